@@ -1,6 +1,8 @@
 #pragma once
 
 #include "data.h"
+#include "LatenessHistogram.h"
+#include "HistoryLog.h"
 
 class BlablaCallbacks
 {
@@ -8,4 +10,9 @@ public:
     virtual void onMessageReceived(MessageType messageType, void* message) = 0;
     
     virtual void onEventStateChange(const Event& event, bool newState) = 0;
+
+    virtual void getLatenessHistogram(LatenessHistogram& histogram) = 0;
+
+    // Returns false when more than maxRecords matched
+    virtual bool getHistory(uint32_t from, uint32_t to, std::vector<HistoryRecord>& records, size_t maxRecords) = 0;
 };
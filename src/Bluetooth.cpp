@@ -4,53 +4,54 @@
 #include "Bluetooth.h"
 #include "BlablaCallbacks.h"
 #include "Storage.h"
+#include "WireFormat.h"
+#include "JsonFormat.h"
 
 #include "data.h"
 
 #include "esp32-hal-log.h"
 #include "cJSON.h"
 
-#define MSG_START_CHAR '$'
-#define MSG_END_CHAR '\n'
-
 #define SERVICE_UUID "0000abcd-6e32-4f94-adf6-b96ebda4c6ce"
 
 #define SET_DATA_CHR_UUID                       "1000b0ea-6e32-4f94-adf6-b96ebda4c6ce"
 #define GET_STATIONS_CHR_UUID                   "1001b0ea-6e32-4f94-adf6-b96ebda4c6ce"
 #define GET_EVENTS_CHR_UUID                     "1002b0ea-6e32-4f94-adf6-b96ebda4c6ce"
 #define NOTIFY_STATION_STATUS_CHR_UUID          "1003b0ea-6e32-4f94-adf6-b96ebda4c6ce"
+#define GET_SCHEDULER_STATS_CHR_UUID            "1004b0ea-6e32-4f94-adf6-b96ebda4c6ce"
+#define GET_HISTORY_CHR_UUID                    "1005b0ea-6e32-4f94-adf6-b96ebda4c6ce"
 
-static std::vector<std::string> s_characteristics = {
-    SET_DATA_CHR_UUID,
-    GET_STATIONS_CHR_UUID,
-    GET_EVENTS_CHR_UUID,
-    NOTIFY_STATION_STATUS_CHR_UUID
-};
+// Caps the size of a history reply, clients page through longer ranges
+#define HISTORY_QUERY_MAX_RECORDS 128
+
+// Longest message accepted on a writable characteristic, per connection. A configuration
+// of 64 stations and 100 events sent as a JSON string fits.
+#define WRITE_MESSAGE_MAX_SIZE 16384
 
 // JSON Helpers
-static cJSON* stationToJson(const Station& station)
+static cJSON* stationToJson(const Storage& storage, const Station& station)
 {
     cJSON* object = cJSON_CreateObject();
     cJSON_AddNumberToObject(object, "id", station.id);
     cJSON_AddNumberToObject(object, "gpio_pin", station.gpio_pin);
-    cJSON_AddStringToObject(object, "name", station.name.c_str());
+    cJSON_AddStringToObject(object, "name", std::string(storage.getStationName(station)).c_str());
     cJSON_AddBoolToObject(object, "is_on", station.is_on);
 
     return object;
 }
 
-static cJSON* stationsToJson(const std::vector<Station>& stations)
+static cJSON* stationsToJson(const Storage& storage, const std::vector<Station>& stations)
 {
 	cJSON* root = cJSON_CreateArray();
     for (const auto& s : stations)
     {
-        cJSON* object = stationToJson(s);
+        cJSON* object = stationToJson(storage, s);
         cJSON_AddItemToArray(root, object);
     }
     return root;
 }
 
-static cJSON* eventToJson(const Event& event)
+static cJSON* eventToJson(const Storage& storage, const Event& event)
 {
     cJSON* object = cJSON_CreateObject();
     cJSON_AddNumberToObject(object, "id", event.id);
@@ -61,24 +62,111 @@ static cJSON* eventToJson(const Event& event)
         cJSON* number = cJSON_CreateNumber(id);
         cJSON_AddItemToArray(stations_array, number);        
     }    
-    cJSON_AddStringToObject(object, "name", event.name.c_str());
-    cJSON_AddStringToObject(object, "cron_expr", event.cron_expr.c_str());
+    cJSON_AddStringToObject(object, "name", std::string(storage.getEventName(event)).c_str());
+    cJSON_AddStringToObject(object, "cron_expr", std::string(storage.getEventCron(event)).c_str());
     cJSON_AddNumberToObject(object, "duration", event.duration);
 
     return object;
 }
 
-static cJSON* eventsToJson(const std::vector<Event>& events)
+static cJSON* eventsToJson(const Storage& storage, const std::vector<Event>& events)
 {
 	cJSON* root = cJSON_CreateArray();
     for (const auto& e : events)
     {
-        cJSON* object = eventToJson(e);
+        cJSON* object = eventToJson(storage, e);
         cJSON_AddItemToArray(root, object);
     }
     return root;
 }
 
+static cJSON* latenessHistogramToJson(const LatenessHistogram& histogram)
+{
+    cJSON* object = cJSON_CreateObject();
+    cJSON_AddNumberToObject(object, "count", histogram.getCount());
+    cJSON_AddNumberToObject(object, "min_ms", histogram.getMinMs());
+    cJSON_AddNumberToObject(object, "max_ms", histogram.getMaxMs());
+    cJSON_AddNumberToObject(object, "last_ms", histogram.getLastMs());
+
+    cJSON* bounds_array = cJSON_AddArrayToObject(object, "bounds_ms");
+    for (size_t i = 0; i < LatenessHistogram::NUM_BOUNDS; i++)
+    {
+        cJSON_AddItemToArray(bounds_array, cJSON_CreateNumber(LatenessHistogram::BUCKET_BOUNDS_MS[i]));
+    }
+    cJSON* buckets_array = cJSON_AddArrayToObject(object, "buckets");
+    for (size_t i = 0; i < LatenessHistogram::NUM_BUCKETS; i++)
+    {
+        cJSON_AddItemToArray(buckets_array, cJSON_CreateNumber(histogram.getBucketCount(i)));
+    }
+
+    return object;
+}
+
+static cJSON* historyToJson(uint32_t from, uint32_t to, const std::vector<HistoryRecord>& records, bool complete)
+{
+    cJSON* object = cJSON_CreateObject();
+    cJSON_AddNumberToObject(object, "from", from);
+    cJSON_AddNumberToObject(object, "to", to);
+    cJSON_AddBoolToObject(object, "complete", complete);
+
+    cJSON* records_array = cJSON_AddArrayToObject(object, "records");
+    for (const auto& r : records)
+    {
+        cJSON* record = cJSON_CreateObject();
+        cJSON_AddNumberToObject(record, "timestamp", r.timestamp);
+        cJSON_AddNumberToObject(record, "station_id", r.station_id);
+        if (r.event_id != HISTORY_NO_EVENT)
+        {
+            cJSON_AddNumberToObject(record, "event_id", r.event_id);
+        }
+        cJSON_AddStringToObject(record, "source", r.source == HISTORY_SOURCE_MANUAL ? "manual" : "event");
+        cJSON_AddBoolToObject(record, "is_on", r.is_on);
+        cJSON_AddNumberToObject(record, "duration", r.duration);
+        cJSON_AddItemToArray(records_array, record);
+    }
+
+    return object;
+}
+
+// Prints and frees the tree, reusing the capacity of 'out'
+static void printJson(cJSON* json, std::string& out)
+{
+    char* json_cstr = cJSON_PrintUnformatted(json);
+    out.assign(json_cstr);
+    cJSON_free(json_cstr);
+    cJSON_Delete(json);
+}
+
+static void stationsToFrame(const Storage& storage, const std::vector<Station>& stations, std::string& out)
+{
+    std::vector<uint8_t> frame;
+    wireBeginFrame(frame, MessageType::GET_STATIONS);
+    for (const auto& s : stations)
+    {
+        wireEncodeStation(frame, s, storage.getStationName(s));
+    }
+    if (!wireFinishFrame(frame))
+    {
+        log_e("Stations don't fit in a frame (%d bytes)", frame.size());
+    }
+    out.assign(frame.begin(), frame.end());
+}
+
+static void eventsToFrame(const Storage& storage, const std::vector<Event>& events, std::string& out)
+{
+    std::vector<uint8_t> frame;
+    wireBeginFrame(frame, MessageType::GET_EVENTS);
+    for (const auto& e : events)
+    {
+        wireEncodeEvent(frame, e, storage.getEventName(e), storage.getEventCron(e));
+    }
+    if (!wireFinishFrame(frame))
+    {
+        log_e("Events don't fit in a frame (%d bytes)", frame.size());
+    }
+    out.assign(frame.begin(), frame.end());
+}
+
 static void advertisingComplete(NimBLEAdvertising *pAdv)
 {
     auto numConnectedDevices = NimBLEDevice::getServer()->getConnectedCount();
@@ -113,25 +201,68 @@ void Bluetooth::setBluetoothCallbacks(BlablaCallbacks* callbacks)
     m_pCallback = callbacks;
 }
 
+const std::string& Bluetooth::getStationsJson()
+{
+    uint32_t revision = m_pStorage->getStationsRevision();
+    if (!m_stationsJson.valid || m_stationsJson.revision != revision)
+    {
+        printJson(stationsToJson(*m_pStorage, to_vector(m_pStorage->getStations())), m_stationsJson.value);
+        m_stationsJson.revision = revision;
+        m_stationsJson.valid = true;
+        log_d("Encoded stations JSON (%d bytes)", m_stationsJson.value.size());
+    }
+    return m_stationsJson.value;
+}
+
+const std::string& Bluetooth::getStationsBinary()
+{
+    uint32_t revision = m_pStorage->getStationsRevision();
+    if (!m_stationsBinary.valid || m_stationsBinary.revision != revision)
+    {
+        stationsToFrame(*m_pStorage, to_vector(m_pStorage->getStations()), m_stationsBinary.value);
+        m_stationsBinary.revision = revision;
+        m_stationsBinary.valid = true;
+        log_d("Encoded stations frame (%d bytes)", m_stationsBinary.value.size());
+    }
+    return m_stationsBinary.value;
+}
+
+const std::string& Bluetooth::getEventsJson()
+{
+    uint32_t revision = m_pStorage->getEventsRevision();
+    if (!m_eventsJson.valid || m_eventsJson.revision != revision)
+    {
+        printJson(eventsToJson(*m_pStorage, to_vector(m_pStorage->getEvents())), m_eventsJson.value);
+        m_eventsJson.revision = revision;
+        m_eventsJson.valid = true;
+        log_d("Encoded events JSON (%d bytes)", m_eventsJson.value.size());
+    }
+    return m_eventsJson.value;
+}
+
+const std::string& Bluetooth::getEventsBinary()
+{
+    uint32_t revision = m_pStorage->getEventsRevision();
+    if (!m_eventsBinary.valid || m_eventsBinary.revision != revision)
+    {
+        eventsToFrame(*m_pStorage, to_vector(m_pStorage->getEvents()), m_eventsBinary.value);
+        m_eventsBinary.revision = revision;
+        m_eventsBinary.valid = true;
+        log_d("Encoded events frame (%d bytes)", m_eventsBinary.value.size());
+    }
+    return m_eventsBinary.value;
+}
+
 void Bluetooth::setStations()
 {
     auto getStationsChr = getCharacteristicByUUIDs(SERVICE_UUID, GET_STATIONS_CHR_UUID);
     if (getStationsChr != nullptr)
-    {   
-        std::vector<Station> stationVec = to_vector(m_pStorage->getStations());
-        auto json = stationsToJson(stationVec);
-        auto json_cstr = cJSON_PrintUnformatted(json);
-        std::string stationsJsonStr(json_cstr);
-        log_i("Stations JSON:\n%s", stationsJsonStr.c_str());
-
-        if (stationsJsonStr[stationsJsonStr.size()-1] != '\n')
+    {
+        setReadValue(getStationsChr, getStationsJson());
+        if (anyConnectionUsesBinary())
         {
-            log_i("Adding newline char to value");
-            stationsJsonStr += "\n";
+            setBinaryReadValue(getStationsChr, getStationsBinary());
         }
-        m_characteristicValues[getStationsChr] = std::make_pair(stationsJsonStr, 0);
-        cJSON_Delete(json);
-        cJSON_free(json_cstr);
     }
 }
 
@@ -139,40 +270,174 @@ void Bluetooth::setEvents()
 {
     auto getEventsChr = getCharacteristicByUUIDs(SERVICE_UUID, GET_EVENTS_CHR_UUID);
     if (getEventsChr != nullptr)
-    {   
-        std::vector<Event> eventsVec = to_vector(m_pStorage->getEvents());
-        auto json = eventsToJson(eventsVec);
+    {
+        setReadValue(getEventsChr, getEventsJson());
+        if (anyConnectionUsesBinary())
+        {
+            setBinaryReadValue(getEventsChr, getEventsBinary());
+        }
+    }
+}
+
+void Bluetooth::setReadValue(NimBLECharacteristic* pCharacteristic, const std::string& json)
+{
+    // Reads are framed by a trailing newline. The value is copied once per change, reads in
+    // progress finish on the value they started with.
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    auto& value = m_characteristicValues[pCharacteristic];
+    if (value && value->size() == json.size() + 1 && value->compare(0, json.size(), json) == 0)
+    {
+        return;
+    }
+    auto framed = std::make_shared<std::string>();
+    framed->reserve(json.size() + 1);
+    framed->assign(json);
+    *framed += '\n';
+    value = framed;
+}
+
+void Bluetooth::setBinaryReadValue(NimBLECharacteristic* pCharacteristic, const std::string& frame)
+{
+    // Frames carry their size, no terminator is needed
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    auto& value = m_binaryValues[pCharacteristic];
+    if (value && *value == frame)
+    {
+        return;
+    }
+    value = std::make_shared<const std::string>(frame);
+}
+
+void Bluetooth::resetReadCursors(NimBLECharacteristic* pCharacteristic)
+{
+    for (auto it = m_readCursors.begin(); it != m_readCursors.end(); )
+    {
+        it = it->first.second == pCharacteristic ? m_readCursors.erase(it) : std::next(it);
+    }
+}
+
+void Bluetooth::setSchedulerStats()
+{
+    auto schedulerStatsChr = getCharacteristicByUUIDs(SERVICE_UUID, GET_SCHEDULER_STATS_CHR_UUID);
+    if (schedulerStatsChr != nullptr && m_pCallback)
+    {
+        LatenessHistogram histogram;
+        m_pCallback->getLatenessHistogram(histogram);
+        auto json = latenessHistogramToJson(histogram);
         auto json_cstr = cJSON_PrintUnformatted(json);
-        std::string eventsJsonStr(json_cstr);
-        log_i("Events JSON:%s", eventsJsonStr.c_str());
-        
-        if (eventsJsonStr[eventsJsonStr.size()-1] != '\n')
+        auto statsJsonStr = std::make_shared<std::string>(json_cstr);
+        log_i("Scheduler stats JSON:%s", statsJsonStr->c_str());
+        *statsJsonStr += "\n";
         {
-            log_i("Adding newline char to value");
-            eventsJsonStr += "\n";
+            std::lock_guard<std::mutex> lock(m_readMutex);
+            m_characteristicValues[schedulerStatsChr] = statsJsonStr;
         }
-        m_characteristicValues[getEventsChr] = std::make_pair(eventsJsonStr, 0);
         cJSON_Delete(json);
         cJSON_free(json_cstr);
     }
 }
 
-void Bluetooth::notifyStationStates() const
+void Bluetooth::setHistory(uint32_t from, uint32_t to)
 {
-    auto stationStatesChr = getCharacteristicByUUIDs(SERVICE_UUID, NOTIFY_STATION_STATUS_CHR_UUID);
-    if (stationStatesChr != nullptr)
-    {        
-        std::vector<Station> stationVec = to_vector(m_pStorage->getStations());
-        auto json = stationsToJson(stationVec);
+    auto historyChr = getCharacteristicByUUIDs(SERVICE_UUID, GET_HISTORY_CHR_UUID);
+    if (historyChr != nullptr && m_pCallback)
+    {
+        std::vector<HistoryRecord> records;
+        bool complete = m_pCallback->getHistory(from, to, records, HISTORY_QUERY_MAX_RECORDS);
+        auto json = historyToJson(from, to, records, complete);
         auto json_cstr = cJSON_PrintUnformatted(json);
-        std::string statesJsonStr(json_cstr);
-        log_i("Notifying Stations states JSON:%s", statesJsonStr.c_str());
-        stationStatesChr->notify(statesJsonStr);
+        auto historyJsonStr = std::make_shared<std::string>(json_cstr);
+        log_i("History has %d records between %u and %u", records.size(), from, to);
+        *historyJsonStr += "\n";
+        {
+            // A new query restarts reads of the previous reply
+            std::lock_guard<std::mutex> lock(m_readMutex);
+            m_characteristicValues[historyChr] = historyJsonStr;
+            resetReadCursors(historyChr);
+        }
         cJSON_Delete(json);
         cJSON_free(json_cstr);
     }
 }
 
+void Bluetooth::notifyStationStates()
+{
+    sendStationStates(-1, false);
+}
+
+void Bluetooth::resyncStationStates(uint16_t connHandle)
+{
+    sendStationStates(connHandle, true);
+}
+
+void Bluetooth::sendStationStates(int connHandle, bool full)
+{
+    auto stationStatesChr = getCharacteristicByUUIDs(SERVICE_UUID, NOTIFY_STATION_STATUS_CHR_UUID);
+    if (stationStatesChr == nullptr)
+    {
+        return;
+    }
+
+    StationBits present, states;
+    for (const auto& station : m_pStorage->getStations())
+    {
+        present[station.id] = true;
+        states[station.id] = station.is_on;
+    }
+
+    // Every connection gets the payload it asked for
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    for (auto& entry : m_connections)
+    {
+        ConnectionState& connection = entry.second;
+        if (!connection.subscribed || (connHandle >= 0 && entry.first != connHandle))
+        {
+            continue;
+        }
+        if (!connection.deltaNotify && connection.binaryProtocol)
+        {
+            const std::string& frame = getStationsBinary();
+            log_d("Notifying stations frame (%d bytes) to %d", frame.size(), entry.first);
+            notifyConnection(stationStatesChr, entry.first, (const uint8_t*)frame.data(), frame.size());
+            continue;
+        }
+        if (!connection.deltaNotify)
+        {
+            const std::string& json = getStationsJson();
+            log_d("Notifying stations states JSON to %d:%s", entry.first, json.c_str());
+            notifyConnection(stationStatesChr, entry.first, (const uint8_t*)json.data(), json.size());
+            continue;
+        }
+
+        std::vector<uint8_t> frame;
+        if (!wireEncodeStateFrame(frame, connection.notifySequence, full, present, states, connection.notifiedStates))
+        {
+            continue;
+        }
+        log_d("Notifying %s state frame #%d (%d bytes) to %d", full ? "full" : "delta", connection.notifySequence,
+            frame.size(), entry.first);
+        connection.notifySequence++;
+        notifyConnection(stationStatesChr, entry.first, frame.data(), frame.size());
+        connection.notifiedStates = states;
+    }
+}
+
+void Bluetooth::notifyConnection(NimBLECharacteristic* pCharacteristic, uint16_t connHandle, const uint8_t* data, size_t size)
+{
+    // NimBLECharacteristic::notify() sends the same value to every subscriber
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(data, size);
+    if (om == nullptr)
+    {
+        log_e("No buffer for a %d byte notification", size);
+        return;
+    }
+    int rc = ble_gattc_notify_custom(connHandle, pCharacteristic->getHandle(), om);
+    if (rc != 0)
+    {
+        log_w("Failed notifying connection %d (%d)", connHandle, rc);
+    }
+}
+
 NimBLECharacteristic* Bluetooth::getCharacteristicByUUIDs(const char* serviceUuid, const char* characteristicUuid) const
 {
     auto pService = m_pServer->getServiceByUUID(serviceUuid);
@@ -193,27 +458,6 @@ NimBLECharacteristic* Bluetooth::getCharacteristicByUUIDs(const char* serviceUui
     return pCharacteristic;
 }
 
-void Bluetooth::setCharacteristicValue(NimBLECharacteristic* pCharacteristic, const std::string& value)
-{
-    log_i("Setting value of %s to %s", pCharacteristic->toString().c_str(), value.c_str());
-    auto max_size = std::min((std::size_t)NimBLEDevice::getMTU(), value.length());
-    log_i("Max size is %d, value length is %d", max_size, value.length());
-
-    std::string substr = value.substr(0, max_size);
-    int& bytes_sent = m_characteristicValues[pCharacteristic].second;
-
-    bytes_sent += substr.length();
-    log_i("Setting value to substring %s", substr.c_str());
-    pCharacteristic->setValue(substr);
-
-    const std::string& full_value = m_characteristicValues[pCharacteristic].first;
-    if (bytes_sent == full_value.length())
-    {
-        log_i("Full value sent. Resetting to 0");
-        bytes_sent = 0;
-    }
-}
-
 void Bluetooth::setupCharacteristic()
 {        
     NimBLEService *pService = m_pServer->createService(SERVICE_UUID);
@@ -221,18 +465,17 @@ void Bluetooth::setupCharacteristic()
     NimBLECharacteristic *setDataChr = pService->createCharacteristic(SET_DATA_CHR_UUID, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_ENC | NIMBLE_PROPERTY::WRITE_AUTHEN);
 
     NimBLECharacteristic *notifyStationChangedChr = pService->createCharacteristic(NOTIFY_STATION_STATUS_CHR_UUID, NIMBLE_PROPERTY::NOTIFY);
+    NimBLECharacteristic *getSchedulerStatsChr = pService->createCharacteristic(GET_SCHEDULER_STATS_CHR_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::READ_ENC | NIMBLE_PROPERTY::READ_AUTHEN);
+    NimBLECharacteristic *getHistoryChr = pService->createCharacteristic(GET_HISTORY_CHR_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::READ_ENC | NIMBLE_PROPERTY::READ_AUTHEN);
     
     NimBLECharacteristic *getEventsChr = pService->createCharacteristic(GET_EVENTS_CHR_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::READ_ENC | NIMBLE_PROPERTY::READ_AUTHEN);        
 
 
-    for (auto& chr : s_characteristics)
-    {
-        m_characteristicsBuffers[chr] = std::vector<char>();    
-    }
-
     getStationsChr->setCallbacks(this);
     setDataChr->setCallbacks(this);
     notifyStationChangedChr->setCallbacks(this);
+    getSchedulerStatsChr->setCallbacks(this);
+    getHistoryChr->setCallbacks(this);
     getEventsChr->setCallbacks(this);
     pService->start();
 }
@@ -244,69 +487,107 @@ void Bluetooth::start()
     pAdvertising->start(0, &advertisingComplete);
 }
 
-void Bluetooth::onConnect(NimBLEServer* pServer)
+void Bluetooth::onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc)
 {
     log_d("Device connected. stopping advertising");
     NimBLEDevice::getAdvertising()->stop();
 
-    log_d("Resetting write buffers");
-    for (auto& chr : s_characteristics)
+    log_d("Resetting read cursors");
     {
-        m_characteristicsBuffers[chr] = std::vector<char>();    
-    }
-    log_d("Resetting read buffers");
-    for (auto& value : m_characteristicValues)
-    {
-        value.second.second = 0;
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        for (auto it = m_readCursors.begin(); it != m_readCursors.end(); )
+        {
+            it = it->first.first == desc->conn_handle ? m_readCursors.erase(it) : std::next(it);
+        }
+        m_connections[desc->conn_handle] = ConnectionState();
     }
 }
 
-void Bluetooth::onDisconnect(NimBLEServer* pServer)
+void Bluetooth::onDisconnect(NimBLEServer* pServer, ble_gap_conn_desc* desc)
 {    
     log_d("Device disconnected.");
-}
-
-void Bluetooth::onRead(NimBLECharacteristic* pCharacteristic) {
-    auto value = pCharacteristic->getValue();
-    auto total_length = m_characteristicValues[pCharacteristic].first.length();
-    auto last_read_pos = m_characteristicValues[pCharacteristic].second;
-    log_i("Total length: %d, last read pos: %d", total_length, last_read_pos);
-    int remaining_length = total_length - last_read_pos;
-    if (remaining_length > 0)
+    // Drops the connection's partial writes and frees their buffers
+    for (auto it = m_writeBuffers.begin(); it != m_writeBuffers.end(); )
     {
-        std::string new_value = m_characteristicValues[pCharacteristic].first.substr(last_read_pos);
-        setCharacteristicValue(pCharacteristic, new_value);
+        it = it->first.first == desc->conn_handle ? m_writeBuffers.erase(it) : std::next(it);
     }
-    log_i("Sending value %s", pCharacteristic->getValue().c_str());
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    for (auto it = m_readCursors.begin(); it != m_readCursors.end(); )
+    {
+        it = it->first.first == desc->conn_handle ? m_readCursors.erase(it) : std::next(it);
+    }
+    m_connections.erase(desc->conn_handle);
 }
 
-void Bluetooth::onWrite(NimBLECharacteristic* pCharacteristic) {
-    std::string characteristicStr = pCharacteristic->getUUID().toString();
-    std::string value_str(pCharacteristic->getValue().c_str());
-    if (value_str.empty())
+void Bluetooth::onRead(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc) {
+    // Every read returns the next window of the value, sized to the connection's MTU. The
+    // client reads until the newline (JSON) or the frame size (binary).
+    auto key = std::make_pair(desc->conn_handle, pCharacteristic);
+    bool start;
+    {
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        auto cursor = m_readCursors.find(key);
+        start = cursor == m_readCursors.end();
+    }
+    if (start && pCharacteristic->getUUID() == NimBLEUUID(GET_SCHEDULER_STATS_CHR_UUID))
     {
-        value_str = "$\n";
+        // Take a fresh snapshot at the start of every read
+        setSchedulerStats();
     }
-    log_i("%s: value: %s (%s)", characteristicStr.c_str(), pCharacteristic->getValue().c_str(), value_str.c_str());
 
-    auto& buffer = m_characteristicsBuffers[characteristicStr];
-    if (value_str.at(0) == MSG_START_CHAR)
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    auto& cursor = m_readCursors[key];
+    if (start)
     {
-        value_str = value_str.substr(1);
-        log_i("Found start of message. Resetting buffer. Using incoming message %s", value_str.c_str());
-        buffer = std::vector<char>();
+        // Characteristics without a binary payload are read as JSON in both protocols
+        auto connection = m_connections.find(desc->conn_handle);
+        auto binary = m_binaryValues.find(pCharacteristic);
+        bool useBinary = connection != m_connections.end() && connection->second.binaryProtocol && binary != m_binaryValues.end();
+        cursor.value = useBinary ? binary->second : m_characteristicValues[pCharacteristic];
+        cursor.offset = 0;
+    }
+    if (!cursor.value)
+    {
+        pCharacteristic->setValue((const uint8_t*)"", 0);
+        m_readCursors.erase(key);
+        return;
     }
 
-    log_i("Buffer length is %d", buffer.size());
-    buffer.insert(buffer.end(), value_str.begin(), value_str.end());
-    std::string buffer_string(buffer.begin(), buffer.end());
-    log_i("Added %d chars to buffer. New buffer length is %d (%s)", value_str.length(), buffer.size(), buffer_string.c_str());
-    if (buffer[buffer.size()-1] == MSG_END_CHAR)
+    // A read response carries MTU - 1 bytes
+    size_t mtu = std::max<size_t>(m_pServer->getPeerMTU(desc->conn_handle), BLE_ATT_MTU_DFLT);
+    size_t length = std::min(cursor.value->size() - cursor.offset, mtu - 1);
+    pCharacteristic->setValue((const uint8_t*)cursor.value->data() + cursor.offset, length);
+    cursor.offset += length;
+    log_d("Read %d bytes of %d, at %d", length, cursor.value->size(), cursor.offset);
+    if (cursor.offset == cursor.value->size())
     {
-        log_i("Found end of message. Parsing");
+        m_readCursors.erase(key);
+    }
+}
 
-        parseCharacteristicWrite(buffer);
+void Bluetooth::onWrite(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc) {
+    auto key = std::make_pair(desc->conn_handle, pCharacteristic);
+    auto buffer = m_writeBuffers.find(key);
+    if (buffer == m_writeBuffers.end())
+    {
+        buffer = m_writeBuffers.emplace(key, WriteReassembler(WRITE_MESSAGE_MAX_SIZE)).first;
     }
+
+    auto value = pCharacteristic->getValue();
+    log_d("%s: %d bytes written", pCharacteristic->getUUID().toString().c_str(), value.length());
+    uint16_t connHandle = desc->conn_handle;
+    buffer->second.feed((const uint8_t*)value.data(), value.length(),
+        [this, connHandle](WriteReassembler::Kind kind, uint8_t* data, size_t size)
+        {
+            if (kind == WriteReassembler::BINARY)
+            {
+                parseBinaryWrite(connHandle, data, size);
+            }
+            else
+            {
+                parseCharacteristicWrite(connHandle, (char*)data, size);
+            }
+        });
 }
 
 void Bluetooth::onNotify(NimBLECharacteristic* pCharacteristic) {
@@ -314,91 +595,183 @@ void Bluetooth::onNotify(NimBLECharacteristic* pCharacteristic) {
     log_i(": onNotify(), value: %s", pCharacteristic->getValue().c_str());
 }
 
-void Bluetooth::parseCharacteristicWrite(const std::vector<char>& buffer) const
+void Bluetooth::onSubscribe(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc, uint16_t subValue)
 {
-    cJSON *json = cJSON_Parse(&buffer[0]);
-    if (json == NULL)
+    // Only station states are notified
+    if (pCharacteristic->getUUID() != NimBLEUUID(NOTIFY_STATION_STATUS_CHR_UUID))
     {
-        const char *error_ptr = cJSON_GetErrorPtr();
-        if (error_ptr != NULL)
-        {
-            log_e("cJSON Error: %s", error_ptr);
-        }
-        else
-        {
-            log_e("cJSON - Unknown parsing error");
-        }
         return;
     }
-    auto messageTypeInt = cJSON_GetObjectItemCaseSensitive(json, "type");
-    if (!cJSON_IsNumber(messageTypeInt) || messageTypeInt->valueint >= MessageType::MAX)
+    log_d("Connection %d %s station states", desc->conn_handle, subValue != 0 ? "subscribed to" : "unsubscribed from");
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    m_connections[desc->conn_handle].subscribed = subValue != 0;
+}
+
+// Decoders of the JSON and binary messages, for handleMessage
+struct JsonDecoders
+{
+    static bool setTime(JsonReader data, SetTimeMessage& message) { return jsonDecodeSetTime(data, message); }
+    static bool setStationState(JsonReader data, SetStationStateMessage& message) { return jsonDecodeSetStationState(data, message); }
+    static bool requestNotify(JsonReader data, int& mode) { return jsonDecodeRequestNotify(data, mode); }
+    static bool getHistory(JsonReader data, uint32_t& from, uint32_t& to) { return jsonDecodeGetHistory(data, from, to); }
+    static bool setConfig(JsonReader data, SetConfigMessage& message) { return jsonDecodeSetConfig(data, message); }
+    static bool setProtocol(JsonReader data, bool& binary) { return jsonDecodeSetProtocol(data, binary); }
+};
+
+struct WireDecoders
+{
+    static bool setTime(RecordReader payload, SetTimeMessage& message) { return wireDecodeSetTime(payload, message); }
+    static bool setStationState(RecordReader payload, SetStationStateMessage& message) { return wireDecodeSetStationState(payload, message); }
+    static bool requestNotify(RecordReader payload, int& mode) { return wireDecodeRequestNotify(payload, mode); }
+    static bool getHistory(RecordReader payload, uint32_t& from, uint32_t& to) { return wireDecodeGetHistory(payload, from, to); }
+    static bool setConfig(RecordReader payload, SetConfigMessage& message) { return wireDecodeSetConfig(payload, message); }
+    static bool setProtocol(RecordReader payload, bool& binary) { return wireDecodeSetProtocol(payload, binary); }
+};
+
+void Bluetooth::parseCharacteristicWrite(uint16_t connHandle, char* message, size_t size)
+{
+    // The data sent as a string is unescaped in place, the message is consumed
+    int type;
+    JsonReader data;
+    if (!jsonDecodeMessage(message, size, type, data))
     {
-        log_e("Unknown message type received");
+        log_e("Invalid message, it needs to be a JSON object with a data object");
         return;
     }
-    if (!cJSON_HasObjectItem(json, "data"))
+    handleMessage<JsonDecoders>(connHandle, type, data);
+}
+
+void Bluetooth::parseBinaryWrite(uint16_t connHandle, const uint8_t* frame, size_t size)
+{
+    RecordReader reader(frame, size);
+    RecordReader payload;
+    uint8_t type;
+    if (!wireDecodeFrame(reader, type, payload))
     {
-        log_e("Message doesn't have data object");
+        log_e("Invalid binary frame");
         return;
     }
-    auto dataJsonStr = cJSON_GetObjectItem(json, "data");
-    auto dataJson = cJSON_Parse(dataJsonStr->valuestring);
-    if (dataJson == NULL)
+    handleMessage<WireDecoders>(connHandle, type, payload);
+}
+
+template <class Decoders, class Payload>
+void Bluetooth::handleMessage(uint16_t connHandle, int type, Payload payload)
+{
+    bool ok = true;
+    switch (type)
     {
-        const char *error_ptr = cJSON_GetErrorPtr();
-        if (error_ptr != NULL)
-        {
-            log_e("data cJSON Error: %s", error_ptr);
-        }
-        else
+        case SET_TIME:
         {
-            log_e("data cJSON - Unknown parsing error");
+            SetTimeMessage message;
+            ok = Decoders::setTime(payload, message);
+            if (ok && m_pCallback)
+            {
+                m_pCallback->onMessageReceived(MessageType::SET_TIME, (void*)&message);
+            }
         }
-        return;
-    }
-    auto messageType = static_cast<MessageType>(messageTypeInt->valueint);
-    switch(messageType)
-    {
-        case SET_TIME:
-            parseSetTime(dataJson);
         break;
         case SET_STATION_STATE:
-            parseSetStationState(dataJson);
+        {
+            SetStationStateMessage message;
+            ok = Decoders::setStationState(payload, message);
+            if (ok && m_pCallback)
+            {
+                m_pCallback->onMessageReceived(MessageType::SET_STATION_STATE, (void*)&message);
+            }
+        }
         break;
         case REQUEST_NOTIFY:
-            notifyStationStates();
+        {
+            int mode;
+            ok = Decoders::requestNotify(payload, mode);
+            if (ok)
+            {
+                requestNotify(connHandle, mode);
+            }
+        }
+        break;
+        case GET_HISTORY:
+        {
+            // The reply is read from the history characteristic
+            uint32_t from, to;
+            ok = Decoders::getHistory(payload, from, to);
+            if (ok)
+            {
+                setHistory(from, to);
+            }
+        }
+        break;
+        case SET_CONFIG:
+        {
+            // Nothing is applied unless the whole configuration is valid
+            SetConfigMessage message;
+            ok = Decoders::setConfig(payload, message);
+            if (ok && m_pCallback)
+            {
+                m_pCallback->onMessageReceived(MessageType::SET_CONFIG, (void*)&message);
+            }
+        }
+        break;
+        case SET_PROTOCOL:
+        {
+            bool binary;
+            ok = Decoders::setProtocol(payload, binary);
+            if (ok)
+            {
+                setProtocol(connHandle, binary);
+            }
+        }
         break;
 
         default:
+            log_e("Unknown message type %d received", type);
         break;
     }
-    cJSON_free(json);
+    if (!ok)
+    {
+        log_e("Invalid data in message of type %d", type);
+    }
 }
 
-void Bluetooth::parseSetTime(const cJSON* json) const
-{    
+void Bluetooth::requestNotify(uint16_t connHandle, int mode)
+{
+    if (mode >= 0)
+    {
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        m_connections[connHandle].deltaNotify = mode == 1;
+        log_i("Station states are notified to %d as %s", connHandle, mode == 1 ? "delta frames" : "full payloads");
+    }
+    // The owner notifies under its lock, the payload is built from Storage. Only the
+    // requesting connection is sent the full states.
     if (m_pCallback)
     {
-        SetTimeMessage message;        
-        auto tv_sec = cJSON_GetObjectItemCaseSensitive(json, "tv_sec");
-        auto tv_usec = cJSON_GetObjectItemCaseSensitive(json, "tv_usec");
-        auto tz_str = cJSON_GetObjectItemCaseSensitive(json, "tz_str");
-        message.timeval.tv_sec = cJSON_IsNumber(tv_sec) ? tv_sec->valueint : 0;
-        message.timeval.tv_usec = cJSON_IsNumber(tv_usec) ? tv_usec->valueint : 0;
-        message.tz = cJSON_IsString(tz_str) ? tz_str->valuestring : "";
-        m_pCallback->onMessageReceived(MessageType::SET_TIME, (void*)&message);
+        m_pCallback->onMessageReceived(MessageType::REQUEST_NOTIFY, &connHandle);
     }
 }
 
-void Bluetooth::parseSetStationState(const cJSON* json) const
+void Bluetooth::setProtocol(uint16_t connHandle, bool binary)
 {
+    {
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        m_connections[connHandle].binaryProtocol = binary;
+    }
+    log_i("Connection %d uses the %s protocol", connHandle, binary ? "binary" : "JSON");
+    // The owner refreshes the read values under its lock, the binary ones are built from Storage
     if (m_pCallback)
     {
-        SetStationStateMessage message;
-        auto id = cJSON_GetObjectItemCaseSensitive(json, "station_id");
-        auto state = cJSON_GetObjectItemCaseSensitive(json, "is_on");
-        message.station_id = cJSON_IsNumber(id) ? id->valueint : -1;
-        message.is_on = cJSON_IsBool(state) ? cJSON_IsTrue(state) : false;
-        m_pCallback->onMessageReceived(MessageType::SET_STATION_STATE, (void*)&message);
+        m_pCallback->onMessageReceived(MessageType::SET_PROTOCOL, nullptr);
+    }
+}
+
+bool Bluetooth::anyConnectionUsesBinary()
+{
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    for (const auto& entry : m_connections)
+    {
+        if (entry.second.binaryProtocol)
+        {
+            return true;
+        }
     }
+    return false;
 }
@@ -1,15 +1,19 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <bitset>
 
 #include <NimBLEDevice.h>
 
 #include "data.h"
+#include "WriteReassembler.h"
 
 class BlablaCallbacks;
 class Storage;
-class cJSON;
 
 class Bluetooth : public NimBLECharacteristicCallbacks, public NimBLEServerCallbacks
 {
@@ -18,35 +22,106 @@ public:
 
     void start();
     void setBluetoothCallbacks(BlablaCallbacks* callbacks);
+    // The stations and events payloads are encoded once per Storage revision, these must be
+    // called with the owner's lock held. The binary payloads are only kept up to date while
+    // a connection uses the binary protocol.
     void setStations();
     void setEvents();
-    void notifyStationStates() const;
+    // Notifies every subscribed connection of the stations JSON (the stations frame with the
+    // binary protocol), or in delta mode of a frame with the stations whose state changed
+    // since its previous one
+    void notifyStationStates();
+    // Same for a single connection, in delta mode with every station's state
+    void resyncStationStates(uint16_t connHandle);
+    void setSchedulerStats();
+    // Fills the history characteristic with the records logged between from and to
+    void setHistory(uint32_t from, uint32_t to);
 
 private:
 
     // Server callbacks
-    void onConnect(NimBLEServer* pServer) override;
-    void onDisconnect(NimBLEServer* pServer) override;
+    void onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override;
+    void onDisconnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override;
 
     // Characteristics callbacks
-    void onRead(NimBLECharacteristic* pCharacteristic) override;
-    void onWrite(NimBLECharacteristic* pCharacteristic) override;
+    void onRead(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc) override;
+    void onWrite(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc) override;
     void onNotify(NimBLECharacteristic* pCharacteristic) override;
+    void onSubscribe(NimBLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc, uint16_t subValue) override;
 
-    void setCharacteristicValue(NimBLECharacteristic* pCharacteristic, const std::string& value);
+    void setReadValue(NimBLECharacteristic* pCharacteristic, const std::string& json);
+    void setBinaryReadValue(NimBLECharacteristic* pCharacteristic, const std::string& frame);
+    // Must be called with m_readMutex held
+    void resetReadCursors(NimBLECharacteristic* pCharacteristic);
+
+    // Position of a connection in a value it is reading, which stays alive until it is done
+    struct ReadCursor
+    {
+        std::shared_ptr<const std::string> value;
+        size_t offset = 0;
+    };
+
+    // What a connection subscribed to and selected with its messages
+    struct ConnectionState
+    {
+        bool subscribed = false;
+        // Message protocol, set by SET_PROTOCOL
+        bool binaryProtocol = false;
+        // Station states are notified as delta frames, set by REQUEST_NOTIFY
+        bool deltaNotify = false;
+        uint16_t notifySequence = 0;
+        std::bitset<StationTable::MAX_IDS> notifiedStates;
+    };
+
+    // Last encoded payload of a table and the Storage revision it was encoded from
+    struct CachedPayload
+    {
+        bool valid = false;
+        uint32_t revision = 0;
+        std::string value;
+    };
+
+    const std::string& getStationsJson();
+    const std::string& getEventsJson();
+    const std::string& getStationsBinary();
+    const std::string& getEventsBinary();
 
     void setupCharacteristic();
 
     NimBLECharacteristic* getCharacteristicByUUIDs(const char* serviceUuid, const char* characteristicUuid) const;
 
-    void parseCharacteristicWrite(const std::vector<char>& buffer) const;
-    void parseSetTime(const cJSON* json) const;
-    void parseSetStationState(const cJSON* json) const;
+    // connHandle -1 notifies every subscribed connection
+    void sendStationStates(int connHandle, bool full);
+    // Must be called with m_readMutex held
+    void notifyConnection(NimBLECharacteristic* pCharacteristic, uint16_t connHandle, const uint8_t* data, size_t size);
+
+    void parseCharacteristicWrite(uint16_t connHandle, char* message, size_t size);
+    void parseBinaryWrite(uint16_t connHandle, const uint8_t* frame, size_t size);
+    // Decodes the message with Decoders (see Bluetooth.cpp) and passes it on
+    template <class Decoders, class Payload>
+    void handleMessage(uint16_t connHandle, int type, Payload payload);
+
+    // 'mode' is 1 for delta frames, 0 for JSON and -1 to keep the current one
+    void requestNotify(uint16_t connHandle, int mode);
+    void setProtocol(uint16_t connHandle, bool binary);
+    bool anyConnectionUsesBinary();
 
     NimBLEServer* m_pServer;
     Storage* m_pStorage;
 
     BlablaCallbacks* m_pCallback;
-    std::map<NimBLECharacteristic*, std::pair<std::string, int>> m_characteristicValues;
-    std::map<std::string, std::vector<char>> m_characteristicsBuffers;
+    // Read values are set from the owner's task and read from the NimBLE task, the
+    // connection states are set from the NimBLE task and used by both
+    std::mutex m_readMutex;
+    std::map<NimBLECharacteristic*, std::shared_ptr<const std::string>> m_characteristicValues;
+    // Read values served instead of the JSON ones while binary is selected
+    std::map<NimBLECharacteristic*, std::shared_ptr<const std::string>> m_binaryValues;
+    std::map<std::pair<uint16_t, NimBLECharacteristic*>, ReadCursor> m_readCursors;
+    // Messages being written, per connection handle and characteristic
+    std::map<std::pair<uint16_t, NimBLECharacteristic*>, WriteReassembler> m_writeBuffers;
+    std::map<uint16_t, ConnectionState> m_connections;
+    CachedPayload m_stationsJson;
+    CachedPayload m_eventsJson;
+    CachedPayload m_stationsBinary;
+    CachedPayload m_eventsBinary;
 };
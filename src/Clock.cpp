@@ -0,0 +1,27 @@
+#include "Clock.h"
+
+#include <sys/time.h>
+
+#include "esp_timer.h"
+
+class SystemClock : public Clock
+{
+public:
+    uint64_t getWallMs() const override
+    {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+    }
+
+    int64_t getMonotonicMs() const override
+    {
+        return esp_timer_get_time() / 1000;
+    }
+};
+
+Clock& Clock::system()
+{
+    static SystemClock clock;
+    return clock;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Where the schedulers read the time from, host tests pass a fake one to step it by hand
+class Clock
+{
+public:
+    virtual ~Clock() {}
+
+    // Milliseconds since the epoch, jumps when the time is set
+    virtual uint64_t getWallMs() const = 0;
+    // Milliseconds since boot, never goes back
+    virtual int64_t getMonotonicMs() const = 0;
+
+    // gettimeofday and esp_timer
+    static Clock& system();
+};
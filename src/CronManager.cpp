@@ -1,11 +1,16 @@
 
 #include "CronManager.h"
 #include "BlablaCallbacks.h"
+#include "Storage.h"
+#include "Clock.h"
 
 #include "esp32-hal-log.h"
-#include "ccronexpr.h"
 
-#include <TmLongSchedule.h>
+CronManager::CronManager(Storage* storage, Clock* clock) :
+    m_pStorage(storage),
+    m_clock(clock != nullptr ? clock : &Clock::system())
+{
+}
 
 void CronManager::setCronCallbacks(BlablaCallbacks* callbacks)
 {
@@ -14,73 +19,210 @@ void CronManager::setCronCallbacks(BlablaCallbacks* callbacks)
 
 void CronManager::loop()
 {
-    taskManager.runLoop();
+    uint64_t now = nowMs();
+    DeadlineQueue::Entry entry;
+    while (!m_queue.empty() && m_queue.peek()->deadline <= now)
+    {
+        m_queue.pop(entry);
+        fireTransition(entry);
+    }
 }
 
-time_t CronManager::getNextRun(const Event& event)
+uint64_t CronManager::nowMs() const
+{
+    return m_clock->getWallMs();
+}
+
+CronManager::CompiledSchedule* CronManager::getSchedule(const Event& event)
 {
-    struct timeval now;
-    gettimeofday(&now, NULL);
+    auto it = m_schedules.find(event.id);
+    if (it != m_schedules.end())
+    {
+        return &it->second;
+    }
 
     const char *error = NULL;
-    cron_expr expression;
-    memset(&expression, 0, sizeof(expression));
-    cron_parse_expr(event.cron_expr.c_str(), &expression, &error);
-    time_t next_run = cron_next(&expression, now.tv_sec);
-    return next_run - now.tv_sec;
+    CompiledSchedule schedule;
+    memset(&schedule.expr, 0, sizeof(schedule.expr));
+    std::string cronExpr(m_pStorage->getEventCron(event));
+    cron_parse_expr(cronExpr.c_str(), &schedule.expr, &error);
+    if (error != NULL)
+    {
+        log_e("Failed parsing cron expression '%s' of event %d: %s", cronExpr.c_str(), event.id, error);
+        return nullptr;
+    }
+    schedule.next_fire = 0;
+
+    log_d("Compiled cron expression '%s' of event %d", cronExpr.c_str(), event.id);
+    return &(m_schedules[event.id] = schedule);
 }
 
-void CronManager::addEvent(const Event& event)
+time_t CronManager::getNextRun(const Event& event)
 {
-    if (m_jobs.find(event.id) != m_jobs.end())
+    auto schedule = getSchedule(event);
+    if (schedule == nullptr)
     {
-        log_w("Job ID already exists. Please remove before adding");
-        return;
+        return -1;
     }
-    
+
+    time_t now = (time_t)(nowMs() / 1000);
+
+    // Only walk the calendar again once the cached fire time has passed
+    if (schedule->next_fire <= now)
+    {
+        schedule->next_fire = cron_next(&schedule->expr, now);
+        if (schedule->next_fire == (time_t)-1)
+        {
+            log_e("No next run for event %d", event.id);
+            schedule->next_fire = 0;
+            return -1;
+        }
+    }
+    return schedule->next_fire;
+}
+
+bool CronManager::scheduleNextRun(const Event& event)
+{
     time_t next_run = getNextRun(event);
-    
-    log_d("[addEvent] - next run is in %ld seconds\n", next_run);
-    
-    auto taskId = taskManager.registerEvent(new TmLongSchedule(next_run*1000, [this, event]() {
-        // Turn station on
-        if (m_pCallback)
+    if (next_run < 0)
+    {
+        log_e("Failed calculating next run of event %d", event.id);
+        return false;
+    }
+
+    log_d("[scheduleNextRun] - next run of event %d is at %ld\n", event.id, next_run);
+    m_queue.push(transitionKey(event.id, true), (uint64_t)next_run * 1000);
+    return true;
+}
+
+void CronManager::fireTransition(const DeadlineQueue::Entry& entry)
+{
+    uint32_t eventId = entry.key >> 1;
+    bool newState = (entry.key & 1) != 0;
+
+    int64_t latenessMs = (int64_t)(nowMs() - entry.deadline);
+    m_lateness.record(latenessMs);
+    log_d("Event %d turning %s %lld ms late", eventId, (newState ? "ON" : "OFF"), latenessMs);
+
+    if (!newState)
+    {
+        switchOff(eventId);
+        // The event may have been removed from Storage while it was running
+        const Event* event = m_pStorage->getEvent(eventId);
+        if (m_eventIds.find(eventId) == m_eventIds.end() || event == nullptr)
         {
-            m_pCallback->onEventStateChange(event, true);
+            removeEvent(eventId);
+            return;
         }
+        // Start the next run
+        scheduleNextRun(*event);
+        return;
+    }
 
-        // Schedule the off event
-        auto offTaskId = taskManager.registerEvent(new TmLongSchedule(event.duration*1000, [this, event]() {
-            // Turn station off            
-            if (m_pCallback)
-            {
-                m_pCallback->onEventStateChange(event, false);
-            }
+    const Event* event = m_pStorage->getEvent(eventId);
+    if (event == nullptr)
+    {
+        log_w("Transition fired for event %d which is no longer stored, dropping it", eventId);
+        removeEvent(eventId);
+        return;
+    }
 
-            // Remove the event and re-add it to start next run
-            m_jobs.erase(event.id);
-            addEvent(event);
-        }, true), true);
+    // The off transition is relative to when the event should have started, so lateness doesn't accumulate
+    switchOn(*event, entry.deadline);
+}
 
-        m_jobs[event.id] = offTaskId;
+void CronManager::switchOn(const Event& event, uint64_t startMs)
+{
+    uint32_t eventId = event.id;
+    m_running[eventId] = Event(event.id, event.stations_ids, "", "", event.duration);
+    if (m_pCallback)
+    {
+        m_pCallback->onEventStateChange(event, true);
+    }
+
+    // The callback may have removed or replaced the event
+    auto running = m_running.find(eventId);
+    if (running == m_running.end())
+    {
+        return;
+    }
+
+    m_queue.push(transitionKey(eventId, false), startMs + (uint64_t)running->second.duration * 1000);
+}
+
+void CronManager::switchOff(uint32_t eventId)
+{
+    auto it = m_running.find(eventId);
+    if (it == m_running.end())
+    {
+        return;
+    }
+    Event event = std::move(it->second);
+    m_running.erase(it);
+    if (m_pCallback)
+    {
+        m_pCallback->onEventStateChange(event, false);
+    }
+}
 
-    }, true), true);
+void CronManager::addEvent(uint32_t eventId)
+{
+    if (m_eventIds.find(eventId) != m_eventIds.end())
+    {
+        log_w("Job ID already exists. Please remove before adding");
+        return;
+    }
 
-    if (taskId == TASKMGR_INVALIDID)
+    const Event* event = m_pStorage->getEvent(eventId);
+    if (event == nullptr)
     {
-        log_e("Failed scheduling task");
+        log_e("Can't schedule event %d, it isn't stored", eventId);
         return;
     }
-    m_jobs[event.id] = taskId;
+
+    if (scheduleNextRun(*event))
+    {
+        m_eventIds.insert(eventId);
+    }
 }
 
-void CronManager::removeEvent(const Event& event)
+void CronManager::removeEvent(uint32_t eventId)
 {
-    auto it = m_jobs.find(event.id);
-    if (it != m_jobs.end())
+    switchOff(eventId);
+    m_queue.cancel(transitionKey(eventId, true));
+    m_queue.cancel(transitionKey(eventId, false));
+    m_eventIds.erase(eventId);
+    m_schedules.erase(eventId);
+}
+
+void CronManager::applyDiff(const StorageDiff& diff)
+{
+    for (auto eventId : diff.removedEvents)
+    {
+        removeEvent(eventId);
+    }
+    for (auto eventId : diff.addedEvents)
+    {
+        addEvent(eventId);
+    }
+    for (auto eventId : diff.changedEvents)
     {
-        taskManager.cancelTask(it->second);
-        m_jobs.erase(event.id);
+        if (m_eventIds.find(eventId) == m_eventIds.end())
+        {
+            addEvent(eventId);
+            continue;
+        }
+        // A running event finishes with its old stations and duration, its next run follows
+        // the new schedule. A waiting one is rescheduled.
+        m_schedules.erase(eventId);
+        if (m_queue.cancel(transitionKey(eventId, true)))
+        {
+            const Event* event = m_pStorage->getEvent(eventId);
+            if (event == nullptr || !scheduleNextRun(*event))
+            {
+                removeEvent(eventId);
+            }
+        }
     }
 }
 
@@ -89,12 +231,73 @@ void CronManager::begin()
     log_i("Starting cron manager");
 }
 
-taskid_t CronManager::getTaskId(uint32_t eventId) const
+void CronManager::resumeRunningEvents()
 {
-    auto it = m_jobs.find(eventId);
-    if (it != m_jobs.end())
+    time_t now = (time_t)(nowMs() / 1000);
+    // Switching on may call back into removeEvent, don't iterate the set itself
+    std::vector<uint32_t> eventIds(m_eventIds.begin(), m_eventIds.end());
+    for (auto eventId : eventIds)
     {
-        return it->second;
+        const Event* event = m_pStorage->getEvent(eventId);
+        if (event == nullptr || m_running.find(eventId) != m_running.end() || !m_queue.contains(transitionKey(eventId, true)))
+        {
+            continue;
+        }
+        auto schedule = getSchedule(*event);
+        if (schedule == nullptr)
+        {
+            continue;
+        }
+        // The first run ending after now, it's going if it already started
+        time_t start = cron_next(&schedule->expr, now - (time_t)event->duration);
+        if (start == (time_t)-1 || start > now)
+        {
+            continue;
+        }
+        log_i("Resuming event %d, started at %ld", eventId, start);
+        m_queue.cancel(transitionKey(eventId, true));
+        switchOn(*event, (uint64_t)start * 1000);
+    }
+}
+
+bool CronManager::isScheduled(uint32_t eventId) const
+{
+    return m_queue.contains(transitionKey(eventId, true)) || m_queue.contains(transitionKey(eventId, false));
+}
+
+int64_t CronManager::getMsUntilNextDeadline() const
+{
+    auto next = m_queue.peek();
+    if (next == nullptr)
+    {
+        return -1;
+    }
+    uint64_t now = nowMs();
+    return next->deadline > now ? (int64_t)(next->deadline - now) : 0;
+}
+
+void CronManager::onTimeChanged(int64_t deltaMs)
+{
+    log_i("Time changed by %lld ms, rescheduling %d events", deltaMs, m_eventIds.size());
+    for (auto eventId : m_eventIds)
+    {
+        uint64_t offDeadline;
+        if (m_queue.getDeadline(transitionKey(eventId, false), offDeadline))
+        {
+            // The event is running, keep its remaining duration
+            m_queue.push(transitionKey(eventId, false), (uint64_t)((int64_t)offDeadline + deltaMs));
+            continue;
+        }
+
+        auto it = m_schedules.find(eventId);
+        if (it != m_schedules.end())
+        {
+            it->second.next_fire = 0;
+        }
+        const Event* event = m_pStorage->getEvent(eventId);
+        if (event != nullptr)
+        {
+            scheduleNextRun(*event);
+        }
     }
-    return TASKMGR_INVALIDID;
 }
@@ -1,35 +1,90 @@
 #pragma once
 
 #include <map>
+#include <set>
 
 #include "BlablaCallbacks.h"
-
-#include <TaskManagerIO.h>
+#include "DeadlineQueue.h"
+#include "LatenessHistogram.h"
+#include "ccronexpr.h"
 
 class BlablaCallbacks;
+class Storage;
+class Clock;
+struct StorageDiff;
 
+// Schedules the events owned by Storage. Events are referred to by id and looked up
+// when a transition fires, so edits in Storage apply from the next transition on. A
+// running event is switched off with the stations and duration it was switched on with.
 class CronManager
 {
 public:
-    CronManager() = default;
+    // Uses the system clock unless one is given
+    CronManager(Storage* storage, Clock* clock = nullptr);
     ~CronManager() = default;
 
     void setCronCallbacks(BlablaCallbacks* callbacks);
 
     void loop();
 
-    void addEvent(const Event& event);
-    void removeEvent(const Event& event);
+    void addEvent(uint32_t eventId);
+    // Switches the event off first if it's running
+    void removeEvent(uint32_t eventId);
+    // Re-arms the events a storage transaction touched, the rest keep their deadlines
+    void applyDiff(const StorageDiff& diff);
 
     void begin();
 
-    taskid_t getTaskId(uint32_t eventId) const;
+    // Switches on the events whose last run should still be going, for after a reset. Their
+    // off transitions are due when the run would have ended.
+    void resumeRunningEvents();
+    // Events switched on and not yet off, as they were switched on
+    const std::map<uint32_t, Event>& getRunningEvents() const { return m_running; }
+
+    bool isScheduled(uint32_t eventId) const;
+
+    // Milliseconds until the next pending transition is due, -1 if nothing is scheduled
+    int64_t getMsUntilNextDeadline() const;
+
+    // Must be called after the wall clock was set, deltaMs is new time minus old time
+    void onTimeChanged(int64_t deltaMs);
+
+    // Deadlines are absolute wall clock times in ms, queue keys encode the event id and which transition (on/off) is pending
+    static uint32_t transitionKey(uint32_t eventId, bool newState) { return (eventId << 1) | (newState ? 1 : 0); }
+
+    // Difference between the intended and actual time of fired transitions
+    const LatenessHistogram& getLatenessHistogram() const { return m_lateness; }
 
 private:
 
+    // Parsed cron expression of an event, kept until the event is removed or changed so
+    // scheduling doesn't need the cron string (it's read from flash)
+    struct CompiledSchedule
+    {
+        cron_expr expr;
+        time_t next_fire;
+    };
+
+    uint64_t nowMs() const;
+
+    CompiledSchedule* getSchedule(const Event& event);
     time_t getNextRun(const Event& event);
 
-    std::map<uint32_t, taskid_t> m_jobs;
-    BlablaCallbacks* m_pCallback;
+    bool scheduleNextRun(const Event& event);
+    void fireTransition(const DeadlineQueue::Entry& entry);
+    // startMs is when the run should have started, its off transition follows from it
+    void switchOn(const Event& event, uint64_t startMs);
+    void switchOff(uint32_t eventId);
+
+    Storage* m_pStorage;
+    Clock* m_clock;
+    DeadlineQueue m_queue;
+    std::set<uint32_t> m_eventIds;
+    std::map<uint32_t, CompiledSchedule> m_schedules;
+    // Copies of the running events as they were switched on, their off transition closes
+    // these stations even if the event was changed or removed from Storage since
+    std::map<uint32_t, Event> m_running;
+    LatenessHistogram m_lateness;
+    BlablaCallbacks* m_pCallback = nullptr;
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,243 @@
+#include <string.h>
+
+#include "DbFormat.h"
+
+template <class T>
+static void putLe(std::vector<uint8_t>& out, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        out.push_back((uint8_t)((uint64_t)value >> (8 * i)));
+    }
+}
+
+template <class T>
+static void setLe(std::vector<uint8_t>& out, size_t offset, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        out[offset + i] = (uint8_t)((uint64_t)value >> (8 * i));
+    }
+}
+
+template <class T>
+static void putBytes(std::vector<uint8_t>& out, const T* data, size_t size)
+{
+    // Longer values can't be represented by the u16 size fields
+    if (size > UINT16_MAX)
+    {
+        size = UINT16_MAX;
+    }
+    putLe<uint16_t>(out, size);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+uint32_t dbCrc32(const uint8_t* data, size_t size, uint32_t crc)
+{
+    // CRC-32 (IEEE 802.3), nibble table to keep it small
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+void dbEncodeRecord(std::vector<uint8_t>& out, const Station& station)
+{
+    putLe<uint8_t>(out, station.id);
+    putLe<uint8_t>(out, station.gpio_pin);
+    putLe<uint8_t>(out, station.is_on ? 1 : 0);
+    putBytes(out, station.name.data(), station.name.size());
+}
+
+void dbEncodeRecord(std::vector<uint8_t>& out, const Event& event)
+{
+    putLe<uint8_t>(out, event.id);
+    putLe<int32_t>(out, event.duration);
+    putBytes(out, event.stations_ids.data(), event.stations_ids.size());
+    putBytes(out, event.name.data(), event.name.size());
+    putBytes(out, event.cron_expr.data(), event.cron_expr.size());
+}
+
+bool dbDecodeRecord(RecordReader& reader, Station& station)
+{
+    uint8_t is_on = 0;
+    bool ok = reader.readLe(station.id) &&
+        reader.readLe(station.gpio_pin) &&
+        reader.readLe(is_on) &&
+        reader.readString<uint16_t>(station.name, true);
+    station.is_on = is_on != 0;
+    return ok;
+}
+
+bool dbDecodeRecord(RecordReader& reader, Event& event)
+{
+    return reader.readLe(event.id) &&
+        reader.readLe(event.duration) &&
+        reader.readVector<uint16_t>(event.stations_ids, true) &&
+        reader.readString<uint16_t>(event.name, true) &&
+        reader.readString<uint16_t>(event.cron_expr, true);
+}
+
+bool dbDecodeRecord(RecordReader& reader, Station& station, std::string_view& name)
+{
+    uint8_t is_on = 0;
+    bool ok = reader.readLe(station.id) &&
+        reader.readLe(station.gpio_pin) &&
+        reader.readLe(is_on) &&
+        reader.readStringView<uint16_t>(name, true);
+    station.is_on = is_on != 0;
+    return ok;
+}
+
+bool dbDecodeRecord(RecordReader& reader, Event& event, std::string_view& name, std::string_view& cronExpr)
+{
+    return reader.readLe(event.id) &&
+        reader.readLe(event.duration) &&
+        reader.readVector<uint16_t>(event.stations_ids, true) &&
+        reader.readStringView<uint16_t>(name, true) &&
+        reader.readStringView<uint16_t>(cronExpr, true);
+}
+
+bool dbDecodeStrings(RecordReader& reader, DbTable table, std::string_view& name, std::string_view& cronExpr)
+{
+    const uint8_t* skipped;
+    uint16_t numOfStations;
+    cronExpr = std::string_view();
+    if (table == DB_TABLE_STATIONS)
+    {
+        return reader.readBytes(skipped, 3) && reader.readStringView<uint16_t>(name, true);
+    }
+    return reader.readBytes(skipped, 5) &&
+        reader.readLe(numOfStations) && reader.readBytes(skipped, numOfStations) &&
+        reader.readStringView<uint16_t>(name, true) &&
+        reader.readStringView<uint16_t>(cronExpr, true);
+}
+
+bool dbIsSnapshot(const uint8_t* data, size_t size)
+{
+    uint32_t magic;
+    RecordReader reader(data, size);
+    return reader.readLe(magic) && magic == DB_SNAPSHOT_MAGIC;
+}
+
+void dbFinishSnapshot(std::vector<uint8_t>& out, DbTable table, uint32_t sequence, uint32_t count)
+{
+    uint32_t payloadSize = out.size() - DB_SNAPSHOT_HEADER_SIZE;
+    setLe<uint32_t>(out, 0, DB_SNAPSHOT_MAGIC);
+    setLe<uint16_t>(out, 4, DB_FORMAT_VERSION);
+    setLe<uint8_t>(out, 6, table);
+    setLe<uint8_t>(out, 7, 0);
+    setLe<uint32_t>(out, 8, sequence);
+    setLe<uint32_t>(out, 12, count);
+    setLe<uint32_t>(out, 16, payloadSize);
+    uint32_t crc = dbCrc32(out.data() + 4, DB_SNAPSHOT_HEADER_SIZE - 8);
+    crc = dbCrc32(out.data() + DB_SNAPSHOT_HEADER_SIZE, payloadSize, crc);
+    setLe<uint32_t>(out, 20, crc);
+}
+
+size_t dbSnapshotSize(const uint8_t* data, size_t size)
+{
+    uint32_t magic, payloadSize;
+    RecordReader reader(data, size);
+    if (!reader.readLe(magic) || magic != DB_SNAPSHOT_MAGIC || size < DB_SNAPSHOT_HEADER_SIZE)
+    {
+        return 0;
+    }
+    RecordReader sizeReader(data + 16, 4);
+    if (!sizeReader.readLe(payloadSize) || payloadSize > size - DB_SNAPSHOT_HEADER_SIZE)
+    {
+        return 0;
+    }
+    return DB_SNAPSHOT_HEADER_SIZE + payloadSize;
+}
+
+bool dbCheckSnapshot(RecordReader& reader, DbTable table, uint32_t& sequence, uint32_t& count)
+{
+    const uint8_t* header = reader.data() + reader.offset();
+    uint32_t magic, payloadSize, crc;
+    uint16_t version;
+    uint8_t headerTable, reserved;
+    if (!reader.readLe(magic) || !reader.readLe(version) || !reader.readLe(headerTable) || !reader.readLe(reserved))
+    {
+        return false;
+    }
+    if (magic != DB_SNAPSHOT_MAGIC || headerTable != table || version != DB_FORMAT_VERSION)
+    {
+        return false;
+    }
+    if (!reader.readLe(sequence) || !reader.readLe(count) || !reader.readLe(payloadSize) || !reader.readLe(crc))
+    {
+        return false;
+    }
+    if (payloadSize != reader.remaining())
+    {
+        return false;
+    }
+
+    const uint8_t* payload = reader.data() + reader.offset();
+    return dbCrc32(payload, payloadSize, dbCrc32(header + 4, DB_SNAPSHOT_HEADER_SIZE - 8)) == crc;
+}
+
+void dbEncodeLogHeader(std::vector<uint8_t>& out, DbTable table, uint32_t baseSequence)
+{
+    putLe<uint32_t>(out, DB_LOG_MAGIC);
+    putLe<uint16_t>(out, DB_FORMAT_VERSION);
+    putLe<uint8_t>(out, table);
+    putLe<uint8_t>(out, 0);
+    putLe<uint32_t>(out, baseSequence);
+}
+
+bool dbCheckLogHeader(RecordReader& reader, DbTable table, uint32_t& baseSequence)
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t headerTable, reserved;
+    return reader.readLe(magic) && reader.readLe(version) && reader.readLe(headerTable) && reader.readLe(reserved) &&
+        magic == DB_LOG_MAGIC && version == DB_FORMAT_VERSION && headerTable == table &&
+        reader.readLe(baseSequence);
+}
+
+size_t dbBeginLogRecord(std::vector<uint8_t>& out, DbLogOp op)
+{
+    size_t start = out.size();
+    putLe<uint8_t>(out, op);
+    putLe<uint16_t>(out, 0);
+    return start;
+}
+
+void dbFinishLogRecord(std::vector<uint8_t>& out, size_t start)
+{
+    size_t payloadSize = out.size() - start - 3;
+    setLe<uint16_t>(out, start + 1, payloadSize);
+    putLe<uint32_t>(out, dbCrc32(out.data() + start, out.size() - start));
+}
+
+void dbEncodeLogDelete(std::vector<uint8_t>& out, uint8_t id)
+{
+    size_t start = dbBeginLogRecord(out, DB_LOG_DELETE);
+    putLe<uint8_t>(out, id);
+    dbFinishLogRecord(out, start);
+}
+
+bool dbDecodeLogRecord(RecordReader& reader, DbLogOp& op, RecordReader& payload)
+{
+    const uint8_t* record = reader.data() + reader.offset();
+    uint8_t rawOp;
+    uint16_t payloadSize;
+    uint32_t crc;
+    if (!reader.readLe(rawOp) || !reader.readLe(payloadSize) || !reader.readSubReader(payload, payloadSize) ||
+        !reader.readLe(crc))
+    {
+        return false;
+    }
+    op = (DbLogOp)rawOp;
+    return dbCrc32(record, 3 + payloadSize) == crc;
+}
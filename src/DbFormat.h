@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "data.h"
+#include "RecordReader.h"
+
+// On-flash format of the stations and events db. All fields are fixed width little-endian.
+//
+// Snapshot: header followed by 'count' records, the CRC32 covers the header fields after
+// the magic and the payload. Snapshots are committed to alternating A/B slots, the valid
+// slot with the highest sequence number is the current one.
+//   magic "BWDB" u32 | version u16 | table u8 | reserved u8 | sequence u32 | count u32 | payload size u32 | crc32 u32
+// Log: header followed by records appended one at a time, the log only applies on top of
+// the snapshot with the base sequence number
+//   magic "BWLG" u32 | version u16 | table u8 | reserved u8 | base sequence u32
+//   record: op u8 | payload size u16 | payload | crc32 u32 over op, size and payload
+//   upsert payload is a full record, delete payload is the record id u8
+//
+// Station: id u8 | gpio_pin u8 | is_on u8 | name size u16 | name
+// Event: id u8 | duration i32 | station count u16 | station ids | name size u16 | name | cron size u16 | cron
+//
+// Nothing here depends on the ESP-IDF so host tools can produce and check images.
+
+#define DB_SNAPSHOT_MAGIC 0x42445742 // "BWDB"
+#define DB_LOG_MAGIC 0x474C5742 // "BWLG"
+#define DB_FORMAT_VERSION 2
+
+#define DB_SNAPSHOT_HEADER_SIZE 24
+#define DB_LOG_HEADER_SIZE 12
+
+enum DbTable : uint8_t
+{
+    DB_TABLE_STATIONS = 1,
+    DB_TABLE_EVENTS = 2,
+};
+
+enum DbLogOp : uint8_t
+{
+    DB_LOG_UPSERT = 1,
+    DB_LOG_DELETE = 2,
+};
+
+inline DbTable dbTableOf(const Station&) { return DB_TABLE_STATIONS; }
+inline DbTable dbTableOf(const Event&) { return DB_TABLE_EVENTS; }
+
+uint32_t dbCrc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+void dbEncodeRecord(std::vector<uint8_t>& out, const Station& station);
+void dbEncodeRecord(std::vector<uint8_t>& out, const Event& event);
+bool dbDecodeRecord(RecordReader& reader, Station& station);
+bool dbDecodeRecord(RecordReader& reader, Event& event);
+// Views into the buffer instead of copies, the string members aren't touched
+bool dbDecodeRecord(RecordReader& reader, Station& station, std::string_view& name);
+bool dbDecodeRecord(RecordReader& reader, Event& event, std::string_view& name, std::string_view& cronExpr);
+// Only the strings of a record, 'cronExpr' is left empty for stations
+bool dbDecodeStrings(RecordReader& reader, DbTable table, std::string_view& name, std::string_view& cronExpr);
+
+// Snapshots
+bool dbIsSnapshot(const uint8_t* data, size_t size);
+// Size of the snapshot at the start of a larger region (e.g. a flash slot), 0 if there is none
+size_t dbSnapshotSize(const uint8_t* data, size_t size);
+void dbFinishSnapshot(std::vector<uint8_t>& out, DbTable table, uint32_t sequence, uint32_t count);
+// Validates the header and CRC, leaves the reader at the first record
+bool dbCheckSnapshot(RecordReader& reader, DbTable table, uint32_t& sequence, uint32_t& count);
+
+template <class T>
+void dbEncodeSnapshot(std::vector<uint8_t>& out, const IdTable<T>& records, uint32_t sequence)
+{
+    out.assign(DB_SNAPSHOT_HEADER_SIZE, 0);
+    for (const auto& record : records)
+    {
+        dbEncodeRecord(out, record);
+    }
+    dbFinishSnapshot(out, dbTableOf(T()), sequence, records.size());
+}
+
+// Logs
+void dbEncodeLogHeader(std::vector<uint8_t>& out, DbTable table, uint32_t baseSequence);
+bool dbCheckLogHeader(RecordReader& reader, DbTable table, uint32_t& baseSequence);
+// Appends a log record whose payload is everything after 'start'
+void dbFinishLogRecord(std::vector<uint8_t>& out, size_t start);
+size_t dbBeginLogRecord(std::vector<uint8_t>& out, DbLogOp op);
+// Reads the next log record, fails on a torn or corrupt record
+bool dbDecodeLogRecord(RecordReader& reader, DbLogOp& op, RecordReader& payload);
+
+template <class T>
+void dbEncodeLogUpsert(std::vector<uint8_t>& out, const T& record)
+{
+    size_t start = dbBeginLogRecord(out, DB_LOG_UPSERT);
+    dbEncodeRecord(out, record);
+    dbFinishLogRecord(out, start);
+}
+
+void dbEncodeLogDelete(std::vector<uint8_t>& out, uint8_t id);
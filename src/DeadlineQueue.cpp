@@ -0,0 +1,159 @@
+#include <utility>
+
+#include "DeadlineQueue.h"
+
+void DeadlineQueue::push(uint32_t key, uint64_t deadline)
+{
+    int32_t pos = getPosition(key);
+    if (pos >= 0)
+    {
+        uint64_t oldDeadline = m_heap[pos].deadline;
+        m_heap[pos].deadline = deadline;
+        if (deadline < oldDeadline)
+        {
+            siftUp(pos);
+        }
+        else
+        {
+            siftDown(pos);
+        }
+        return;
+    }
+
+    m_heap.push_back({deadline, key});
+    setPosition(key, m_heap.size() - 1);
+    siftUp(m_heap.size() - 1);
+}
+
+bool DeadlineQueue::cancel(uint32_t key)
+{
+    int32_t pos = getPosition(key);
+    if (pos < 0)
+    {
+        return false;
+    }
+    removeAt(pos);
+    return true;
+}
+
+bool DeadlineQueue::contains(uint32_t key) const
+{
+    return getPosition(key) >= 0;
+}
+
+bool DeadlineQueue::getDeadline(uint32_t key, uint64_t& deadline) const
+{
+    int32_t pos = getPosition(key);
+    if (pos < 0)
+    {
+        return false;
+    }
+    deadline = m_heap[pos].deadline;
+    return true;
+}
+
+const DeadlineQueue::Entry* DeadlineQueue::peek() const
+{
+    if (m_heap.empty())
+    {
+        return nullptr;
+    }
+    return &m_heap[0];
+}
+
+bool DeadlineQueue::pop(Entry& entry)
+{
+    if (m_heap.empty())
+    {
+        return false;
+    }
+    entry = m_heap[0];
+    removeAt(0);
+    return true;
+}
+
+void DeadlineQueue::clear()
+{
+    for (const auto& entry : m_heap)
+    {
+        m_positions[entry.key] = -1;
+    }
+    m_heap.clear();
+}
+
+void DeadlineQueue::siftUp(size_t pos)
+{
+    while (pos > 0)
+    {
+        size_t parent = (pos - 1) / 2;
+        if (m_heap[parent].deadline <= m_heap[pos].deadline)
+        {
+            break;
+        }
+        swapEntries(parent, pos);
+        pos = parent;
+    }
+}
+
+void DeadlineQueue::siftDown(size_t pos)
+{
+    size_t size = m_heap.size();
+    while (true)
+    {
+        size_t smallest = pos;
+        size_t left = 2 * pos + 1;
+        size_t right = left + 1;
+        if (left < size && m_heap[left].deadline < m_heap[smallest].deadline)
+        {
+            smallest = left;
+        }
+        if (right < size && m_heap[right].deadline < m_heap[smallest].deadline)
+        {
+            smallest = right;
+        }
+        if (smallest == pos)
+        {
+            break;
+        }
+        swapEntries(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void DeadlineQueue::swapEntries(size_t a, size_t b)
+{
+    std::swap(m_heap[a], m_heap[b]);
+    m_positions[m_heap[a].key] = a;
+    m_positions[m_heap[b].key] = b;
+}
+
+void DeadlineQueue::removeAt(size_t pos)
+{
+    size_t last = m_heap.size() - 1;
+    m_positions[m_heap[pos].key] = -1;
+    if (pos != last)
+    {
+        m_heap[pos] = m_heap[last];
+        m_positions[m_heap[pos].key] = pos;
+    }
+    m_heap.pop_back();
+    if (pos < m_heap.size())
+    {
+        siftUp(pos);
+        siftDown(pos);
+    }
+}
+
+void DeadlineQueue::setPosition(uint32_t key, int32_t pos)
+{
+    if (key >= m_positions.size())
+    {
+        m_positions.resize(key + 1, -1);
+    }
+    m_positions[key] = pos;
+}
+
+int32_t DeadlineQueue::getPosition(uint32_t key) const
+{
+    return key < m_positions.size() ? m_positions[key] : -1;
+}
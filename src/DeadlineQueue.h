@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Min-heap of pending deadlines. Every entry is identified by a unique key so it
+// can be replaced or cancelled in O(log n), the earliest deadline is peeked in O(1).
+// Keys index a position table directly, so they should be small; once the largest
+// key was seen, re-queueing never allocates.
+class DeadlineQueue
+{
+public:
+    struct Entry
+    {
+        uint64_t deadline;
+        uint32_t key;
+    };
+
+    DeadlineQueue() = default;
+    ~DeadlineQueue() = default;
+
+    // Adds the key, or moves it to the new deadline if already queued
+    void push(uint32_t key, uint64_t deadline);
+    bool cancel(uint32_t key);
+    bool contains(uint32_t key) const;
+    bool getDeadline(uint32_t key, uint64_t& deadline) const;
+
+    const Entry* peek() const;
+    bool pop(Entry& entry);
+
+    bool empty() const { return m_heap.empty(); }
+    size_t size() const { return m_heap.size(); }
+    void clear();
+
+private:
+    void siftUp(size_t pos);
+    void siftDown(size_t pos);
+    void swapEntries(size_t a, size_t b);
+    void removeAt(size_t pos);
+    void setPosition(uint32_t key, int32_t pos);
+    int32_t getPosition(uint32_t key) const;
+
+    std::vector<Entry> m_heap;
+    // Heap position of every key, -1 when the key isn't queued
+    std::vector<int32_t> m_positions;
+};
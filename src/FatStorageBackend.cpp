@@ -0,0 +1,50 @@
+#include "FatStorageBackend.h"
+
+#include "esp32-hal-log.h"
+#include "esp_vfs.h"
+#include "esp_vfs_fat.h"
+
+
+FatStorageBackend::FatStorageBackend(const char* basePath, const char* partitionLabel) :
+    PosixStorageBackend(basePath),
+    m_partitionLabel(partitionLabel),
+    m_wlHandle(WL_INVALID_HANDLE)
+{
+}
+
+FatStorageBackend::~FatStorageBackend()
+{
+    close();
+}
+
+bool FatStorageBackend::open()
+{
+    if (m_wlHandle != WL_INVALID_HANDLE)
+    {
+        return true;
+    }
+    log_i("Mounting FAT filesystem");
+
+    esp_vfs_fat_mount_config_t mount_config;
+    mount_config.max_files = 4;
+    mount_config.format_if_mount_failed = true;
+    mount_config.allocation_unit_size = CONFIG_WL_SECTOR_SIZE;
+    esp_err_t err = esp_vfs_fat_spiflash_mount(m_basePath.c_str(), m_partitionLabel.c_str(), &mount_config, &m_wlHandle);
+    if (err != ESP_OK) {
+        log_e("Failed to mount FATFS (%s)", esp_err_to_name(err));
+        m_wlHandle = WL_INVALID_HANDLE;
+        return false;
+    }
+    return true;
+}
+
+void FatStorageBackend::close()
+{
+    if (m_wlHandle == WL_INVALID_HANDLE)
+    {
+        return;
+    }
+    log_i("Unmounting FAT filesystem");
+    ESP_ERROR_CHECK( esp_vfs_fat_spiflash_unmount(m_basePath.c_str(), m_wlHandle));
+    m_wlHandle = WL_INVALID_HANDLE;
+}
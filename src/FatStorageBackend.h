@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "PosixStorageBackend.h"
+
+// Files on a FAT filesystem on top of wear levelling, mounted from a data partition
+class FatStorageBackend : public PosixStorageBackend
+{
+public:
+    FatStorageBackend(const char* basePath, const char* partitionLabel);
+    ~FatStorageBackend();
+
+    const char* getName() const override { return "fat"; }
+
+    bool open() override;
+    void close() override;
+
+private:
+    std::string m_partitionLabel;
+    int32_t m_wlHandle;
+};
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HistoryLog.h"
+#include "RecordReader.h"
+#include "DbFormat.h"
+
+#include "esp32-hal-log.h"
+
+
+// Record layout (little endian): sequence u32, timestamp u32, station u8, event u8,
+// flags u8 (bit 0 is_on, bits 1-7 source), reserved u8, duration u16, crc u16.
+// The crc is the low half of the CRC32 of the first 14 bytes.
+#define RECORD_CRC_OFFSET 14
+
+template <class T>
+static void putLe(uint8_t* buffer, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+HistoryLog::HistoryLog(const char* path) :
+    m_path(path),
+    m_file(nullptr),
+    m_nextSequence(1),
+    m_dirty(false)
+{
+    memset(m_index, 0, sizeof(m_index));
+    memset(m_onSince, 0, sizeof(m_onSince));
+}
+
+HistoryLog::~HistoryLog()
+{
+    close();
+}
+
+bool HistoryLog::open()
+{
+    if (m_file != nullptr)
+    {
+        return true;
+    }
+    const long fileSize = CAPACITY * RECORD_SIZE;
+    m_file = fopen(m_path.c_str(), "r+b");
+    if (m_file != nullptr && (fseek(m_file, 0, SEEK_END) != 0 || ftell(m_file) != fileSize))
+    {
+        log_w("%s has an unexpected size, recreating it", m_path.c_str());
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    if (m_file == nullptr)
+    {
+        // Preallocate the whole log, so appending never grows the file
+        m_file = fopen(m_path.c_str(), "w+b");
+        bool ok = m_file != nullptr;
+        memset(m_blockBuffer, 0, sizeof(m_blockBuffer));
+        for (uint32_t block = 0; ok && block < NUM_BLOCKS; block++)
+        {
+            ok = fwrite(m_blockBuffer, 1, sizeof(m_blockBuffer), m_file) == sizeof(m_blockBuffer);
+        }
+        ok = ok && fflush(m_file) == 0 && fsync(fileno(m_file)) == 0;
+        if (!ok)
+        {
+            log_e("Failed creating %s", m_path.c_str());
+            close();
+            return false;
+        }
+    }
+
+    // Find the newest record and the time range of every block
+    uint32_t lastSequence = 0;
+    for (uint32_t block = 0; block < NUM_BLOCKS; block++)
+    {
+        m_index[block].empty = true;
+        if (!readBlock(block))
+        {
+            close();
+            return false;
+        }
+        for (uint32_t i = 0; i < BLOCK_RECORDS; i++)
+        {
+            HistoryRecord record;
+            if (decodeRecord(m_blockBuffer + i * RECORD_SIZE, record))
+            {
+                addToIndex(block, record.timestamp);
+                lastSequence = std::max(lastSequence, record.sequence);
+            }
+        }
+    }
+    m_nextSequence = lastSequence + 1;
+
+    // The block being written still holds evicted records from the previous lap
+    uint32_t currentBlock = (lastSequence % CAPACITY) / BLOCK_RECORDS;
+    uint32_t oldestSequence = getOldestSequence();
+    m_index[currentBlock].empty = true;
+    if (!readBlock(currentBlock))
+    {
+        close();
+        return false;
+    }
+    for (uint32_t i = 0; i < BLOCK_RECORDS; i++)
+    {
+        HistoryRecord record;
+        if (decodeRecord(m_blockBuffer + i * RECORD_SIZE, record) && record.sequence >= oldestSequence)
+        {
+            addToIndex(currentBlock, record.timestamp);
+        }
+    }
+    log_i("Opened history with %d records", getCount());
+    return true;
+}
+
+void HistoryLog::close()
+{
+    if (m_file == nullptr)
+    {
+        return;
+    }
+    sync();
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+bool HistoryLog::logTransition(uint8_t stationId, uint8_t eventId, HistorySource source, bool isOn, int32_t plannedDuration)
+{
+    HistoryRecord record;
+    record.timestamp = (uint32_t)time(nullptr);
+    record.station_id = stationId;
+    record.event_id = eventId;
+    record.source = source;
+    record.is_on = isOn;
+    int64_t duration;
+    if (isOn)
+    {
+        duration = plannedDuration;
+        m_onSince[stationId] = record.timestamp;
+    }
+    else
+    {
+        // Unknown when the station was turned on before the last boot
+        duration = m_onSince[stationId] != 0 ? (int64_t)record.timestamp - m_onSince[stationId] : 0;
+        m_onSince[stationId] = 0;
+    }
+    record.duration = (uint16_t)std::min<int64_t>(std::max<int64_t>(duration, 0), UINT16_MAX);
+    return append(record);
+}
+
+bool HistoryLog::append(HistoryRecord& record)
+{
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+    record.sequence = m_nextSequence;
+    uint32_t slot = record.sequence % CAPACITY;
+    uint32_t block = slot / BLOCK_RECORDS;
+    if (slot % BLOCK_RECORDS == 0)
+    {
+        // Entering the block evicts what it held from the previous lap
+        m_index[block].empty = true;
+    }
+
+    uint8_t buffer[RECORD_SIZE];
+    encodeRecord(record, buffer);
+    if (fseek(m_file, slot * RECORD_SIZE, SEEK_SET) != 0 ||
+        fwrite(buffer, 1, RECORD_SIZE, m_file) != RECORD_SIZE ||
+        fflush(m_file) != 0)
+    {
+        log_e("Failed appending to history");
+        return false;
+    }
+    addToIndex(block, record.timestamp);
+    m_nextSequence++;
+    m_dirty = true;
+    return true;
+}
+
+void HistoryLog::sync()
+{
+    if (m_dirty && m_file != nullptr)
+    {
+        fsync(fileno(m_file));
+        m_dirty = false;
+    }
+}
+
+bool HistoryLog::query(uint32_t from, uint32_t to, std::vector<HistoryRecord>& records, size_t maxRecords)
+{
+    records.clear();
+    if (m_file == nullptr || getCount() == 0)
+    {
+        return true;
+    }
+    // Walk the blocks from the oldest one, so records come out in the order they were logged
+    uint32_t oldestSequence = getOldestSequence();
+    uint32_t firstBlock = (oldestSequence % CAPACITY) / BLOCK_RECORDS;
+    for (uint32_t i = 0; i < NUM_BLOCKS; i++)
+    {
+        uint32_t block = (firstBlock + i) % NUM_BLOCKS;
+        const BlockRange& range = m_index[block];
+        if (range.empty || range.maxTimestamp < from || range.minTimestamp > to)
+        {
+            continue;
+        }
+        if (!readBlock(block))
+        {
+            return false;
+        }
+        for (uint32_t j = 0; j < BLOCK_RECORDS; j++)
+        {
+            HistoryRecord record;
+            if (!decodeRecord(m_blockBuffer + j * RECORD_SIZE, record) || record.sequence < oldestSequence ||
+                record.timestamp < from || record.timestamp > to)
+            {
+                continue;
+            }
+            if (records.size() == maxRecords)
+            {
+                return false;
+            }
+            records.push_back(record);
+        }
+    }
+    return true;
+}
+
+uint32_t HistoryLog::getCount() const
+{
+    return m_nextSequence - getOldestSequence();
+}
+
+uint32_t HistoryLog::getOldestSequence() const
+{
+    uint32_t lastSequence = m_nextSequence - 1;
+    if (lastSequence == 0)
+    {
+        return 1;
+    }
+    // Every block but the current one holds a full lap of records
+    uint32_t blockStart = lastSequence - (lastSequence % CAPACITY) % BLOCK_RECORDS;
+    return blockStart > CAPACITY - BLOCK_RECORDS ? blockStart - (CAPACITY - BLOCK_RECORDS) : 1;
+}
+
+void HistoryLog::addToIndex(uint32_t block, uint32_t timestamp)
+{
+    BlockRange& range = m_index[block];
+    if (range.empty)
+    {
+        range.minTimestamp = range.maxTimestamp = timestamp;
+        range.empty = false;
+        return;
+    }
+    range.minTimestamp = std::min(range.minTimestamp, timestamp);
+    range.maxTimestamp = std::max(range.maxTimestamp, timestamp);
+}
+
+bool HistoryLog::readBlock(uint32_t block)
+{
+    if (fseek(m_file, block * sizeof(m_blockBuffer), SEEK_SET) != 0 ||
+        fread(m_blockBuffer, 1, sizeof(m_blockBuffer), m_file) != sizeof(m_blockBuffer))
+    {
+        log_e("Failed reading history block %d", block);
+        return false;
+    }
+    return true;
+}
+
+void HistoryLog::encodeRecord(const HistoryRecord& record, uint8_t* buffer) const
+{
+    putLe<uint32_t>(buffer, record.sequence);
+    putLe<uint32_t>(buffer + 4, record.timestamp);
+    buffer[8] = record.station_id;
+    buffer[9] = record.event_id;
+    buffer[10] = (uint8_t)((record.source << 1) | (record.is_on ? 1 : 0));
+    buffer[11] = 0;
+    putLe<uint16_t>(buffer + 12, record.duration);
+    putLe<uint16_t>(buffer + RECORD_CRC_OFFSET, (uint16_t)dbCrc32(buffer, RECORD_CRC_OFFSET));
+}
+
+bool HistoryLog::decodeRecord(const uint8_t* buffer, HistoryRecord& record) const
+{
+    RecordReader reader(buffer, RECORD_SIZE);
+    uint8_t flags, reserved;
+    uint16_t crc;
+    bool ok = reader.readLe(record.sequence) && reader.readLe(record.timestamp) &&
+        reader.readLe(record.station_id) && reader.readLe(record.event_id) &&
+        reader.readLe(flags) && reader.readLe(reserved) && reader.readLe(record.duration) &&
+        reader.readLe(crc);
+    if (!ok || record.sequence == 0 || crc != (uint16_t)dbCrc32(buffer, RECORD_CRC_OFFSET))
+    {
+        return false;
+    }
+    record.is_on = flags & 1;
+    record.source = (HistorySource)(flags >> 1);
+    return true;
+}
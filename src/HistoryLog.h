@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum HistorySource : uint8_t
+{
+    HISTORY_SOURCE_EVENT = 0,
+    HISTORY_SOURCE_MANUAL = 1,
+};
+
+// Event id of manual transitions
+#define HISTORY_NO_EVENT 0xFF
+
+struct HistoryRecord
+{
+    uint32_t sequence;
+    uint32_t timestamp;
+    uint8_t station_id;
+    uint8_t event_id;
+    HistorySource source;
+    bool is_on;
+    // On transitions: the planned duration, off transitions: how long the station was on (seconds)
+    uint16_t duration;
+};
+
+// Fixed-size circular log of station transitions kept in a preallocated file.
+// The log is split into blocks, the time range of every block is kept in memory
+// so range queries only read the blocks that can hold matching records.
+// Starting to write a block evicts the records the block held from the previous lap.
+class HistoryLog
+{
+public:
+    static const uint32_t RECORD_SIZE = 16;
+    static const uint32_t BLOCK_RECORDS = 64;
+    static const uint32_t NUM_BLOCKS = 64;
+    static const uint32_t CAPACITY = BLOCK_RECORDS * NUM_BLOCKS;
+
+    HistoryLog(const char* path);
+    ~HistoryLog();
+
+    // Opens (creating if needed) the log and rebuilds the block index
+    bool open();
+    void close();
+
+    // Records a transition at the current time. O(1), doesn't allocate
+    bool logTransition(uint8_t stationId, uint8_t eventId, HistorySource source, bool isOn, int32_t plannedDuration);
+    bool append(HistoryRecord& record);
+    // Makes the appended records durable
+    void sync();
+
+    // Collects records with from <= timestamp <= to in the order they were logged.
+    // Returns false when more than maxRecords matched, 'records' holds the first ones then.
+    bool query(uint32_t from, uint32_t to, std::vector<HistoryRecord>& records, size_t maxRecords);
+
+    uint32_t getCount() const;
+
+private:
+    struct BlockRange
+    {
+        uint32_t minTimestamp;
+        uint32_t maxTimestamp;
+        bool empty;
+    };
+
+    bool readBlock(uint32_t block);
+    bool decodeRecord(const uint8_t* buffer, HistoryRecord& record) const;
+    void encodeRecord(const HistoryRecord& record, uint8_t* buffer) const;
+    uint32_t getOldestSequence() const;
+    void addToIndex(uint32_t block, uint32_t timestamp);
+
+    std::string m_path;
+    FILE* m_file;
+    // Sequence numbers start at 1, 0 marks an empty slot
+    uint32_t m_nextSequence;
+    bool m_dirty;
+    BlockRange m_index[NUM_BLOCKS];
+    // When each station was last turned on, for the duration of off records
+    uint32_t m_onSince[256];
+    uint8_t m_blockBuffer[BLOCK_RECORDS * RECORD_SIZE];
+};
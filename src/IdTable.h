@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Table of records keyed by their 8 bit 'id' member. A presence bitmap and an id to
+// position array index a dense vector kept sorted by id, so lookups are O(1),
+// iteration is contiguous (in id order) and there is no heap node per record.
+// Inserting and erasing shift the records behind the position, tables are small.
+template <class T>
+class IdTable
+{
+public:
+    static const uint32_t MAX_IDS = 256;
+
+    typedef typename std::vector<T>::iterator iterator;
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    IdTable()
+    {
+        memset(m_present, 0, sizeof(m_present));
+        memset(m_positions, 0, sizeof(m_positions));
+    }
+
+    bool contains(uint32_t id) const
+    {
+        return id < MAX_IDS && (m_present[id / 32] & (1u << (id % 32))) != 0;
+    }
+
+    T* find(uint32_t id)
+    {
+        return contains(id) ? &m_values[m_positions[id]] : nullptr;
+    }
+
+    const T* find(uint32_t id) const
+    {
+        return contains(id) ? &m_values[m_positions[id]] : nullptr;
+    }
+
+    // Inserts or replaces the record with the same id
+    void set(T value)
+    {
+        uint32_t id = value.id;
+        if (contains(id))
+        {
+            m_values[m_positions[id]] = std::move(value);
+            return;
+        }
+        size_t position = countBelow(id);
+        m_values.insert(m_values.begin() + position, std::move(value));
+        m_present[id / 32] |= 1u << (id % 32);
+        reindex(position);
+    }
+
+    // Returns false if a record with the same id exists
+    bool insert(const T& value)
+    {
+        if (contains(value.id))
+        {
+            return false;
+        }
+        set(value);
+        return true;
+    }
+
+    bool erase(uint32_t id)
+    {
+        if (!contains(id))
+        {
+            return false;
+        }
+        size_t position = m_positions[id];
+        m_values.erase(m_values.begin() + position);
+        m_present[id / 32] &= ~(1u << (id % 32));
+        reindex(position);
+        return true;
+    }
+
+    void clear()
+    {
+        m_values.clear();
+        memset(m_present, 0, sizeof(m_present));
+    }
+
+    size_t size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+
+    // The records in id order
+    const std::vector<T>& values() const { return m_values; }
+
+    iterator begin() { return m_values.begin(); }
+    iterator end() { return m_values.end(); }
+    const_iterator begin() const { return m_values.begin(); }
+    const_iterator end() const { return m_values.end(); }
+
+private:
+    // Number of present ids below 'id', i.e. the position a record with 'id' belongs at
+    size_t countBelow(uint32_t id) const
+    {
+        size_t count = 0;
+        for (uint32_t word = 0; word < id / 32; word++)
+        {
+            count += __builtin_popcount(m_present[word]);
+        }
+        if (id % 32 != 0)
+        {
+            count += __builtin_popcount(m_present[id / 32] & ((1u << (id % 32)) - 1));
+        }
+        return count;
+    }
+
+    void reindex(size_t from)
+    {
+        for (size_t i = from; i < m_values.size(); i++)
+        {
+            m_positions[m_values[i].id] = (uint8_t)i;
+        }
+    }
+
+    uint32_t m_present[MAX_IDS / 32];
+    uint8_t m_positions[MAX_IDS];
+    std::vector<T> m_values;
+};
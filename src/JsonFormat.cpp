@@ -0,0 +1,400 @@
+#include <limits>
+
+#include "JsonFormat.h"
+
+// Out of range numbers saturate, like cJSON's valueint
+template <class T>
+static T clampTo(double value)
+{
+    if (!(value > (double)std::numeric_limits<T>::min()))
+    {
+        return std::numeric_limits<T>::min();
+    }
+    if (value >= (double)std::numeric_limits<T>::max())
+    {
+        return std::numeric_limits<T>::max();
+    }
+    return (T)value;
+}
+
+static bool decodeStation(JsonReader& data, Station& station)
+{
+    // A station needs an id, a pin and a name and starts switched off
+    bool hasId = false, hasPin = false, hasName = false;
+    std::string_view key, raw;
+    double number;
+    station = Station(0, 0, "", false);
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        JsonReader::Type type = data.peek();
+        if (key == "id" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            int id = clampTo<int>(number);
+            if (id < 0 || id >= (int)StationTable::MAX_IDS)
+            {
+                return false;
+            }
+            station.id = id;
+            hasId = true;
+        }
+        else if (key == "gpio_pin" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            int pin = clampTo<int>(number);
+            if (pin < 0 || pin > Station::MAX_GPIO_PIN)
+            {
+                return false;
+            }
+            station.gpio_pin = pin;
+            hasPin = true;
+        }
+        else if (key == "name" && type == JsonReader::STRING && data.readString(raw))
+        {
+            if (!JsonReader::unescape(raw, station.name))
+            {
+                return false;
+            }
+            hasName = true;
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed() && hasId && hasPin && hasName;
+}
+
+static bool decodeStationIds(JsonReader& data, std::vector<uint8_t>& stations)
+{
+    double number;
+    stations.clear();
+    if (!data.beginArray())
+    {
+        return false;
+    }
+    while (data.nextElement())
+    {
+        if (data.peek() != JsonReader::NUMBER || !data.readNumber(number))
+        {
+            return false;
+        }
+        int id = clampTo<int>(number);
+        if (id < 0 || id >= (int)StationTable::MAX_IDS)
+        {
+            return false;
+        }
+        stations.push_back(id);
+    }
+    return !data.failed();
+}
+
+static bool decodeEvent(JsonReader& data, Event& event)
+{
+    bool hasId = false, hasStations = false, hasName = false, hasCron = false, hasDuration = false;
+    std::string_view key, raw;
+    double number;
+    event = Event(0, {}, "", "", 0);
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        JsonReader::Type type = data.peek();
+        if (key == "id" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            int id = clampTo<int>(number);
+            if (id < 0 || id >= (int)EventTable::MAX_IDS)
+            {
+                return false;
+            }
+            event.id = id;
+            hasId = true;
+        }
+        else if (key == "station_ids" && type == JsonReader::ARRAY)
+        {
+            if (!decodeStationIds(data, event.stations_ids))
+            {
+                return false;
+            }
+            hasStations = true;
+        }
+        else if (key == "name" && type == JsonReader::STRING && data.readString(raw))
+        {
+            if (!JsonReader::unescape(raw, event.name))
+            {
+                return false;
+            }
+            hasName = true;
+        }
+        else if (key == "cron_expr" && type == JsonReader::STRING && data.readString(raw))
+        {
+            if (!JsonReader::unescape(raw, event.cron_expr))
+            {
+                return false;
+            }
+            hasCron = true;
+        }
+        else if (key == "duration" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            // Long durations saturate, negative ones are meaningless
+            if (number < 0)
+            {
+                return false;
+            }
+            event.duration = clampTo<int>(number);
+            hasDuration = true;
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed() && hasId && hasStations && hasName && hasCron && hasDuration;
+}
+
+bool jsonDecodeMessage(char* buffer, size_t size, int& type, JsonReader& data)
+{
+    JsonReader reader(buffer, size);
+    std::string_view key, dataString;
+    bool hasData = false, dataIsString = false;
+    double number;
+    type = -1;
+    if (!reader.beginObject())
+    {
+        return false;
+    }
+    while (reader.nextMember(key))
+    {
+        JsonReader::Type valueType = reader.peek();
+        if (key == "type" && valueType == JsonReader::NUMBER && reader.readNumber(number))
+        {
+            type = clampTo<int>(number);
+        }
+        else if (key == "data" && valueType == JsonReader::STRING && reader.readString(dataString))
+        {
+            hasData = true;
+            dataIsString = true;
+        }
+        else if (key == "data" && valueType == JsonReader::OBJECT)
+        {
+            // peek() left the offset at the opening brace
+            size_t start = reader.offset();
+            if (reader.skipValue())
+            {
+                data = JsonReader(buffer + start, reader.offset() - start);
+                hasData = true;
+                dataIsString = false;
+            }
+        }
+        else
+        {
+            reader.skipValue();
+        }
+    }
+    if (reader.failed() || !hasData)
+    {
+        return false;
+    }
+    if (dataIsString)
+    {
+        // The escaped text is only read once, it is decoded over itself
+        char* text = buffer + (dataString.data() - buffer);
+        size_t textSize;
+        if (!JsonReader::unescape(text, dataString.size(), textSize))
+        {
+            return false;
+        }
+        data = JsonReader(text, textSize);
+    }
+    return true;
+}
+
+bool jsonDecodeSetTime(JsonReader data, SetTimeMessage& message)
+{
+    std::string_view key, raw;
+    double number;
+    message.timeval.tv_sec = 0;
+    message.timeval.tv_usec = 0;
+    message.tz.clear();
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        JsonReader::Type type = data.peek();
+        if (key == "tv_sec" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            message.timeval.tv_sec = clampTo<int>(number);
+        }
+        else if (key == "tv_usec" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            message.timeval.tv_usec = clampTo<int>(number);
+        }
+        else if (key == "tz_str" && type == JsonReader::STRING && data.readString(raw))
+        {
+            if (!JsonReader::unescape(raw, message.tz))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed();
+}
+
+bool jsonDecodeSetStationState(JsonReader data, SetStationStateMessage& message)
+{
+    std::string_view key;
+    double number;
+    bool state;
+    message.station_id = -1;
+    message.is_on = false;
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        JsonReader::Type type = data.peek();
+        if (key == "station_id" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            message.station_id = clampTo<int>(number);
+        }
+        else if (key == "is_on" && type == JsonReader::BOOL && data.readBool(state))
+        {
+            message.is_on = state;
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed();
+}
+
+bool jsonDecodeSetConfig(JsonReader data, SetConfigMessage& message)
+{
+    bool hasStations = false, hasEvents = false;
+    std::string_view key;
+    message.stations.clear();
+    message.events.clear();
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        JsonReader::Type type = data.peek();
+        if (key == "stations" && type == JsonReader::ARRAY && data.beginArray())
+        {
+            while (data.nextElement())
+            {
+                message.stations.emplace_back();
+                if (!decodeStation(data, message.stations.back()))
+                {
+                    return false;
+                }
+            }
+            hasStations = true;
+        }
+        else if (key == "events" && type == JsonReader::ARRAY && data.beginArray())
+        {
+            while (data.nextElement())
+            {
+                message.events.emplace_back();
+                if (!decodeEvent(data, message.events.back()))
+                {
+                    return false;
+                }
+            }
+            hasEvents = true;
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed() && hasStations && hasEvents;
+}
+
+bool jsonDecodeRequestNotify(JsonReader data, int& mode)
+{
+    std::string_view key, raw;
+    mode = -1;
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        if (key == "mode" && data.peek() == JsonReader::STRING && data.readString(raw))
+        {
+            mode = raw == "delta" ? 1 : 0;
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed();
+}
+
+bool jsonDecodeGetHistory(JsonReader data, uint32_t& from, uint32_t& to)
+{
+    std::string_view key;
+    double number;
+    from = 0;
+    to = UINT32_MAX;
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        JsonReader::Type type = data.peek();
+        if (key == "from" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            from = clampTo<uint32_t>(number);
+        }
+        else if (key == "to" && type == JsonReader::NUMBER && data.readNumber(number))
+        {
+            to = clampTo<uint32_t>(number);
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed();
+}
+
+bool jsonDecodeSetProtocol(JsonReader data, bool& binary)
+{
+    std::string_view key, raw;
+    bool found = false;
+    if (!data.beginObject())
+    {
+        return false;
+    }
+    while (data.nextMember(key))
+    {
+        if (key == "protocol" && data.peek() == JsonReader::STRING && data.readString(raw))
+        {
+            binary = raw == "binary";
+            found = true;
+        }
+        else
+        {
+            data.skipValue();
+        }
+    }
+    return !data.failed() && found;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "data.h"
+#include "JsonReader.h"
+
+// JSON messages written to the BLE service, decoded with JsonReader without building a tree:
+//   {"type": <MessageType>, "data": {...}}
+// 'data' may also be sent as a string holding the object, as older clients do. It is then
+// unescaped in place in the message buffer.
+//
+// Fields of the wrong type fall back to the same defaults the messages always had, only
+// malformed JSON and invalid configurations are rejected.
+
+// 'data' reads the data object of the message in 'buffer'
+bool jsonDecodeMessage(char* buffer, size_t size, int& type, JsonReader& data);
+
+bool jsonDecodeSetTime(JsonReader data, SetTimeMessage& message);
+bool jsonDecodeSetStationState(JsonReader data, SetStationStateMessage& message);
+// Nothing is applied unless every station and event is valid
+bool jsonDecodeSetConfig(JsonReader data, SetConfigMessage& message);
+// 'mode' is 1 for "delta", 0 for any other mode and -1 when the message doesn't select one
+bool jsonDecodeRequestNotify(JsonReader data, int& mode);
+bool jsonDecodeGetHistory(JsonReader data, uint32_t& from, uint32_t& to);
+bool jsonDecodeSetProtocol(JsonReader data, bool& binary);
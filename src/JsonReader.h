@@ -0,0 +1,442 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <string.h>
+#include <string>
+#include <string_view>
+
+// Pull parser over a JSON text in memory, it reads values in place in a single pass and
+// never allocates. Containers are walked with beginObject/nextMember and
+// beginArray/nextElement, every member or element value must be read or skipped before
+// asking for the next one. Once anything fails the reader stays failed.
+class JsonReader
+{
+public:
+    enum Type
+    {
+        INVALID,
+        OBJECT,
+        ARRAY,
+        STRING,
+        NUMBER,
+        BOOL,
+        NUL,
+    };
+
+    JsonReader() :
+        m_data(nullptr), m_size(0), m_offset(0), m_first(false), m_failed(true)
+    {}
+
+    JsonReader(const char* data, size_t size) :
+        m_data(data), m_size(size), m_offset(0), m_first(false), m_failed(false)
+    {}
+
+    // Type of the next value, without consuming it
+    Type peek()
+    {
+        skipWhitespace();
+        if (m_failed || m_offset == m_size)
+        {
+            return INVALID;
+        }
+        switch (m_data[m_offset])
+        {
+            case '{': return OBJECT;
+            case '[': return ARRAY;
+            case '"': return STRING;
+            case 't': case 'f': return BOOL;
+            case 'n': return NUL;
+            case '-': case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9': return NUMBER;
+            default: return INVALID;
+        }
+    }
+
+    bool beginObject()
+    {
+        return begin('{');
+    }
+
+    // Reads the next member's key and its colon. Returns false after the closing brace and
+    // on errors, which failed() tells apart.
+    bool nextMember(std::string_view& key)
+    {
+        if (!next('}'))
+        {
+            return false;
+        }
+        skipWhitespace();
+        if (!readString(key) || !expect(':'))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    bool beginArray()
+    {
+        return begin('[');
+    }
+
+    // Returns false after the closing bracket and on errors, which failed() tells apart
+    bool nextElement()
+    {
+        return next(']');
+    }
+
+    // The string's contents between the quotes, escapes are left as they are
+    bool readString(std::string_view& raw)
+    {
+        if (peek() != STRING)
+        {
+            return fail();
+        }
+        size_t start = ++m_offset;
+        while (m_offset < m_size && m_data[m_offset] != '"')
+        {
+            if ((uint8_t)m_data[m_offset] < 0x20)
+            {
+                return fail();
+            }
+            m_offset += m_data[m_offset] == '\\' ? 2 : 1;
+        }
+        if (m_offset >= m_size)
+        {
+            return fail();
+        }
+        raw = std::string_view(m_data + start, m_offset - start);
+        m_offset++;
+        return true;
+    }
+
+    bool readNumber(double& value)
+    {
+        if (peek() != NUMBER)
+        {
+            return fail();
+        }
+        bool negative = consume('-');
+        double mantissa = 0;
+        int exponent = 0;
+        size_t digits = readDigits(mantissa, exponent, false);
+        if (digits == 0 || (digits > 1 && m_data[m_offset - digits] == '0'))
+        {
+            return fail();
+        }
+        if (consume('.') && readDigits(mantissa, exponent, true) == 0)
+        {
+            return fail();
+        }
+        if (consume('e') || consume('E'))
+        {
+            bool negativeExponent = consume('-');
+            if (!negativeExponent)
+            {
+                consume('+');
+            }
+            int e = 0;
+            size_t start = m_offset;
+            while (m_offset < m_size && m_data[m_offset] >= '0' && m_data[m_offset] <= '9')
+            {
+                e = e < 10000 ? e * 10 + (m_data[m_offset] - '0') : e;
+                m_offset++;
+            }
+            if (m_offset == start)
+            {
+                return fail();
+            }
+            exponent += negativeExponent ? -e : e;
+        }
+        value = mantissa * std::pow(10.0, exponent);
+        value = negative ? -value : value;
+        return true;
+    }
+
+    bool readBool(bool& value)
+    {
+        if (peek() != BOOL)
+        {
+            return fail();
+        }
+        value = m_data[m_offset] == 't';
+        return literal(value ? "true" : "false");
+    }
+
+    // Skips the next value. Skipped containers are only checked for balanced brackets and
+    // well formed strings, without recursing however deep they nest.
+    bool skipValue()
+    {
+        Type type = peek();
+        if (type == STRING)
+        {
+            std::string_view raw;
+            return readString(raw);
+        }
+        if (type == NUMBER)
+        {
+            double value;
+            return readNumber(value);
+        }
+        if (type == BOOL)
+        {
+            bool value;
+            return readBool(value);
+        }
+        if (type == NUL)
+        {
+            return literal("null");
+        }
+        if (type == INVALID)
+        {
+            return fail();
+        }
+        size_t depth = 0;
+        do
+        {
+            skipWhitespace();
+            if (m_offset == m_size)
+            {
+                return fail();
+            }
+            char c = m_data[m_offset];
+            if (c == '"')
+            {
+                std::string_view raw;
+                if (!readString(raw))
+                {
+                    return false;
+                }
+                continue;
+            }
+            depth += (c == '{' || c == '[') ? 1 : 0;
+            depth -= (c == '}' || c == ']') ? 1 : 0;
+            m_offset++;
+        }
+        while (depth > 0);
+        return true;
+    }
+
+    bool failed() const { return m_failed; }
+    size_t offset() const { return m_offset; }
+
+    // Decodes the escapes of a raw string in place and returns the decoded size, which is
+    // never larger. Returns false on invalid escapes.
+    static bool unescape(char* data, size_t size, size_t& decodedSize)
+    {
+        size_t out = 0;
+        for (size_t in = 0; in < size; )
+        {
+            if (data[in] != '\\')
+            {
+                data[out++] = data[in++];
+                continue;
+            }
+            if (in + 1 >= size)
+            {
+                return false;
+            }
+            char c = data[in + 1];
+            in += 2;
+            switch (c)
+            {
+                case '"': case '\\': case '/': data[out++] = c; break;
+                case 'b': data[out++] = '\b'; break;
+                case 'f': data[out++] = '\f'; break;
+                case 'n': data[out++] = '\n'; break;
+                case 'r': data[out++] = '\r'; break;
+                case 't': data[out++] = '\t'; break;
+                case 'u':
+                {
+                    uint32_t code;
+                    if (!readHex(data, size, in, code))
+                    {
+                        return false;
+                    }
+                    // A high surrogate needs its low half
+                    if (code >= 0xD800 && code < 0xDC00)
+                    {
+                        uint32_t low;
+                        if (in + 1 >= size || data[in] != '\\' || data[in + 1] != 'u')
+                        {
+                            return false;
+                        }
+                        in += 2;
+                        if (!readHex(data, size, in, low) || low < 0xDC00 || low >= 0xE000)
+                        {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    else if (code >= 0xDC00 && code < 0xE000)
+                    {
+                        return false;
+                    }
+                    out += putUtf8(data + out, code);
+                }
+                break;
+
+                default:
+                    return false;
+            }
+        }
+        decodedSize = out;
+        return true;
+    }
+
+    // Decoded copy of a raw string
+    static bool unescape(std::string_view raw, std::string& str)
+    {
+        str.assign(raw);
+        size_t size;
+        if (!unescape(&str[0], str.size(), size))
+        {
+            return false;
+        }
+        str.resize(size);
+        return true;
+    }
+
+private:
+    bool fail()
+    {
+        m_failed = true;
+        return false;
+    }
+
+    void skipWhitespace()
+    {
+        while (m_offset < m_size && (m_data[m_offset] == ' ' || m_data[m_offset] == '\t' ||
+            m_data[m_offset] == '\n' || m_data[m_offset] == '\r'))
+        {
+            m_offset++;
+        }
+    }
+
+    bool consume(char c)
+    {
+        if (m_offset < m_size && m_data[m_offset] == c)
+        {
+            m_offset++;
+            return true;
+        }
+        return false;
+    }
+
+    bool expect(char c)
+    {
+        skipWhitespace();
+        return !m_failed && consume(c) ? true : fail();
+    }
+
+    bool literal(const char* text)
+    {
+        size_t length = strlen(text);
+        if (m_size - m_offset < length || memcmp(m_data + m_offset, text, length) != 0)
+        {
+            return fail();
+        }
+        m_offset += length;
+        return true;
+    }
+
+    bool begin(char open)
+    {
+        if (!expect(open))
+        {
+            return false;
+        }
+        m_first = true;
+        return true;
+    }
+
+    // Steps over the separator in front of the next member or element
+    bool next(char close)
+    {
+        skipWhitespace();
+        if (m_failed)
+        {
+            return false;
+        }
+        if (consume(close))
+        {
+            m_first = false;
+            return false;
+        }
+        if (!m_first && !expect(','))
+        {
+            return false;
+        }
+        m_first = false;
+        return true;
+    }
+
+    size_t readDigits(double& mantissa, int& exponent, bool fraction)
+    {
+        size_t start = m_offset;
+        while (m_offset < m_size && m_data[m_offset] >= '0' && m_data[m_offset] <= '9')
+        {
+            mantissa = mantissa * 10 + (m_data[m_offset] - '0');
+            exponent -= fraction ? 1 : 0;
+            m_offset++;
+        }
+        return m_offset - start;
+    }
+
+    static bool readHex(const char* data, size_t size, size_t& in, uint32_t& code)
+    {
+        if (size - in < 4)
+        {
+            return false;
+        }
+        code = 0;
+        for (size_t i = 0; i < 4; i++)
+        {
+            char c = data[in + i];
+            uint32_t digit = (c >= '0' && c <= '9') ? c - '0' :
+                (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 16;
+            if (digit == 16)
+            {
+                return false;
+            }
+            code = code << 4 | digit;
+        }
+        in += 4;
+        return true;
+    }
+
+    static size_t putUtf8(char* out, uint32_t code)
+    {
+        if (code < 0x80)
+        {
+            out[0] = code;
+            return 1;
+        }
+        if (code < 0x800)
+        {
+            out[0] = 0xC0 | (code >> 6);
+            out[1] = 0x80 | (code & 0x3F);
+            return 2;
+        }
+        if (code < 0x10000)
+        {
+            out[0] = 0xE0 | (code >> 12);
+            out[1] = 0x80 | ((code >> 6) & 0x3F);
+            out[2] = 0x80 | (code & 0x3F);
+            return 3;
+        }
+        out[0] = 0xF0 | (code >> 18);
+        out[1] = 0x80 | ((code >> 12) & 0x3F);
+        out[2] = 0x80 | ((code >> 6) & 0x3F);
+        out[3] = 0x80 | (code & 0x3F);
+        return 4;
+    }
+
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset;
+    bool m_first;
+    bool m_failed;
+};
@@ -0,0 +1,42 @@
+#include <string.h>
+
+#include "LatenessHistogram.h"
+
+const int32_t LatenessHistogram::BUCKET_BOUNDS_MS[LatenessHistogram::NUM_BOUNDS] = {
+    0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000
+};
+
+LatenessHistogram::LatenessHistogram()
+{
+    reset();
+}
+
+void LatenessHistogram::record(int64_t latenessMs)
+{
+    size_t bucket = 0;
+    while (bucket < NUM_BOUNDS && latenessMs > BUCKET_BOUNDS_MS[bucket])
+    {
+        bucket++;
+    }
+    m_buckets[bucket]++;
+
+    if (m_count == 0 || latenessMs < m_minMs)
+    {
+        m_minMs = latenessMs;
+    }
+    if (m_count == 0 || latenessMs > m_maxMs)
+    {
+        m_maxMs = latenessMs;
+    }
+    m_lastMs = latenessMs;
+    m_count++;
+}
+
+void LatenessHistogram::reset()
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+    m_count = 0;
+    m_minMs = 0;
+    m_maxMs = 0;
+    m_lastMs = 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Fixed-bucket histogram of scheduling lateness, recording never allocates
+class LatenessHistogram
+{
+public:
+    // Upper bounds (inclusive) of all buckets but the last, which holds everything above
+    static const size_t NUM_BOUNDS = 12;
+    static const size_t NUM_BUCKETS = NUM_BOUNDS + 1;
+    static const int32_t BUCKET_BOUNDS_MS[NUM_BOUNDS];
+
+    LatenessHistogram();
+    ~LatenessHistogram() = default;
+
+    void record(int64_t latenessMs);
+    void reset();
+
+    uint32_t getCount() const { return m_count; }
+    int64_t getMinMs() const { return m_minMs; }
+    int64_t getMaxMs() const { return m_maxMs; }
+    int64_t getLastMs() const { return m_lastMs; }
+    uint32_t getBucketCount(size_t bucket) const { return bucket < NUM_BUCKETS ? m_buckets[bucket] : 0; }
+
+private:
+    uint32_t m_buckets[NUM_BUCKETS];
+    uint32_t m_count;
+    int64_t m_minMs;
+    int64_t m_maxMs;
+    int64_t m_lastMs;
+};
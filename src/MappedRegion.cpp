@@ -0,0 +1,198 @@
+#include "MappedRegion.h"
+
+#include "esp32-hal-log.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#endif
+
+
+MappedRegion::MappedRegion(const char* name, size_t size) :
+    m_name(name),
+    m_size(size),
+    m_data(nullptr),
+    m_partition(nullptr),
+    m_mapHandle(0),
+    m_fd(-1)
+{
+}
+
+MappedRegion::~MappedRegion()
+{
+    close();
+}
+
+#ifdef ESP_PLATFORM
+
+bool MappedRegion::open()
+{
+    if (m_data != nullptr)
+    {
+        return true;
+    }
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, m_name.c_str());
+    if (partition == nullptr)
+    {
+        log_e("No partition labeled %s", m_name.c_str());
+        return false;
+    }
+    m_partition = partition;
+    m_size = partition->size;
+    return map();
+}
+
+void MappedRegion::close()
+{
+    unmap();
+    m_partition = nullptr;
+}
+
+bool MappedRegion::map()
+{
+    const void* data;
+    spi_flash_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(static_cast<const esp_partition_t*>(m_partition), 0, m_size,
+        SPI_FLASH_MMAP_DATA, &data, &handle);
+    if (err != ESP_OK)
+    {
+        log_e("Failed mapping partition %s (%s)", m_name.c_str(), esp_err_to_name(err));
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(data);
+    m_mapHandle = handle;
+    return true;
+}
+
+void MappedRegion::unmap()
+{
+    if (m_data != nullptr)
+    {
+        spi_flash_munmap(m_mapHandle);
+        m_data = nullptr;
+    }
+}
+
+bool MappedRegion::erase(size_t offset, size_t size)
+{
+    size_t start = offset / SECTOR_SIZE * SECTOR_SIZE;
+    size_t end = (offset + size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    esp_err_t err = esp_partition_erase_range(static_cast<const esp_partition_t*>(m_partition), start, end - start);
+    if (err != ESP_OK)
+    {
+        log_e("Failed erasing %s (%s)", m_name.c_str(), esp_err_to_name(err));
+    }
+    // The cache may still hold the old contents of the mapping
+    unmap();
+    return map() && err == ESP_OK;
+}
+
+bool MappedRegion::write(size_t offset, const uint8_t* data, size_t size)
+{
+    esp_err_t err = esp_partition_write(static_cast<const esp_partition_t*>(m_partition), offset, data, size);
+    if (err != ESP_OK)
+    {
+        log_e("Failed writing %s (%s)", m_name.c_str(), esp_err_to_name(err));
+    }
+    unmap();
+    return map() && err == ESP_OK;
+}
+
+#else
+
+bool MappedRegion::open()
+{
+    if (m_data != nullptr)
+    {
+        return true;
+    }
+    m_fd = ::open(m_name.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (m_fd < 0 || fstat(m_fd, &st) != 0)
+    {
+        log_e("Failed opening %s", m_name.c_str());
+        close();
+        return false;
+    }
+    if ((size_t)st.st_size != m_size)
+    {
+        // A new region, starts out erased like flash
+        std::vector<uint8_t> erased(m_size, 0xFF);
+        if (ftruncate(m_fd, 0) != 0 || pwrite(m_fd, erased.data(), m_size, 0) != (ssize_t)m_size)
+        {
+            log_e("Failed creating %s", m_name.c_str());
+            close();
+            return false;
+        }
+    }
+    if (!map())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedRegion::close()
+{
+    unmap();
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool MappedRegion::map()
+{
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        log_e("Failed mapping %s", m_name.c_str());
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(data);
+    return true;
+}
+
+void MappedRegion::unmap()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+        m_data = nullptr;
+    }
+}
+
+bool MappedRegion::erase(size_t offset, size_t size)
+{
+    size_t start = offset / SECTOR_SIZE * SECTOR_SIZE;
+    size_t end = (offset + size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    std::vector<uint8_t> erased(end - start, 0xFF);
+    bool ok = pwrite(m_fd, erased.data(), erased.size(), start) == (ssize_t)erased.size() && fsync(m_fd) == 0;
+    if (!ok)
+    {
+        log_e("Failed erasing %s", m_name.c_str());
+    }
+    // Same sequence as on the ESP32, a shared mapping is coherent anyway
+    unmap();
+    return map() && ok;
+}
+
+bool MappedRegion::write(size_t offset, const uint8_t* data, size_t size)
+{
+    bool ok = pwrite(m_fd, data, size, offset) == (ssize_t)size && fsync(m_fd) == 0;
+    if (!ok)
+    {
+        log_e("Failed writing %s", m_name.c_str());
+    }
+    unmap();
+    return map() && ok;
+}
+
+#endif
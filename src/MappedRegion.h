@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Raw flash region mapped read-only into the address space: a data partition mapped with
+// esp_partition_mmap on the ESP32, a file of the same layout mapped with mmap on Linux.
+// Erases and writes go through the flash API, the mapping is refreshed after each of them.
+class MappedRegion
+{
+public:
+    static const size_t SECTOR_SIZE = 4096;
+
+    // 'name' is the partition label on the ESP32 and the file path on Linux,
+    // where 'size' is the size of the file (the partition size is used on the ESP32)
+    MappedRegion(const char* name, size_t size);
+    ~MappedRegion();
+
+    bool open();
+    void close();
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    // Offsets and sizes are rounded out to whole sectors, erased bytes read as 0xFF
+    bool erase(size_t offset, size_t size);
+    bool write(size_t offset, const uint8_t* data, size_t size);
+
+private:
+    bool map();
+    void unmap();
+
+    std::string m_name;
+    size_t m_size;
+    const uint8_t* m_data;
+    // esp_partition_t* and spi_flash_mmap_handle_t on the ESP32, the file descriptor on Linux
+    const void* m_partition;
+    uint32_t m_mapHandle;
+    int m_fd;
+};
@@ -0,0 +1,128 @@
+#include "NvsStorageBackend.h"
+
+#include "esp32-hal-log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+
+NvsStorageBackend::NvsStorageBackend(const char* nameSpace) :
+    m_nameSpace(nameSpace),
+    m_handle(0),
+    m_isOpen(false)
+{
+}
+
+NvsStorageBackend::~NvsStorageBackend()
+{
+    close();
+}
+
+bool NvsStorageBackend::open()
+{
+    if (m_isOpen)
+    {
+        return true;
+    }
+    // Already initialized by the bluetooth stack on most boots, in which case this is a no-op
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        log_w("NVS partition needs to be erased (%s)", esp_err_to_name(err));
+        err = nvs_flash_erase();
+        if (err == ESP_OK)
+        {
+            err = nvs_flash_init();
+        }
+    }
+    if (err != ESP_OK)
+    {
+        log_e("Failed to init NVS (%s)", esp_err_to_name(err));
+        return false;
+    }
+    nvs_handle_t handle;
+    err = nvs_open(m_nameSpace.c_str(), NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        log_e("Failed to open NVS namespace %s (%s)", m_nameSpace.c_str(), esp_err_to_name(err));
+        return false;
+    }
+    m_handle = handle;
+    m_isOpen = true;
+    return true;
+}
+
+void NvsStorageBackend::close()
+{
+    if (!m_isOpen)
+    {
+        return;
+    }
+    nvs_commit(m_handle);
+    nvs_close(m_handle);
+    m_isOpen = false;
+}
+
+bool NvsStorageBackend::read(const char* key, std::vector<uint8_t>& buffer)
+{
+    size_t size = 0;
+    esp_err_t err = nvs_get_blob(m_handle, key, nullptr, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return false;
+    }
+    if (err == ESP_OK)
+    {
+        buffer.resize(size);
+        err = size == 0 ? ESP_OK : nvs_get_blob(m_handle, key, buffer.data(), &size);
+    }
+    if (err != ESP_OK)
+    {
+        log_e("Failed reading %s (%s)", key, esp_err_to_name(err));
+        return false;
+    }
+    m_bytesRead += size;
+    return true;
+}
+
+bool NvsStorageBackend::write(const char* key, const std::vector<uint8_t>& buffer)
+{
+    esp_err_t err = nvs_set_blob(m_handle, key, buffer.data(), buffer.size());
+    if (err != ESP_OK)
+    {
+        log_e("Failed writing %s (%s)", key, esp_err_to_name(err));
+        return false;
+    }
+    m_bytesWritten += buffer.size();
+    m_writeCount++;
+    return true;
+}
+
+bool NvsStorageBackend::append(const char* key, const std::vector<uint8_t>& buffer)
+{
+    std::vector<uint8_t> value;
+    read(key, value);
+    value.insert(value.end(), buffer.begin(), buffer.end());
+    return write(key, value);
+}
+
+bool NvsStorageBackend::erase(const char* key)
+{
+    esp_err_t err = nvs_erase_key(m_handle, key);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+    {
+        log_e("Failed erasing %s (%s)", key, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool NvsStorageBackend::commit()
+{
+    esp_err_t err = nvs_commit(m_handle);
+    if (err != ESP_OK)
+    {
+        log_e("Failed committing NVS (%s)", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
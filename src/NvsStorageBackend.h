@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "StorageBackend.h"
+
+// Stores every key as a blob in an NVS namespace. NVS can't append to a blob,
+// so appending rewrites the whole value, which suits small tables only.
+// Keys are limited to 15 characters.
+class NvsStorageBackend : public StorageBackend
+{
+public:
+    NvsStorageBackend(const char* nameSpace);
+    ~NvsStorageBackend();
+
+    const char* getName() const override { return "nvs"; }
+
+    bool open() override;
+    void close() override;
+
+    bool read(const char* key, std::vector<uint8_t>& buffer) override;
+    bool write(const char* key, const std::vector<uint8_t>& buffer) override;
+    bool append(const char* key, const std::vector<uint8_t>& buffer) override;
+    bool erase(const char* key) override;
+    bool commit() override;
+
+private:
+    std::string m_nameSpace;
+    uint32_t m_handle;
+    bool m_isOpen;
+};
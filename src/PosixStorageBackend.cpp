@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "PosixStorageBackend.h"
+
+#include "esp32-hal-log.h"
+
+
+PosixStorageBackend::PosixStorageBackend(const char* basePath) :
+    m_basePath(basePath)
+{
+}
+
+bool PosixStorageBackend::open()
+{
+    struct stat st;
+    if (stat(m_basePath.c_str(), &st) == 0)
+    {
+        return true;
+    }
+    if (mkdir(m_basePath.c_str(), 0755) != 0)
+    {
+        log_e("Failed creating %s", m_basePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string PosixStorageBackend::getPath(const char* key) const
+{
+    return m_basePath + "/" + key;
+}
+
+// Reads a whole file into memory with a single read
+bool PosixStorageBackend::read(const char* key, std::vector<uint8_t>& buffer)
+{
+    std::string path = getPath(key);
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    if (ok)
+    {
+        buffer.resize(size);
+        ok = size == 0 || fread(buffer.data(), 1, size, f) == (size_t)size;
+    }
+    fclose(f);
+    if (!ok)
+    {
+        log_e("Failed reading %s", path.c_str());
+        return false;
+    }
+    m_bytesRead += size;
+    return true;
+}
+
+// Writes a buffer with a single write and syncs it, 'mode' is passed to fopen
+bool PosixStorageBackend::writeFile(const char* key, const char* mode, const std::vector<uint8_t>& buffer)
+{
+    std::string path = getPath(key);
+    FILE* f = fopen(path.c_str(), mode);
+    if (f == nullptr)
+    {
+        log_e("Failed opening %s", path.c_str());
+        return false;
+    }
+    bool ok = buffer.empty() || fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        log_e("Failed writing %s", path.c_str());
+        return false;
+    }
+    m_bytesWritten += buffer.size();
+    m_writeCount++;
+    return true;
+}
+
+bool PosixStorageBackend::write(const char* key, const std::vector<uint8_t>& buffer)
+{
+    return writeFile(key, "wb", buffer);
+}
+
+bool PosixStorageBackend::append(const char* key, const std::vector<uint8_t>& buffer)
+{
+    return writeFile(key, "ab", buffer);
+}
+
+bool PosixStorageBackend::erase(const char* key)
+{
+    std::string path = getPath(key);
+    if (remove(path.c_str()) != 0 && errno != ENOENT)
+    {
+        log_e("Failed removing %s", path.c_str());
+        return false;
+    }
+    return true;
+}
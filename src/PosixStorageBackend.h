@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "StorageBackend.h"
+
+// Stores every key as a file in a directory, used as is on Linux and as the base
+// of the FAT backend on the device
+class PosixStorageBackend : public StorageBackend
+{
+public:
+    PosixStorageBackend(const char* basePath);
+
+    const char* getName() const override { return "posix"; }
+
+    bool open() override;
+    void close() override {}
+
+    bool read(const char* key, std::vector<uint8_t>& buffer) override;
+    bool write(const char* key, const std::vector<uint8_t>& buffer) override;
+    bool append(const char* key, const std::vector<uint8_t>& buffer) override;
+    bool erase(const char* key) override;
+    // Every write is synced already
+    bool commit() override { return true; }
+
+    std::string getFilePath(const char* name) const override { return getPath(name); }
+
+protected:
+    std::string getPath(const char* key) const;
+    bool writeFile(const char* key, const char* mode, const std::vector<uint8_t>& buffer);
+
+    std::string m_basePath;
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bounds-checked cursor over a db file that was read into memory in one go.
+// Every read fails instead of running past the end of the buffer.
+class RecordReader
+{
+public:
+    RecordReader() :
+        m_data(nullptr), m_size(0), m_offset(0)
+    {}
+
+    RecordReader(const uint8_t* data, size_t size) :
+        m_data(data), m_size(size), m_offset(0)
+    {}
+
+    template <class T>
+    bool read(T& value)
+    {
+        if (remaining() < sizeof(T))
+        {
+            return false;
+        }
+        memcpy(&value, m_data + m_offset, sizeof(T));
+        m_offset += sizeof(T);
+        return true;
+    }
+
+    // Fixed width little-endian integer, independent of the host byte order
+    template <class T>
+    bool readLe(T& value)
+    {
+        if (remaining() < sizeof(T))
+        {
+            return false;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            v |= (uint64_t)m_data[m_offset + i] << (8 * i);
+        }
+        value = (T)v;
+        m_offset += sizeof(T);
+        return true;
+    }
+
+    // Points 'bytes' at the next 'length' bytes without copying them
+    bool readBytes(const uint8_t*& bytes, size_t length)
+    {
+        if (remaining() < length)
+        {
+            return false;
+        }
+        bytes = m_data + m_offset;
+        m_offset += length;
+        return true;
+    }
+
+    // Length prefixed string, the length is read in host byte order unless 'le' is set
+    template <class LengthType>
+    bool readString(std::string& str, bool le = false)
+    {
+        LengthType length;
+        const uint8_t* bytes;
+        if (!(le ? readLe(length) : read(length)) || !readBytes(bytes, length))
+        {
+            return false;
+        }
+        str.assign(reinterpret_cast<const char*>(bytes), length);
+        return true;
+    }
+
+    // Like readString, but the view points into the buffer instead of copying it
+    template <class LengthType>
+    bool readStringView(std::string_view& str, bool le = false)
+    {
+        LengthType length;
+        const uint8_t* bytes;
+        if (!(le ? readLe(length) : read(length)) || !readBytes(bytes, length))
+        {
+            return false;
+        }
+        str = std::string_view(reinterpret_cast<const char*>(bytes), length);
+        return true;
+    }
+
+    // Length prefixed byte array, the length is read in host byte order unless 'le' is set
+    template <class LengthType>
+    bool readVector(std::vector<uint8_t>& vec, bool le = false)
+    {
+        LengthType length;
+        const uint8_t* bytes;
+        if (!(le ? readLe(length) : read(length)) || !readBytes(bytes, length))
+        {
+            return false;
+        }
+        vec.assign(bytes, bytes + length);
+        return true;
+    }
+
+    // Reader over the next 'length' bytes, which are skipped in this reader
+    bool readSubReader(RecordReader& sub, size_t length)
+    {
+        const uint8_t* bytes;
+        if (!readBytes(bytes, length))
+        {
+            return false;
+        }
+        sub = RecordReader(bytes, length);
+        return true;
+    }
+
+    const uint8_t* data() const { return m_data; }
+    size_t remaining() const { return m_size - m_offset; }
+    size_t offset() const { return m_offset; }
+    bool atEnd() const { return m_offset == m_size; }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_offset;
+};
@@ -1,35 +1,415 @@
 
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
 
 #include "Storage.h"
+#include "StorageBackend.h"
+#include "MappedRegion.h"
+#include "RecordReader.h"
+#include "DbFormat.h"
+#include "Clock.h"
 
 #include "esp32-hal-log.h"
-#include "esp_vfs.h"
-#include "esp_vfs_fat.h"
 
 
-// Mount path for the partition
-const char *BASE_PATH = "/spiflash";
-const char* STATIONS_FILE = "/spiflash/stations.bin";
-const char* EVENTS_FILE = "/spiflash/events.bin";
+// Snapshots are committed to alternating A/B slots, the single key is the pre A/B location.
+// Keys double as file names on the file based backends and must fit an NVS key (15 chars).
+const char* STATIONS_KEY = "stations.bin";
+const char* EVENTS_KEY = "events.bin";
+const char* STATIONS_SLOT_KEYS[2] = { "stations.a.bin", "stations.b.bin" };
+const char* EVENTS_SLOT_KEYS[2] = { "events.a.bin", "events.b.bin" };
+const char* STATIONS_LOG_KEY = "stations.log";
+const char* EVENTS_LOG_KEY = "events.log";
 
-static wl_handle_t s_wl_handle = WL_INVALID_HANDLE;
+// Edits are appended to a log next to each snapshot, once the log grows past
+// this size it is compacted into a fresh snapshot
+#define LOG_COMPACTION_THRESHOLD 4096
 
-Storage::Storage()
+// The snapshot region holds four slots: stations A/B, then events A/B
+#define REGION_STATIONS_SLOT 0
+#define REGION_EVENTS_SLOT 2
+#define REGION_NUM_SLOTS 4
+
+// Station state changes are flushed once no change happened for the quiet period,
+// or when the oldest pending change reaches the maximum age
+#define FLUSH_QUIET_PERIOD_MS 5000
+#define FLUSH_MAX_AGE_MS 30000
+
+// A snapshot read back for its strings is dropped once unused for this long
+#define STRINGS_CACHE_TTL_MS 10000
+
+// Readers for the layout of the original stations.bin/events.bin (native size_t length
+// prefixes, no header), only used for migrating those files
+static bool readBaselineRecord(RecordReader& reader, Station& s)
+{
+    return reader.read(s.id) &&
+        reader.read(s.gpio_pin) &&
+        reader.readString<size_t>(s.name) &&
+        reader.read(s.is_on);
+}
+
+static bool readBaselineRecord(RecordReader& reader, Event& e)
+{
+    // Event::duration was stored as 8 bytes, only the low 4 are meaningful
+    int64_t duration = 0;
+    bool ok = reader.read(e.id) &&
+        reader.readVector<size_t>(e.stations_ids) &&
+        reader.readString<size_t>(e.name) &&
+        reader.readString<size_t>(e.cron_expr) &&
+        reader.read(duration);
+    e.duration = (int32_t)duration;
+    return ok;
+}
+
+// Decodes the fixed fields of a record, its strings are left in the snapshot
+static bool decodeFixedFields(RecordReader& reader, Station& station)
+{
+    std::string_view name;
+    return dbDecodeRecord(reader, station, name);
+}
+
+static bool decodeFixedFields(RecordReader& reader, Event& event)
+{
+    std::string_view name, cronExpr;
+    return dbDecodeRecord(reader, event, name, cronExpr);
+}
+
+// Decodes a full snapshot. A truncated or corrupt snapshot is rejected as a whole.
+// The strings aren't decoded, the offset of every record in the snapshot is stored instead.
+template <class T>
+static bool decodeSnapshot(const char* key, const uint8_t* data, size_t size, IdTable<T>& records,
+    uint32_t& sequence, uint32_t* offsets)
+{
+    records.clear();
+    memset(offsets, 0, IdTable<T>::MAX_IDS * sizeof(uint32_t));
+    RecordReader reader(data, size);
+    uint32_t numOfRecords;
+    if (!dbCheckSnapshot(reader, dbTableOf(T()), sequence, numOfRecords))
+    {
+        log_e("%s failed validation, rejecting it", key);
+        return false;
+    }
+    log_i("Reading %d records from %s", numOfRecords, key);
+
+    for (uint32_t i = 0; i < numOfRecords; i++)
+    {
+        T record;
+        uint32_t offset = reader.offset();
+        if (!decodeFixedFields(reader, record))
+        {
+            log_e("%s is truncated or corrupt at record #%d, rejecting it", key, i);
+            records.clear();
+            return false;
+        }
+        offsets[record.id] = offset;
+        records.set(std::move(record));
+    }
+    if (!reader.atEnd())
+    {
+        log_e("%s has %d trailing bytes, rejecting it", key, reader.remaining());
+        records.clear();
+        return false;
+    }
+    return true;
+}
+
+// Decodes a whole stations.bin/events.bin in the original layout, with its strings
+template <class T>
+static bool decodeBaselineSnapshot(const char* key, const uint8_t* data, size_t size, IdTable<T>& records)
+{
+    records.clear();
+    RecordReader reader(data, size);
+    uint32_t numOfRecords;
+    if (!reader.read(numOfRecords))
+    {
+        log_i("Failed reading number of records from %s", key);
+        return false;
+    }
+    log_i("Migrating %d records from %s", numOfRecords, key);
+
+    for (uint32_t i = 0; i < numOfRecords; i++)
+    {
+        T record;
+        if (!readBaselineRecord(reader, record))
+        {
+            log_e("%s is truncated or corrupt at record #%d, rejecting it", key, i);
+            records.clear();
+            return false;
+        }
+        records.set(std::move(record));
+    }
+    if (!reader.atEnd())
+    {
+        log_e("%s has %d trailing bytes, rejecting it", key, reader.remaining());
+        records.clear();
+        return false;
+    }
+    return true;
+}
+
+// Loads the newest valid A/B slot. When neither slot is valid the db of the original
+// firmware is loaded instead and 'migrate' is set, so it gets committed to a slot.
+// A missing snapshot leaves the table empty. The records of a slot are decoded without
+// their strings, the slot is kept in 'snapshot' to read them from.
+template <class T>
+static bool loadSnapshot(StorageBackend& backend, const char* const slotKeys[2], const char* baselineKey,
+    IdTable<T>& records, uint32_t& sequence, bool& migrate, uint32_t* offsets, std::vector<uint8_t>& snapshot)
+{
+    records.clear();
+    sequence = 0;
+    migrate = false;
+    bool loaded = false;
+    std::vector<uint8_t> buffer;
+    for (int slot = 0; slot < 2; slot++)
+    {
+        IdTable<T> slotRecords;
+        uint32_t slotSequence;
+        uint32_t slotOffsets[IdTable<T>::MAX_IDS];
+        if (!backend.read(slotKeys[slot], buffer) ||
+            !decodeSnapshot(slotKeys[slot], buffer.data(), buffer.size(), slotRecords, slotSequence, slotOffsets))
+        {
+            continue;
+        }
+        if (!loaded || slotSequence > sequence)
+        {
+            records = std::move(slotRecords);
+            sequence = slotSequence;
+            memcpy(offsets, slotOffsets, sizeof(slotOffsets));
+            snapshot.swap(buffer);
+            loaded = true;
+        }
+    }
+    if (loaded)
+    {
+        log_i("Loaded snapshot #%d", sequence);
+        return true;
+    }
+
+    memset(offsets, 0, IdTable<T>::MAX_IDS * sizeof(uint32_t));
+    snapshot.clear();
+    if (!backend.read(baselineKey, buffer))
+    {
+        log_i("No snapshot found");
+        return false;
+    }
+    migrate = true;
+    return decodeBaselineSnapshot(baselineKey, buffer.data(), buffer.size(), records);
+}
+
+// Commits a full snapshot of the table with the given sequence number. The slot holding
+// the current snapshot is left untouched, so a failed commit leaves it in place.
+template <class T>
+static bool writeSnapshot(StorageBackend& backend, const char* const slotKeys[2], const IdTable<T>& records,
+    uint32_t sequence, std::vector<uint8_t>& buffer)
+{
+    buffer.clear();
+    dbEncodeSnapshot(buffer, records, sequence);
+    return backend.write(slotKeys[sequence % 2], buffer) && backend.commit();
+}
+
+// Reads a committed snapshot back, it must still be the one with the sequence number
+static bool readSnapshot(StorageBackend& backend, const char* key, DbTable table, uint32_t sequence,
+    std::vector<uint8_t>& buffer)
+{
+    if (!backend.read(key, buffer) || !dbIsSnapshot(buffer.data(), buffer.size()))
+    {
+        return false;
+    }
+    RecordReader reader(buffer.data(), buffer.size());
+    uint32_t snapshotSequence, numOfRecords;
+    return dbCheckSnapshot(reader, table, snapshotSequence, numOfRecords) && snapshotSequence == sequence;
+}
+
+static size_t getRegionSlotSize(const MappedRegion& region)
+{
+    return region.size() / REGION_NUM_SLOTS / MappedRegion::SECTOR_SIZE * MappedRegion::SECTOR_SIZE;
+}
+
+// The A/B slot of the snapshot region holding the snapshot with the sequence number
+static const uint8_t* getRegionSlot(const MappedRegion& region, size_t firstSlot, uint32_t sequence)
 {
-    log_i("Mounting FAT filesystem");
+    return region.data() + (firstSlot + sequence % 2) * getRegionSlotSize(region);
+}
 
-    esp_vfs_fat_mount_config_t mount_config;
-    mount_config.max_files = 4;
-    mount_config.format_if_mount_failed = true;
-    mount_config.allocation_unit_size = CONFIG_WL_SECTOR_SIZE;
-    esp_err_t err = esp_vfs_fat_spiflash_mount(BASE_PATH, "spiffs", &mount_config, &s_wl_handle);
-    if (err != ESP_OK) {
-        log_e("Failed to mount FATFS (%s)", esp_err_to_name(err));
+// Loads the newest valid A/B slot of the snapshot region. The records are decoded in place
+// without copying their strings, 'offsets' gets the offset of every record in its slot.
+template <class T>
+static bool loadMappedSnapshot(const MappedRegion& region, size_t firstSlot, IdTable<T>& records, uint32_t& sequence,
+    uint32_t* offsets)
+{
+    records.clear();
+    memset(offsets, 0, IdTable<T>::MAX_IDS * sizeof(uint32_t));
+    sequence = 0;
+    size_t slotSize = getRegionSlotSize(region);
+    const uint8_t* snapshot = nullptr;
+    size_t snapshotSize = 0;
+    for (size_t slot = firstSlot; slot < firstSlot + 2; slot++)
+    {
+        const uint8_t* data = region.data() + slot * slotSize;
+        size_t size = dbSnapshotSize(data, slotSize);
+        RecordReader reader(data, size);
+        uint32_t slotSequence, numOfRecords;
+        if (size == 0 || !dbCheckSnapshot(reader, dbTableOf(T()), slotSequence, numOfRecords))
+        {
+            continue;
+        }
+        if (snapshot == nullptr || slotSequence > sequence)
+        {
+            snapshot = data;
+            snapshotSize = size;
+            sequence = slotSequence;
+        }
+    }
+    if (snapshot == nullptr)
+    {
+        log_i("No mapped snapshot found");
+        return false;
+    }
+    if (!decodeSnapshot("Mapped snapshot", snapshot, snapshotSize, records, sequence, offsets))
+    {
+        return false;
+    }
+    log_i("Loaded mapped snapshot #%d with %d records", sequence, records.size());
+    return true;
+}
+
+// Commits a full snapshot to the A/B slot of the snapshot region for the sequence number
+template <class T>
+static bool writeMappedSnapshot(MappedRegion& region, size_t firstSlot, const IdTable<T>& records, uint32_t sequence)
+{
+    std::vector<uint8_t> buffer;
+    dbEncodeSnapshot(buffer, records, sequence);
+    size_t slotSize = getRegionSlotSize(region);
+    if (buffer.size() > slotSize)
+    {
+        log_e("Snapshot of %d bytes doesn't fit a %d byte slot", buffer.size(), slotSize);
+        return false;
+    }
+    size_t offset = (firstSlot + sequence % 2) * slotSize;
+    return region.erase(offset, buffer.size()) && region.write(offset, buffer.data(), buffer.size());
+}
+
+// Appends an encoded log record, the log header is written first for a new log.
+// Returns the new size of the log or 0 on failure.
+template <class T>
+static size_t appendLogRecord(StorageBackend& backend, const char* key, size_t logSize, uint32_t baseSequence,
+    std::vector<uint8_t>& record)
+{
+    bool ok;
+    if (logSize == 0)
+    {
+        std::vector<uint8_t> header;
+        dbEncodeLogHeader(header, dbTableOf(T()), baseSequence);
+        record.insert(record.begin(), header.begin(), header.end());
+        ok = backend.write(key, record);
+    }
+    else
+    {
+        ok = backend.append(key, record);
+    }
+    if (!ok || !backend.commit())
+    {
+        log_e("Failed appending to log %s", key);
+        return 0;
+    }
+    return logSize + record.size();
+}
+
+// Replays the log on top of the loaded snapshot. A torn record at the end of the log
+// (power lost while appending) ends the replay. A log written for another snapshot
+// (power lost between committing a snapshot and removing the log) is ignored.
+// 'compact' is set when the log can't be appended to and should be folded into a
+// fresh snapshot. Returns the log size.
+template <class T>
+static size_t replayLog(StorageBackend& backend, const char* key, IdTable<T>& records, uint32_t sequence,
+    bool& compact, uint32_t* offsets)
+{
+    uint32_t baseSequence;
+    compact = false;
+    std::vector<uint8_t> buffer;
+    if (!backend.read(key, buffer))
+    {
+        return 0;
+    }
+
+    RecordReader reader(buffer.data(), buffer.size());
+    size_t replayed = 0;
+    if (!dbCheckLogHeader(reader, dbTableOf(T()), baseSequence))
+    {
+        log_e("%s has an invalid header, ignoring it", key);
+        compact = true;
+    }
+    else if (baseSequence != sequence)
+    {
+        log_w("%s belongs to snapshot #%d, not #%d, ignoring it", key, baseSequence, sequence);
+        compact = true;
+    }
+    else
+    {
+        while (!reader.atEnd())
+        {
+            DbLogOp op;
+            RecordReader payload;
+            T record;
+            if (!dbDecodeLogRecord(reader, op, payload))
+            {
+                log_w("Torn record at end of %s", key);
+                compact = true;
+                break;
+            }
+            if (op == DB_LOG_UPSERT && dbDecodeRecord(payload, record))
+            {
+                offsets[record.id] = 0;
+                records.set(std::move(record));
+            }
+            else if (op == DB_LOG_DELETE && payload.readLe(record.id))
+            {
+                offsets[record.id] = 0;
+                records.erase(record.id);
+            }
+            else
+            {
+                log_e("Invalid log record %d in %s", op, key);
+                compact = true;
+                break;
+            }
+            replayed++;
+        }
+    }
+    log_i("Replayed %d records from %s", replayed, key);
+    return buffer.size();
+}
+
+Storage::Storage(StorageBackend* backend, MappedRegion* snapshotRegion, Clock* clock) :
+    m_backend(backend),
+    m_snapshotRegion(snapshotRegion),
+    m_clock(clock != nullptr ? clock : &Clock::system()),
+    m_stationsSequence(0),
+    m_eventsSequence(0),
+    m_stationsLogSize(0),
+    m_eventsLogSize(0),
+    m_firstDirtyMs(0),
+    m_lastDirtyMs(0),
+    m_stationsRevision(0),
+    m_eventsRevision(0),
+    m_inTransaction(false)
+{
+    // Without a backend the tables stay empty, but their strings must still be valid
+    resetStrings(m_stationStrings);
+    resetStrings(m_eventStrings);
+    log_i("Opening %s storage backend", m_backend->getName());
+    if (!m_backend->open())
+    {
+        log_e("Failed to open storage backend");
         return;
     }
+    if (m_snapshotRegion != nullptr && !m_snapshotRegion->open())
+    {
+        log_e("Failed to open the snapshot region, keeping snapshots on the backend");
+        m_snapshotRegion = nullptr;
+    }
 
     loadStations();
     if (m_stations.empty())
@@ -53,259 +433,637 @@ Storage::Storage()
 
 Storage::~Storage()
 {    
-    // Unmount FATFS
-    log_i("Unmounting FAT filesystem");
-    ESP_ERROR_CHECK( esp_vfs_fat_spiflash_unmount(BASE_PATH, s_wl_handle));
+    flush();
+    if (m_snapshotRegion != nullptr)
+    {
+        m_snapshotRegion->close();
+    }
+    m_backend->close();
 }
 
 bool Storage::loadStations()
 {
-    FILE* f = fopen(STATIONS_FILE, "rb");
-    if (f == nullptr)
+    bool migrate = false;
+    bool loaded = m_snapshotRegion != nullptr &&
+        loadMappedSnapshot(*m_snapshotRegion, REGION_STATIONS_SLOT, m_stations, m_stationsSequence, m_stationStrings.offsets);
+    m_stationStrings.mapped = loaded;
+    if (!loaded)
     {
-        log_i("Failed opening stations db");
-        return false;
+        loaded = loadSnapshot(*m_backend, STATIONS_SLOT_KEYS, STATIONS_KEY, m_stations, m_stationsSequence, migrate, m_stationStrings.offsets,
+            m_stationStrings.cache);
+        m_stationStrings.lastUsedMs = m_clock->getMonotonicMs();
+        // The snapshot moves to the region
+        migrate = migrate || (loaded && m_snapshotRegion != nullptr);
     }
-    uint32_t numOfStations;
-    if (fread(&numOfStations, sizeof(uint32_t), 1, f) == 0)
+
+    bool compact;
+    m_stationsLogSize = replayLog(*m_backend, STATIONS_LOG_KEY, m_stations, m_stationsSequence, compact, m_stationStrings.offsets);
+    log_i("Loaded %d stations", m_stations.size());
+    m_stationsRevision++;
+    if (migrate || compact)
     {
-        log_i("Failed reading number of stations");
-        return false;
+        // Start over from a fresh snapshot in the current format
+        if (!setStations(m_stations))
+        {
+            return false;
+        }
+        m_backend->erase(STATIONS_KEY);
+        return true;
     }
+    return loaded || m_stationsLogSize > 0;
+}
 
-    std::vector<Station> vec(numOfStations);
-    for (int i = 0; i < numOfStations; i++)
+bool Storage::loadEvents()
+{
+    bool migrate = false;
+    bool loaded = m_snapshotRegion != nullptr &&
+        loadMappedSnapshot(*m_snapshotRegion, REGION_EVENTS_SLOT, m_events, m_eventsSequence, m_eventStrings.offsets);
+    m_eventStrings.mapped = loaded;
+    if (!loaded)
     {
-        auto& s = vec[i];
-        size_t size = 0;
-        fread(&s.id, sizeof(uint8_t), 1, f);
-        fread(&s.gpio_pin, sizeof(uint8_t), 1, f);
-        fread(&size, sizeof(size_t), 1, f);
-        char* name = new char[size + 1];
-        memset(name, 0, size + 1);
-        fread(name, sizeof(char), size, f);
-        fread(&s.is_on, sizeof(bool), 1, f);
-        s.name = std::string(name);
-        delete[] name;
+        loaded = loadSnapshot(*m_backend, EVENTS_SLOT_KEYS, EVENTS_KEY, m_events, m_eventsSequence, migrate, m_eventStrings.offsets,
+            m_eventStrings.cache);
+        m_eventStrings.lastUsedMs = m_clock->getMonotonicMs();
+        // The snapshot moves to the region
+        migrate = migrate || (loaded && m_snapshotRegion != nullptr);
     }
-    fclose(f);
-    m_stations = to_map(vec);
-    return true;
+
+    bool compact;
+    m_eventsLogSize = replayLog(*m_backend, EVENTS_LOG_KEY, m_events, m_eventsSequence, compact, m_eventStrings.offsets);
+    m_eventsRevision++;
+    for (const auto& e : m_events)
+    {
+        std::string_view name = getEventName(e);
+        log_i("Event id: %d, name: %.*s", e.id, (int)name.size(), name.data());
+    }
+    if (migrate || compact)
+    {
+        // Start over from a fresh snapshot in the current format
+        if (!setEvents(m_events))
+        {
+            return false;
+        }
+        m_backend->erase(EVENTS_KEY);
+        return true;
+    }
+    return loaded || m_eventsLogSize > 0;
 }
 
-bool Storage::loadEvents()
+void Storage::loop()
 {
-    FILE* f = fopen(EVENTS_FILE, "rb");
-    if (f == nullptr)
+    if (getMsUntilFlush() == 0)
     {
-        log_e("Failed opening events db");
-        return false;
+        flush();
     }
-    uint32_t numOfEvents;
-    if (fread(&numOfEvents, sizeof(uint32_t), 1, f) == 0)
+
+    // Compaction rewrites the whole table, so it is kept out of the edit path
+    if (m_stationsLogSize > LOG_COMPACTION_THRESHOLD)
+    {
+        log_i("Compacting stations log (%d bytes)", m_stationsLogSize);
+        setStations(m_stations);
+    }
+    if (m_eventsLogSize > LOG_COMPACTION_THRESHOLD)
+    {
+        log_i("Compacting events log (%d bytes)", m_eventsLogSize);
+        setEvents(m_events);
+    }
+
+    releaseStrings(m_stationStrings);
+    releaseStrings(m_eventStrings);
+}
+
+void Storage::markStationDirty(uint32_t id)
+{
+    int64_t now = m_clock->getMonotonicMs();
+    if (m_dirtyStations.empty())
+    {
+        m_firstDirtyMs = now;
+    }
+    m_lastDirtyMs = now;
+    m_dirtyStations.insert(id);
+    m_stationsRevision++;
+}
+
+int64_t Storage::getMsUntilFlush() const
+{
+    if (m_dirtyStations.empty())
+    {
+        return -1;
+    }
+    int64_t due = std::min(m_lastDirtyMs + FLUSH_QUIET_PERIOD_MS, m_firstDirtyMs + FLUSH_MAX_AGE_MS);
+    int64_t now = m_clock->getMonotonicMs();
+    return due > now ? due - now : 0;
+}
+
+bool Storage::flush()
+{
+    if (m_dirtyStations.empty())
+    {
+        return true;
+    }
+
+    // Every dirty station goes into a single append
+    std::vector<uint8_t> records;
+    for (auto id : m_dirtyStations)
+    {
+        const Station* station = m_stations.find(id);
+        if (station != nullptr)
+        {
+            dbEncodeLogUpsert(records, resolve(*station));
+        }
+    }
+    size_t logSize = records.empty() ? m_stationsLogSize :
+        appendLogRecord<Station>(*m_backend, STATIONS_LOG_KEY, m_stationsLogSize, m_stationsSequence, records);
+    if (logSize == 0)
     {
-        log_e("Failed reading number of events");
         return false;
     }
-    log_i("Reading %d events from db", numOfEvents);
-
-    std::vector<Event> vec(numOfEvents);
-    for (int i = 0; i < numOfEvents; i++)
-    {
-        auto& e = vec[i];
-        size_t size = 0;
-        fread(&e.id, sizeof(uint8_t), 1, f);
-        fread(&size, sizeof(size_t), 1, f);
-        e.stations_ids.resize(size);
-        fread(&e.stations_ids[0], sizeof(uint8_t), size, f);
-        fread(&size, sizeof(size_t), 1, f);
-        char* name = new char[size + 1];
-        memset(name, 0, size + 1);
-        fread(name, sizeof(char), size, f);
-        e.name = std::string(name);
-        fread(&size, sizeof(size_t), 1, f);
-        char* cron = new char[size + 1];
-        memset(cron, 0, size + 1);
-        fread(cron, sizeof(char), size, f);
-        e.cron_expr = std::string(cron);
-        fread(&e.duration, sizeof(int64_t), 1, f);
-        delete[] cron;
-        delete[] name;
-    }
-    for(int i = 0; i < numOfEvents; i++)
-    {
-        log_i("Event #%d id: %d, name: %s", (i+1), vec[i].id, vec[i].name.c_str());
-    }
-    fclose(f);
-    m_events = to_map(vec);
+    log_i("Flushed state of %d stations", m_dirtyStations.size());
+    m_stationsLogSize = logSize;
+    m_dirtyStations.clear();
     return true;
 }
 
 bool Storage::clear()
 {
-    return true;
+    // Drops every snapshot and log of both tables
+    const char* keys[] = {
+        STATIONS_KEY, STATIONS_SLOT_KEYS[0], STATIONS_SLOT_KEYS[1], STATIONS_LOG_KEY,
+        EVENTS_KEY, EVENTS_SLOT_KEYS[0], EVENTS_SLOT_KEYS[1], EVENTS_LOG_KEY,
+    };
+    bool ok = true;
+    for (auto key : keys)
+    {
+        ok = m_backend->erase(key) && ok;
+    }
+    ok = m_backend->commit() && ok;
+
+    m_stations.clear();
+    m_events.clear();
+    m_dirtyStations.clear();
+    if (m_snapshotRegion != nullptr)
+    {
+        ok = m_snapshotRegion->erase(0, m_snapshotRegion->size()) && ok;
+    }
+    resetStrings(m_stationStrings);
+    resetStrings(m_eventStrings);
+    m_stationsSequence = m_eventsSequence = 0;
+    m_stationsLogSize = m_eventsLogSize = 0;
+    m_stationsRevision++;
+    m_eventsRevision++;
+    return ok;
 }
 
 bool Storage::addStation(const Station& station)
 {
-    if (m_stations.find(station.id) != m_stations.end())
+    if (m_stations.contains(station.id))
     {
         log_i("Station already exists. Not overriding");
         return false;
     }
     log_i("Adding station %d", station.id);
-    m_stations.insert({station.id, station});
-
-    return setStations(m_stations);
+    std::vector<uint8_t> record;
+    dbEncodeLogUpsert(record, station);
+    size_t logSize = appendLogRecord<Station>(*m_backend, STATIONS_LOG_KEY, m_stationsLogSize, m_stationsSequence, record);
+    if (logSize == 0)
+    {
+        return false;
+    }
+    m_stationsLogSize = logSize;
+    m_stationsRevision++;
+    m_stationStrings.offsets[station.id] = 0;
+    m_stations.insert(station);
+    return true;
 }
 
 bool Storage::removeStation(uint32_t id)
 {
-    if (m_stations.find(id) == m_stations.end())
+    if (!m_stations.contains(id))
     {
         log_i("Station not found");
         return false;
     }
+    std::vector<uint8_t> record;
+    dbEncodeLogDelete(record, id);
+    size_t logSize = appendLogRecord<Station>(*m_backend, STATIONS_LOG_KEY, m_stationsLogSize, m_stationsSequence, record);
+    if (logSize == 0)
+    {
+        return false;
+    }
+    m_stationsLogSize = logSize;
+    m_stationsRevision++;
+    m_stationStrings.offsets[id] = 0;
     m_stations.erase(id);
-
-    return setStations(m_stations);
+    return true;
 }
 
 bool Storage::clearStations()
 {
-    FILE* f = fopen(STATIONS_FILE, "wb");
-    if (f == nullptr)
-    {
-        log_i("Failed opening stations db");
-        return false;
-    }
-    fclose(f);
-    return true;
+    m_stations.clear();
+    return setStations(m_stations);
 }
 
-bool Storage::setStations(const std::map<uint32_t, Station>& stations)
+bool Storage::setStations(const StationTable& stations)
 {
-    FILE* f = fopen(STATIONS_FILE, "wb");
-    if (f == nullptr)
+    StationTable resolved = resolveAll(stations);
+    std::vector<uint8_t> snapshot;
+    bool ok = m_snapshotRegion != nullptr ?
+        writeMappedSnapshot(*m_snapshotRegion, REGION_STATIONS_SLOT, resolved, m_stationsSequence + 1) :
+        writeSnapshot(*m_backend, STATIONS_SLOT_KEYS, resolved, m_stationsSequence + 1, snapshot);
+    if (!ok)
     {
-        log_i("Failed opening stations db");
+        log_e("Failed writing stations db");
         return false;
     }
-    uint32_t numOfStations = stations.size();
-    if (fwrite(&numOfStations, sizeof(uint32_t), 1, f) == 0)
+    m_stationsSequence++;
+    m_stationsRevision++;
+    log_i("Wrote %d stations to db (snapshot #%d)", resolved.size(), m_stationsSequence);
+    m_dirtyStations.clear();
+
+    // Keep the fixed fields in RAM, the strings are read from the new snapshot
+    if (m_snapshotRegion != nullptr)
     {
-        log_i("Failed writing number of stations");
-        return false;
+        loadMappedSnapshot(*m_snapshotRegion, REGION_STATIONS_SLOT, m_stations, m_stationsSequence, m_stationStrings.offsets);
     }
-    for (const auto& station : stations)
+    else
     {
-        const auto& s = station.second;
-        const auto name = s.name.c_str();
-        size_t size = s.name.length();
-
-        fwrite(&s.id, sizeof(uint8_t), 1, f);
-        fwrite(&s.gpio_pin, sizeof(uint8_t), 1, f);
-        fwrite(&size, sizeof(size_t), 1, f);
-        fwrite(name, sizeof(char), size, f);
-        fwrite(&s.is_on, sizeof(bool), 1, f);        
+        decodeSnapshot(STATIONS_SLOT_KEYS[m_stationsSequence % 2], snapshot.data(), snapshot.size(), m_stations, m_stationsSequence,
+            m_stationStrings.offsets);
+        m_stationStrings.cache.swap(snapshot);
+        m_stationStrings.lastUsedMs = m_clock->getMonotonicMs();
     }
-    fclose(f);
-    log_i("Wrote %d stations to db", numOfStations);
-    m_stations = stations;
+    m_stationStrings.mapped = m_snapshotRegion != nullptr;
+
+    // The snapshot holds every edit now
+    m_backend->erase(STATIONS_LOG_KEY);
+    m_backend->commit();
+    m_stationsLogSize = 0;
     return true;
 }
 
 Station* Storage::getStation(uint32_t id)
 {
-    if (m_stations.find(id) == m_stations.end())
+    Station* station = m_stations.find(id);
+    if (station == nullptr)
     {
         log_w("Station not found");
-        return nullptr;
     }
-    return &m_stations.at(id);
+    return station;
 }
 
 bool Storage::addEvent(const Event& event)
 {
-    if (m_events.find(event.id) != m_events.end())
+    if (m_events.contains(event.id))
     {
         log_i("Event already exists. Not overriding");
         return false;
     }
-    m_events.insert({event.id, event});
-
     log_i("Adding event %d", event.id);
-    return setEvents(m_events);
+    std::vector<uint8_t> record;
+    dbEncodeLogUpsert(record, event);
+    size_t logSize = appendLogRecord<Event>(*m_backend, EVENTS_LOG_KEY, m_eventsLogSize, m_eventsSequence, record);
+    if (logSize == 0)
+    {
+        return false;
+    }
+    m_eventsLogSize = logSize;
+    m_eventsRevision++;
+    m_eventStrings.offsets[event.id] = 0;
+    m_events.insert(event);
+    return true;
 }
 
 bool Storage::removeEvent(uint32_t id)
 {
-    if (m_events.find(id) == m_events.end())
+    if (!m_events.contains(id))
     {
         log_i("Event not found");
         return false;
     }
+    std::vector<uint8_t> record;
+    dbEncodeLogDelete(record, id);
+    size_t logSize = appendLogRecord<Event>(*m_backend, EVENTS_LOG_KEY, m_eventsLogSize, m_eventsSequence, record);
+    if (logSize == 0)
+    {
+        return false;
+    }
+    m_eventsLogSize = logSize;
+    m_eventsRevision++;
+    m_eventStrings.offsets[id] = 0;
     m_events.erase(id);
-
-    return setStations(m_stations);
+    return true;
 }
 
 bool Storage::clearEvents()
 {
-    FILE* f = fopen(EVENTS_FILE, "wb");
-    if (f == nullptr)
+    m_events.clear();
+    return setEvents(m_events);
+}
+
+bool Storage::setEvents(const EventTable& events)
+{
+    EventTable resolved = resolveAll(events);
+    std::vector<uint8_t> snapshot;
+    bool ok = m_snapshotRegion != nullptr ?
+        writeMappedSnapshot(*m_snapshotRegion, REGION_EVENTS_SLOT, resolved, m_eventsSequence + 1) :
+        writeSnapshot(*m_backend, EVENTS_SLOT_KEYS, resolved, m_eventsSequence + 1, snapshot);
+    if (!ok)
     {
-        log_i("Failed opening events db");
+        log_e("Failed writing events db");
         return false;
     }
-    fclose(f);
+    m_eventsSequence++;
+    m_eventsRevision++;
+    log_i("Wrote %d events to db (snapshot #%d)", resolved.size(), m_eventsSequence);
+
+    // Keep the fixed fields in RAM, the strings are read from the new snapshot
+    if (m_snapshotRegion != nullptr)
+    {
+        loadMappedSnapshot(*m_snapshotRegion, REGION_EVENTS_SLOT, m_events, m_eventsSequence, m_eventStrings.offsets);
+    }
+    else
+    {
+        decodeSnapshot(EVENTS_SLOT_KEYS[m_eventsSequence % 2], snapshot.data(), snapshot.size(), m_events, m_eventsSequence,
+            m_eventStrings.offsets);
+        m_eventStrings.cache.swap(snapshot);
+        m_eventStrings.lastUsedMs = m_clock->getMonotonicMs();
+    }
+    m_eventStrings.mapped = m_snapshotRegion != nullptr;
+
+    // The snapshot holds every edit now
+    m_backend->erase(EVENTS_LOG_KEY);
+    m_backend->commit();
+    m_eventsLogSize = 0;
     return true;
 }
 
-bool Storage::setEvents(const std::map<uint32_t, Event>& events)
+Event* Storage::getEvent(uint32_t id)
+{
+    Event* event = m_events.find(id);
+    if (event == nullptr)
+    {
+        log_i("Event not found");
+    }
+    return event;
+}
+
+static bool sameRecord(const Station& a, const Station& b)
+{
+    return a.gpio_pin == b.gpio_pin && a.name == b.name && a.is_on == b.is_on;
+}
+
+static bool sameRecord(const Event& a, const Event& b)
+{
+    return a.stations_ids == b.stations_ids && a.name == b.name && a.cron_expr == b.cron_expr &&
+        a.duration == b.duration;
+}
+
+// Ids added to, changed in and removed from a table, in id order
+template <class T>
+static void diffTables(const IdTable<T>& before, const IdTable<T>& after, std::vector<uint32_t>& added,
+    std::vector<uint32_t>& changed, std::vector<uint32_t>& removed)
+{
+    for (uint32_t id = 0; id < IdTable<T>::MAX_IDS; id++)
+    {
+        const T* old = before.find(id);
+        const T* staged = after.find(id);
+        if (old == nullptr && staged != nullptr)
+        {
+            added.push_back(id);
+        }
+        else if (old != nullptr && staged == nullptr)
+        {
+            removed.push_back(id);
+        }
+        else if (old != nullptr && !sameRecord(*old, *staged))
+        {
+            changed.push_back(id);
+        }
+    }
+}
+
+bool Storage::beginTransaction()
 {
-    FILE* f = fopen(EVENTS_FILE, "wb");
-    if (f == nullptr)
+    if (m_inTransaction)
     {
-        log_i("Failed opening events db");
+        log_e("A transaction is already open");
         return false;
     }
-    uint32_t numOfEvents = events.size();
-    if (fwrite(&numOfEvents, sizeof(uint32_t), 1, f) == 0)
+    m_inTransaction = true;
+    m_stagedStations = resolveAll(m_stations);
+    m_stagedEvents = resolveAll(m_events);
+    return true;
+}
+
+bool Storage::stageStation(const Station& station)
+{
+    if (!m_inTransaction)
     {
-        log_i("Failed writing number of events");
+        log_e("No open transaction");
         return false;
     }
-    for (const auto& event : events)
-    {
-        const auto& e = event.second;
-        const auto name = e.name.c_str();
-        const auto cron = e.cron_expr.c_str();        
-        fwrite(&e.id, sizeof(uint8_t), 1, f);
-        size_t size = e.stations_ids.size();
-        fwrite(&size, sizeof(size_t), 1, f);
-        fwrite(&e.stations_ids[0], sizeof(uint8_t), size, f);
-        size = e.name.length();
-        fwrite(&size, sizeof(size_t), 1, f);
-        fwrite(name, sizeof(char), e.name.length(), f);
-        size = e.cron_expr.length();
-        fwrite(&size, sizeof(size_t), 1, f);
-        fwrite(cron, sizeof(char), e.cron_expr.length(), f);
-        fwrite(&e.duration, sizeof(int64_t), 1, f);
-    }
-    fclose(f);
-    log_i("Wrote %d events to db", numOfEvents);
-    m_events = events;
+    m_stagedStations.set(station);
     return true;
 }
 
-Event* Storage::getEvent(uint32_t id)
+bool Storage::stageStationRemoval(uint32_t id)
 {
-    if (m_events.find(id) == m_events.end())
+    if (!m_inTransaction)
     {
-        log_i("Event not found");
-        return nullptr;
+        log_e("No open transaction");
+        return false;
     }
-    return &m_events.at(id);
+    return m_stagedStations.erase(id);
 }
 
+bool Storage::stageEvent(const Event& event)
+{
+    if (!m_inTransaction)
+    {
+        log_e("No open transaction");
+        return false;
+    }
+    m_stagedEvents.set(event);
+    return true;
+}
+
+bool Storage::stageEventRemoval(uint32_t id)
+{
+    if (!m_inTransaction)
+    {
+        log_e("No open transaction");
+        return false;
+    }
+    return m_stagedEvents.erase(id);
+}
+
+bool Storage::stageClear()
+{
+    if (!m_inTransaction)
+    {
+        log_e("No open transaction");
+        return false;
+    }
+    m_stagedStations.clear();
+    m_stagedEvents.clear();
+    return true;
+}
+
+bool Storage::commitTransaction(StorageDiff& diff)
+{
+    diff = StorageDiff();
+    if (!m_inTransaction)
+    {
+        log_e("No open transaction");
+        return false;
+    }
+    m_inTransaction = false;
+
+    // Each table is written at most once and only if it changed. The tables are committed one
+    // after the other, a failure reports only what reached the db.
+    bool ok = true;
+    diffTables(resolveAll(m_stations), m_stagedStations, diff.addedStations, diff.changedStations,
+        diff.removedStations);
+    if (!diff.stationsEmpty() && !setStations(m_stagedStations))
+    {
+        diff = StorageDiff();
+        ok = false;
+    }
+    if (ok)
+    {
+        diffTables(resolveAll(m_events), m_stagedEvents, diff.addedEvents, diff.changedEvents, diff.removedEvents);
+        if (!diff.eventsEmpty() && !setEvents(m_stagedEvents))
+        {
+            diff.addedEvents.clear();
+            diff.changedEvents.clear();
+            diff.removedEvents.clear();
+            ok = false;
+        }
+    }
+    log_i("Committed transaction: stations +%d ~%d -%d, events +%d ~%d -%d", diff.addedStations.size(),
+        diff.changedStations.size(), diff.removedStations.size(), diff.addedEvents.size(),
+        diff.changedEvents.size(), diff.removedEvents.size());
+
+    m_stagedStations.clear();
+    m_stagedEvents.clear();
+    return ok;
+}
+
+void Storage::abortTransaction()
+{
+    m_inTransaction = false;
+    m_stagedStations.clear();
+    m_stagedEvents.clear();
+}
+
+
+void Storage::resetStrings(SnapshotStrings& strings)
+{
+    memset(strings.offsets, 0, sizeof(strings.offsets));
+    std::vector<uint8_t>().swap(strings.cache);
+    strings.lastUsedMs = 0;
+    strings.mapped = false;
+}
+
+void Storage::releaseStrings(SnapshotStrings& strings) const
+{
+    if (!strings.cache.empty() && m_clock->getMonotonicMs() - strings.lastUsedMs >= STRINGS_CACHE_TTL_MS)
+    {
+        log_d("Releasing %d bytes of cached strings", strings.cache.size());
+        std::vector<uint8_t>().swap(strings.cache);
+    }
+}
+
+bool Storage::getSnapshotStrings(DbTable table, uint32_t id, std::string_view& name, std::string_view& cronExpr) const
+{
+    bool stations = table == DB_TABLE_STATIONS;
+    SnapshotStrings& strings = stations ? m_stationStrings : m_eventStrings;
+    uint32_t sequence = stations ? m_stationsSequence : m_eventsSequence;
+    if (id >= StationTable::MAX_IDS || strings.offsets[id] == 0)
+    {
+        return false;
+    }
+
+    const uint8_t* snapshot;
+    size_t size;
+    if (strings.mapped)
+    {
+        snapshot = getRegionSlot(*m_snapshotRegion, stations ? REGION_STATIONS_SLOT : REGION_EVENTS_SLOT, sequence);
+        size = getRegionSlotSize(*m_snapshotRegion);
+    }
+    else
+    {
+        const char* key = (stations ? STATIONS_SLOT_KEYS : EVENTS_SLOT_KEYS)[sequence % 2];
+        if (strings.cache.empty())
+        {
+            if (!readSnapshot(*m_backend, key, table, sequence, strings.cache))
+            {
+                log_e("%s doesn't hold snapshot #%d, strings are unavailable", key, sequence);
+                std::vector<uint8_t>().swap(strings.cache);
+                return false;
+            }
+            log_d("Read %d bytes of strings from %s", strings.cache.size(), key);
+        }
+        strings.lastUsedMs = m_clock->getMonotonicMs();
+        snapshot = strings.cache.data();
+        size = strings.cache.size();
+    }
+    RecordReader reader(snapshot + strings.offsets[id], size - strings.offsets[id]);
+    return dbDecodeStrings(reader, table, name, cronExpr);
+}
+
+std::string_view Storage::getStationName(const Station& station) const
+{
+    std::string_view name, cronExpr;
+    if (station.name.empty() && getSnapshotStrings(DB_TABLE_STATIONS, station.id, name, cronExpr))
+    {
+        return name;
+    }
+    return station.name;
+}
+
+std::string_view Storage::getEventName(const Event& event) const
+{
+    std::string_view name, cronExpr;
+    if (event.name.empty() && getSnapshotStrings(DB_TABLE_EVENTS, event.id, name, cronExpr))
+    {
+        return name;
+    }
+    return event.name;
+}
+
+std::string_view Storage::getEventCron(const Event& event) const
+{
+    std::string_view name, cronExpr;
+    if (event.cron_expr.empty() && getSnapshotStrings(DB_TABLE_EVENTS, event.id, name, cronExpr))
+    {
+        return cronExpr;
+    }
+    return event.cron_expr;
+}
+
+Station Storage::resolve(const Station& station) const
+{
+    Station resolved = station;
+    resolved.name = std::string(getStationName(station));
+    return resolved;
+}
+
+Event Storage::resolve(const Event& event) const
+{
+    Event resolved = event;
+    resolved.name = std::string(getEventName(event));
+    resolved.cron_expr = std::string(getEventCron(event));
+    return resolved;
+}
+
+template <class T>
+IdTable<T> Storage::resolveAll(const IdTable<T>& records) const
+{
+    IdTable<T> resolved;
+    for (const auto& record : records)
+    {
+        resolved.set(resolve(record));
+    }
+    return resolved;
+}
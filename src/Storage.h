@@ -1,30 +1,71 @@
 #pragma once
 
-#include <map>
+#include <set>
 
 #include "esp_log.h"
 
 #include "data.h"
+#include "DbFormat.h"
 
+class StorageBackend;
+class MappedRegion;
+class Clock;
+
+// Ids of the records a transaction added, changed or removed, in id order
+struct StorageDiff
+{
+    std::vector<uint32_t> addedStations;
+    std::vector<uint32_t> changedStations;
+    std::vector<uint32_t> removedStations;
+    std::vector<uint32_t> addedEvents;
+    std::vector<uint32_t> changedEvents;
+    std::vector<uint32_t> removedEvents;
+
+    bool stationsEmpty() const { return addedStations.empty() && changedStations.empty() && removedStations.empty(); }
+    bool eventsEmpty() const { return addedEvents.empty() && changedEvents.empty() && removedEvents.empty(); }
+};
 
 class Storage
 {
 public:
-    Storage();
+    // The backend is opened here and closed by the destructor, it isn't owned.
+    // With a snapshot region the snapshots are committed to raw flash instead of the backend
+    // and mapped. Use the string getters below, the name/cron_expr members of records that
+    // weren't edited since the last snapshot are empty. The flush and string cache timers
+    // use the system clock unless one is given.
+    Storage(StorageBackend* backend, MappedRegion* snapshotRegion = nullptr, Clock* clock = nullptr);
     ~Storage();
 
     bool loadStations();
     bool loadEvents();
 
+    // Housekeeping, flushes station state changes when due and compacts the edit logs
+    // into fresh snapshots once they grew too large
+    void loop();
+
+    // Station state changes are persisted lazily, all pending changes are written in one
+    // batch once no change happened for a quiet period or the oldest one got too old.
+    // Every change to a station returned by getStation() must be reported here.
+    void markStationDirty(uint32_t id);
+    bool flush();
+    // Milliseconds until pending changes are due to be flushed, -1 if there are none
+    int64_t getMsUntilFlush() const;
+
+    // Bumped on every change to a table, lets readers cache what they derive from it
+    uint32_t getStationsRevision() const { return m_stationsRevision; }
+    uint32_t getEventsRevision() const { return m_eventsRevision; }
+
+    // Erases the whole db from the backend
     bool clear();
 
     bool addStation(const Station& station);
     bool removeStation(uint32_t id);
 
     bool clearStations();
-    bool setStations(const std::map<uint32_t, Station>& stations);
+    // Writes a full snapshot, folding in (and removing) the edit log
+    bool setStations(const StationTable& stations);
     
-    const std::map<uint32_t, Station>& getStations() const { return m_stations; }
+    const StationTable& getStations() const { return m_stations; }
     Station* getStation(uint32_t id);
 
 
@@ -32,13 +73,83 @@ public:
     bool removeEvent(uint32_t id);
 
     bool clearEvents();
-    bool setEvents(const std::map<uint32_t, Event>& events);
+    // Writes a full snapshot, folding in (and removing) the edit log
+    bool setEvents(const EventTable& events);
 
-    const std::map<uint32_t, Event>& getEvents() const { return m_events; }
+    const EventTable& getEvents() const { return m_events; }
     Event* getEvent(uint32_t id);
 
+    // Bulk edits: stage changes to copies of the tables, then commit writes one snapshot per
+    // changed table and reports what changed. Staged records replace those with the same id.
+    bool beginTransaction();
+    bool stageStation(const Station& station);
+    bool stageStationRemoval(uint32_t id);
+    bool stageEvent(const Event& event);
+    bool stageEventRemoval(uint32_t id);
+    // Removes every station and event, to stage a whole new configuration
+    bool stageClear();
+    bool commitTransaction(StorageDiff& diff);
+    void abortTransaction();
+    bool inTransaction() const { return m_inTransaction; }
+
+    // Strings of a record. Records are kept without their strings, those are read from the
+    // committed snapshot on demand (see SnapshotStrings) unless the record was edited since.
+    // Only valid until the next call to loop() or a write.
+    std::string_view getStationName(const Station& station) const;
+    std::string_view getEventName(const Event& event) const;
+    std::string_view getEventCron(const Event& event) const;
+
 private:
-    std::map<uint32_t, Station> m_stations;
-    std::map<uint32_t, Event> m_events;    
+    // Where the strings of the records decoded without them are read from: the snapshot
+    // region slot, or a copy of the snapshot read back from the backend and dropped once
+    // it wasn't used for a while
+    struct SnapshotStrings
+    {
+        // Offset of every record in the snapshot, 0 if its strings are held in RAM
+        uint32_t offsets[StationTable::MAX_IDS];
+        std::vector<uint8_t> cache;
+        int64_t lastUsedMs;
+        bool mapped;
+    };
+
+    static void resetStrings(SnapshotStrings& strings);
+    void releaseStrings(SnapshotStrings& strings) const;
+    bool getSnapshotStrings(DbTable table, uint32_t id, std::string_view& name, std::string_view& cronExpr) const;
+
+    // Copies with the strings filled in from the snapshot
+    Station resolve(const Station& station) const;
+    Event resolve(const Event& event) const;
+    template <class T>
+    IdTable<T> resolveAll(const IdTable<T>& records) const;
+
+    StorageBackend* m_backend;
+    MappedRegion* m_snapshotRegion;
+    Clock* m_clock;
+    // Filled in lazily by the const getters
+    mutable SnapshotStrings m_stationStrings;
+    mutable SnapshotStrings m_eventStrings;
+
+    StationTable m_stations;
+    EventTable m_events;
+
+    // Sequence number of the committed snapshots
+    uint32_t m_stationsSequence;
+    uint32_t m_eventsSequence;
+
+    // Bytes appended to the edit logs since the last snapshot
+    size_t m_stationsLogSize;
+    size_t m_eventsLogSize;
+
+    // Stations with unpersisted state changes
+    std::set<uint32_t> m_dirtyStations;
+    int64_t m_firstDirtyMs;
+    int64_t m_lastDirtyMs;
+
+    uint32_t m_stationsRevision;
+    uint32_t m_eventsRevision;
+
+    bool m_inTransaction;
+    StationTable m_stagedStations;
+    EventTable m_stagedEvents;
 
 };
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Key/value store the db is persisted to. Values are read and written as a whole,
+// except for append which extends an existing value (used by the edit logs).
+class StorageBackend
+{
+public:
+    virtual ~StorageBackend() {}
+
+    virtual const char* getName() const = 0;
+
+    // Mounts/opens the underlying storage, must be called before any other operation
+    virtual bool open() = 0;
+    virtual void close() = 0;
+
+    // Reads the whole value, returns false if the key doesn't exist or can't be read
+    virtual bool read(const char* key, std::vector<uint8_t>& buffer) = 0;
+    // Replaces the value
+    virtual bool write(const char* key, const std::vector<uint8_t>& buffer) = 0;
+    // Appends to the value, creating it if needed
+    virtual bool append(const char* key, const std::vector<uint8_t>& buffer) = 0;
+    // Removes the key, erasing a missing key succeeds
+    virtual bool erase(const char* key) = 0;
+    // Makes all preceding writes durable
+    virtual bool commit() = 0;
+
+    // Path of a file kept next to the values, for data that needs random access writes
+    // (the history). Empty if the backend doesn't store files.
+    virtual std::string getFilePath(const char*) const { return std::string(); }
+
+    // Counters for comparing backends, bytes written include any rewrite the backend
+    // has to do internally (e.g. appending to an NVS blob rewrites the whole blob)
+    uint32_t getBytesRead() const { return m_bytesRead; }
+    uint32_t getBytesWritten() const { return m_bytesWritten; }
+    uint32_t getWriteCount() const { return m_writeCount; }
+    void resetStats() { m_bytesRead = m_bytesWritten = m_writeCount = 0; }
+
+protected:
+    uint32_t m_bytesRead = 0;
+    uint32_t m_bytesWritten = 0;
+    uint32_t m_writeCount = 0;
+};
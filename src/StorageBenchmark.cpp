@@ -0,0 +1,97 @@
+#include <string>
+
+#include "StorageBenchmark.h"
+#include "StorageBackend.h"
+#include "Storage.h"
+
+#include "esp32-hal-log.h"
+#include "esp_timer.h"
+
+
+// Measures a workload, the backend counters are reset before it runs
+template <class F>
+static StorageBenchmarkResult measure(StorageBackend& backend, const char* workload, F f)
+{
+    backend.resetStats();
+    int64_t start = esp_timer_get_time();
+    f();
+    StorageBenchmarkResult result;
+    result.workload = workload;
+    result.us = esp_timer_get_time() - start;
+    result.bytesRead = backend.getBytesRead();
+    result.bytesWritten = backend.getBytesWritten();
+    result.writes = backend.getWriteCount();
+    return result;
+}
+
+std::vector<StorageBenchmarkResult> runStorageBenchmark(StorageBackend& backend, uint32_t numOfStations,
+    uint32_t numOfEvents, uint32_t numOfEdits)
+{
+    std::vector<StorageBenchmarkResult> results;
+    Storage* storage = new Storage(&backend);
+    storage->clear();
+
+    StationTable stations;
+    for (uint32_t i = 0; i < numOfStations; i++)
+    {
+        stations.set(Station(i, i, "Station " + std::to_string(i), false));
+    }
+    EventTable events;
+    for (uint32_t i = 0; i < numOfEvents; i++)
+    {
+        events.set(Event(i, {(uint8_t)(i % numOfStations)}, "Event " + std::to_string(i), "0 */5 * * * *", 60));
+    }
+    results.push_back(measure(backend, "bulk import", [&]() {
+        storage->setStations(stations);
+        storage->setEvents(events);
+    }));
+
+    // Add/remove pairs keep the table size stable, each one is a log append
+    results.push_back(measure(backend, "single edit", [&]() {
+        for (uint32_t i = 0; i < numOfEdits; i++)
+        {
+            uint32_t id = numOfEvents + (i % 2);
+            if (!storage->removeEvent(id))
+            {
+                storage->addEvent(Event(id, {0}, "Edited event", "0 0 * * * *", 30));
+            }
+        }
+    }));
+
+    results.push_back(measure(backend, "state flush", [&]() {
+        for (uint32_t i = 0; i < numOfEdits; i++)
+        {
+            Station* station = storage->getStation(i % numOfStations);
+            station->is_on = !station->is_on;
+            storage->markStationDirty(station->id);
+            if (i % numOfStations == numOfStations - 1)
+            {
+                storage->flush();
+            }
+        }
+        storage->flush();
+    }));
+
+    results.push_back(measure(backend, "compaction", [&]() {
+        storage->setStations(storage->getStations());
+        storage->setEvents(storage->getEvents());
+    }));
+
+    delete storage;
+    results.push_back(measure(backend, "boot load", [&]() {
+        storage = new Storage(&backend);
+    }));
+
+    storage->clear();
+    delete storage;
+    return results;
+}
+
+void logStorageBenchmark(const StorageBackend& backend, const std::vector<StorageBenchmarkResult>& results)
+{
+    for (const auto& r : results)
+    {
+        log_i("[%s] %-12s %8lld us, %6u bytes read, %6u bytes written in %4u writes",
+            backend.getName(), r.workload, (long long)r.us, r.bytesRead, r.bytesWritten, r.writes);
+    }
+}
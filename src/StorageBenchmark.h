@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class StorageBackend;
+
+struct StorageBenchmarkResult
+{
+    const char* workload;
+    int64_t us;
+    uint32_t bytesRead;
+    uint32_t bytesWritten;
+    uint32_t writes;
+};
+
+// Runs the same db workloads (bulk import, single edits, boot load) on a backend, so
+// backends can be compared by latency and bytes written.
+// Erases the db stored on the backend!
+std::vector<StorageBenchmarkResult> runStorageBenchmark(StorageBackend& backend, uint32_t numOfStations,
+    uint32_t numOfEvents, uint32_t numOfEdits);
+
+void logStorageBenchmark(const StorageBackend& backend, const std::vector<StorageBenchmarkResult>& results);
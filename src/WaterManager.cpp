@@ -3,9 +3,13 @@
 
 
 #include "Storage.h"
+#include "FatStorageBackend.h"
+#include "NvsStorageBackend.h"
+#include "MappedRegion.h"
 #include "Bluetooth.h"
 #include "DS1307.h"
 #include "CronManager.h"
+#include "HistoryLog.h"
 #include "TFT_eSPI.h" 
 #define TEXT "aA MWyz~12" // Text that will be printed on screen in any font
 
@@ -14,9 +18,33 @@
 #include "freertos/task.h"
 
 #include <time.h>
+#include <bitset>
+
+// When enabled the main loop blocks until the next scheduled transition instead of spinning
+#ifndef WATER_MANAGER_TICKLESS
+#define WATER_MANAGER_TICKLESS 1
+#endif
+
+#define LOOP_STATS_INTERVAL_MS 60000
+
+// Where the db lives: 0 = files on the FAT 'spiffs' partition, 1 = blobs in NVS (small tables only,
+// and without the transition history)
+#ifndef WATER_MANAGER_STORAGE_NVS
+#define WATER_MANAGER_STORAGE_NVS 0
+#endif
+
+// 1 = commit snapshots to the raw 'config' partition and read them through the flash cache,
+// the names and cron expressions then stay in flash instead of the heap
+#ifndef WATER_MANAGER_MAPPED_CONFIG
+#define WATER_MANAGER_MAPPED_CONFIG 0
+#endif
 
 WaterManager::WaterManager() :
-    m_backgroundTaskHandle(nullptr)
+    m_backgroundTaskHandle(nullptr),
+    m_loopTaskHandle(xTaskGetCurrentTaskHandle()),
+    m_loopIterations(0),
+    m_loopStatsStartMs(millis()),
+    m_configRegion(nullptr)
 {
     m_lcd = new TFT_eSPI();
   m_lcd->init();
@@ -31,14 +59,35 @@ WaterManager::WaterManager() :
   m_lcd->drawString(TEXT, 160, 120);// Print the string name of the font
 
     log_i("Initializing storage\n");
-    m_storage = new Storage();    
+#if WATER_MANAGER_STORAGE_NVS
+    m_storageBackend = new NvsStorageBackend("blabla");
+#else
+    m_storageBackend = new FatStorageBackend("/spiflash", "spiffs");
+#endif
+#if WATER_MANAGER_MAPPED_CONFIG
+    m_configRegion = new MappedRegion("config", 0x20000);
+#endif
+    m_storage = new Storage(m_storageBackend, m_configRegion);
+
+    // The history is rewritten in place, so it needs a backend that keeps files. Without one
+    // (NVS) it stays closed, transitions aren't recorded and GET_HISTORY returns nothing.
+    std::string historyPath = m_storageBackend->getFilePath("history.bin");
+    m_history = new HistoryLog(historyPath.c_str());
+    if (historyPath.empty())
+    {
+        log_w("The %s storage backend can't hold the history, transitions won't be recorded", m_storageBackend->getName());
+    }
+    else
+    {
+        m_history->open();
+    }
     for (const auto& station : m_storage->getStations())
     {
         // Set station's pin to out        
-        pinMode(station.second.gpio_pin, OUTPUT);
+        pinMode(station.gpio_pin, OUTPUT);
         
-        // Make sure station is off
-        digitalWrite(station.second.gpio_pin, LOW);
+        // Keep the state from before the reset until the events are resumed below
+        digitalWrite(station.gpio_pin, station.is_on ? HIGH : LOW);
     }
 
     log_i("Initializing bluetooth\n");
@@ -54,13 +103,14 @@ WaterManager::WaterManager() :
     updateTimeFromRTC();
 
     log_i("Initializing cron manager\n");
-    m_cronManager = new CronManager();
+    m_cronManager = new CronManager(m_storage);
     m_cronManager->setCronCallbacks(this);
     m_cronManager->begin();    
     for (const auto& e : m_storage->getEvents())
     {
-        m_cronManager->addEvent(e.second);
+        m_cronManager->addEvent(e.id);
     }
+    reconcileStationStates();
 
     log_i("Water Manager initialized\n");
     delay(1000);
@@ -68,7 +118,10 @@ WaterManager::WaterManager() :
 
 WaterManager::~WaterManager()
 {
+    delete m_history;
     delete m_storage;
+    delete m_storageBackend;
+    delete m_configRegion;
     delete m_bluetooth;
     delete m_rtc;
     delete m_cronManager;
@@ -77,10 +130,52 @@ WaterManager::~WaterManager()
 
 void WaterManager::loop()
 {
-    m_cronManager->loop();
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    auto time = localtime(&now.tv_sec);
+    int64_t timeoutMs;
+    {
+        // BLE messages are handled from the NimBLE host task
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cronManager->loop();
+        m_storage->loop();
+        timeoutMs = m_cronManager->getMsUntilNextDeadline();
+        int64_t flushMs = m_storage->getMsUntilFlush();
+        if (flushMs >= 0 && (timeoutMs < 0 || flushMs < timeoutMs))
+        {
+            timeoutMs = flushMs;
+        }
+    }
+    countLoopIteration();
+
+#if WATER_MANAGER_TICKLESS
+    // Sleep until the next transition is due, incoming BLE messages wake us up early.
+    // Wake up at least once per stats interval so the loop rate keeps being reported.
+    if (timeoutMs < 0 || timeoutMs > LOOP_STATS_INTERVAL_MS)
+    {
+        timeoutMs = LOOP_STATS_INTERVAL_MS;
+    }
+    // Round up so we never wake up just before the deadline
+    ulTaskNotifyTake(pdTRUE, (TickType_t)((timeoutMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS));
+#endif
+}
+
+void WaterManager::wakeLoop()
+{
+    if (m_loopTaskHandle != nullptr)
+    {
+        xTaskNotifyGive((TaskHandle_t)m_loopTaskHandle);
+    }
+}
+
+void WaterManager::countLoopIteration()
+{
+    m_loopIterations++;
+    unsigned long elapsedMs = millis() - m_loopStatsStartMs;
+    if (elapsedMs >= LOOP_STATS_INTERVAL_MS)
+    {
+        log_i("Main loop ran %u iterations in %lu ms (%.2f/s)", m_loopIterations, elapsedMs,
+            m_loopIterations * 1000.0f / elapsedMs);
+        m_loopIterations = 0;
+        m_loopStatsStartMs = millis();
+    }
 }
 
 void WaterManager::updateTimeFromRTC()
@@ -110,9 +205,41 @@ void WaterManager::printTimeFromRTC() const
         m_rtc->minute, m_rtc->second, m_rtc->dayOfMonth, m_rtc->month, m_rtc->year+2000);
 }
 
+void WaterManager::reconcileStationStates()
+{
+    // Events that should still be running switch their stations on again and re-arm their off
+    // transitions. Nothing would close any other valve left open before the reset.
+    m_cronManager->resumeRunningEvents();
+    std::bitset<256> covered;
+    for (const auto& running : m_cronManager->getRunningEvents())
+    {
+        for (auto station_id : running.second.stations_ids)
+        {
+            covered[station_id] = true;
+        }
+    }
+
+    bool changed = false;
+    for (const auto& station : m_storage->getStations())
+    {
+        if (!covered[station.id] && setStationState(*m_storage->getStation(station.id), false))
+        {
+            log_i("Station %d was left on without a running event, switching it off", station.id);
+            m_history->logTransition(station.id, HISTORY_NO_EVENT, HISTORY_SOURCE_MANUAL, false, 0);
+            changed = true;
+        }
+    }
+    if (changed)
+    {
+        m_history->sync();
+        m_bluetooth->notifyStationStates();
+    }
+}
+
 void WaterManager::onMessageReceived(MessageType messageType, void* message)
 {    
     log_i("onMessageReceived with message type %d\n", messageType);
+    std::unique_lock<std::mutex> lock(m_mutex);
     switch (messageType)
     {
     case SET_TIME:
@@ -121,13 +248,32 @@ void WaterManager::onMessageReceived(MessageType messageType, void* message)
     case SET_STATION_STATE:
         setStationStateMessage(*reinterpret_cast<SetStationStateMessage*>(message));
         break;
+    case SET_CONFIG:
+        setConfigMessage(*reinterpret_cast<SetConfigMessage*>(message));
+        break;
+    case REQUEST_NOTIFY:
+        // A requested notify carries every station, it resyncs the central that lost track
+        m_bluetooth->resyncStationStates(*reinterpret_cast<uint16_t*>(message));
+        break;
+    case SET_PROTOCOL:
+        // Encodes the read values in the selected protocol
+        m_bluetooth->setStations();
+        m_bluetooth->setEvents();
+        break;
     default:
         break;
     }
+
+    lock.unlock();
+
+    // Messages may change what is due next, let the main loop re-evaluate its deadline
+    wakeLoop();
 }
 
 void WaterManager::onEventStateChange(const Event& event, bool newState)
 {
+    // Switch every valve first, recording the history can wait
+    std::bitset<256> changed;
     for (auto& station_id : event.stations_ids)
     {
         Station* station = m_storage->getStation(station_id);
@@ -136,18 +282,48 @@ void WaterManager::onEventStateChange(const Event& event, bool newState)
             log_w("Couldn't find station with ID %d, skipping", station_id);
             continue;
         }
-        setStationState(*station, newState);
+        if (setStationState(*station, newState))
+        {
+            changed[station_id] = true;
+        }
+    }
+    for (auto& station_id : event.stations_ids)
+    {
+        if (changed[station_id])
+        {
+            m_history->logTransition(station_id, event.id, HISTORY_SOURCE_EVENT, newState, event.duration);
+            changed[station_id] = false;
+        }
     }
+    m_history->sync();
     
     m_bluetooth->notifyStationStates();
 }
 
-void WaterManager::setStationState(Station& station, bool newState)
+void WaterManager::getLatenessHistogram(LatenessHistogram& histogram)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    histogram = m_cronManager->getLatenessHistogram();
+}
+
+bool WaterManager::getHistory(uint32_t from, uint32_t to, std::vector<HistoryRecord>& records, size_t maxRecords)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_history->query(from, to, records, maxRecords);
+}
+
+bool WaterManager::setStationState(Station& station, bool newState)
 {
     auto newStateValue = newState ? HIGH : LOW;
     log_d("Setting station id %d to new state %s", station.id, (newState ? "ON" : "OFF"));
     digitalWrite(station.gpio_pin, newStateValue);
-    station.is_on = newState;
+    if (station.is_on != newState)
+    {
+        station.is_on = newState;
+        m_storage->markStationDirty(station.id);
+        return true;
+    }
+    return false;
 }
 
 void WaterManager::setTimeMessage(const SetTimeMessage& timeMessage) const
@@ -167,6 +343,10 @@ void WaterManager::setTimeMessage(const SetTimeMessage& timeMessage) const
     setenv("TZ", timeMessage.tz.c_str(), 1);
     tzset();
 
+    // Armed transitions are absolute wall clock deadlines, recompute them against the new clock
+    int64_t deltaMs = ((int64_t)newTime.tv_sec - now.tv_sec) * 1000 + ((int64_t)newTime.tv_usec - now.tv_usec) / 1000;
+    m_cronManager->onTimeChanged(deltaMs);
+
     gettimeofday(&now, NULL);
     time = localtime(&now.tv_sec);
     log_i("new time is set to %02d:%02d:%02d.%03ld", time->tm_hour,
@@ -190,6 +370,66 @@ void WaterManager::setStationStateMessage(const SetStationStateMessage& stationS
         log_w("Couldn't find station with ID %d, skipping", stationStateMessage.station_id);
         return;
     }
-    setStationState(*station, stationStateMessage.is_on);
+    if (setStationState(*station, stationStateMessage.is_on))
+    {
+        m_history->logTransition(station->id, HISTORY_NO_EVENT, HISTORY_SOURCE_MANUAL, station->is_on, 0);
+        m_history->sync();
+    }
+    m_bluetooth->notifyStationStates();
+}
+
+void WaterManager::setConfigMessage(const SetConfigMessage& configMessage)
+{
+    const StationTable& current = m_storage->getStations();
+    StationTable stations = to_table(configMessage.stations);
+
+    // Stations keep running across the import unless they're dropped or moved to another pin,
+    // those valves are closed once the new configuration is committed
+    std::vector<uint8_t> releasedPins;
+    for (const auto& station : current)
+    {
+        const Station* updated = stations.find(station.id);
+        if (updated == nullptr || updated->gpio_pin != station.gpio_pin)
+        {
+            releasedPins.push_back(station.gpio_pin);
+        }
+    }
+
+    m_storage->beginTransaction();
+    m_storage->stageClear();
+    for (auto& station : stations)
+    {
+        const Station* existing = current.find(station.id);
+        station.is_on = existing != nullptr && existing->gpio_pin == station.gpio_pin && existing->is_on;
+        m_storage->stageStation(station);
+    }
+    for (const auto& event : configMessage.events)
+    {
+        m_storage->stageEvent(event);
+    }
+    StorageDiff diff;
+    if (!m_storage->commitTransaction(diff))
+    {
+        log_e("Failed committing the configuration, applying what was stored");
+    }
+
+    if (!diff.stationsEmpty())
+    {
+        for (auto pin : releasedPins)
+        {
+            digitalWrite(pin, LOW);
+        }
+        for (const auto& station : m_storage->getStations())
+        {
+            pinMode(station.gpio_pin, OUTPUT);
+            digitalWrite(station.gpio_pin, station.is_on ? HIGH : LOW);
+        }
+        m_bluetooth->setStations();
+    }
+    if (!diff.eventsEmpty())
+    {
+        m_cronManager->applyDiff(diff);
+        m_bluetooth->setEvents();
+    }
     m_bluetooth->notifyStationStates();
 }
@@ -9,8 +9,11 @@
 
     class Bluetooth;
     class Storage;
+    class StorageBackend;
+    class MappedRegion;
     class DS1307;
     class CronManager;
+    class HistoryLog;
     class TFT_eSPI;
 
     class WaterManager : public BlablaCallbacks
@@ -24,21 +27,36 @@
         // Callbacks
         void onMessageReceived(MessageType messageType, void* message) override;
         void onEventStateChange(const Event& event, bool newState) override;
+        void getLatenessHistogram(LatenessHistogram& histogram) override;
+        bool getHistory(uint32_t from, uint32_t to, std::vector<HistoryRecord>& records, size_t maxRecords) override;
     private:
 
-        void setStationState(Station& station, bool newState);
+        // Returns whether the state changed
+        bool setStationState(Station& station, bool newState);
+        // Boot time: resumes the running events and switches off the stations none of them covers
+        void reconcileStationStates();
+
+        void wakeLoop();
+        void countLoopIteration();
 
         void updateTimeFromRTC();
         void printTimeFromRTC() const;
 
         void setTimeMessage(const SetTimeMessage& timeMessage) const;
         void setStationStateMessage(const SetStationStateMessage& stationStateMessage);
+        void setConfigMessage(const SetConfigMessage& configMessage);
 
         std::mutex m_mutex;
         void* m_backgroundTaskHandle;
+        void* m_loopTaskHandle;
+        uint32_t m_loopIterations;
+        unsigned long m_loopStatsStartMs;
         Bluetooth* m_bluetooth;
+        StorageBackend* m_storageBackend;
+        MappedRegion* m_configRegion;
         Storage* m_storage;
         DS1307* m_rtc;
         CronManager* m_cronManager;
+        HistoryLog* m_history;
         TFT_eSPI* m_lcd;
     };
@@ -0,0 +1,513 @@
+#include <limits>
+
+#include "WireFormat.h"
+
+// Out of range numbers saturate, like in the JSON parser
+template <class T>
+static T clampTo(uint64_t value)
+{
+    return value > (uint64_t)std::numeric_limits<T>::max() ? std::numeric_limits<T>::max() : (T)value;
+}
+
+template <class T>
+static T clampTo(int64_t value)
+{
+    if (value < (int64_t)std::numeric_limits<T>::min())
+    {
+        return std::numeric_limits<T>::min();
+    }
+    return value > (int64_t)std::numeric_limits<T>::max() ? std::numeric_limits<T>::max() : (T)value;
+}
+
+template <class T>
+static void setLe(std::vector<uint8_t>& out, size_t offset, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        out[offset + i] = (uint8_t)((uint64_t)value >> (8 * i));
+    }
+}
+
+static void putHeader(std::vector<uint8_t>& out, uint8_t tag, size_t size)
+{
+    out.push_back(tag);
+    out.push_back(size & 0xFF);
+    out.push_back(size >> 8);
+}
+
+bool wireIsFrame(const uint8_t* data, size_t size)
+{
+    return size > 0 && data[0] == WIRE_MAGIC;
+}
+
+size_t wireFrameSize(const uint8_t* data, size_t size)
+{
+    if (size < WIRE_FRAME_HEADER_SIZE)
+    {
+        return 0;
+    }
+    return WIRE_FRAME_HEADER_SIZE + (data[2] | (data[3] << 8));
+}
+
+bool wireDecodeFrame(RecordReader& reader, uint8_t& type, RecordReader& payload)
+{
+    uint8_t magic;
+    uint16_t size;
+    return reader.readLe(magic) && magic == WIRE_MAGIC &&
+        reader.readLe(type) &&
+        reader.readLe(size) &&
+        reader.readSubReader(payload, size);
+}
+
+void wireBeginFrame(std::vector<uint8_t>& out, uint8_t type)
+{
+    out.clear();
+    out.push_back(WIRE_MAGIC);
+    out.push_back(type);
+    out.push_back(0);
+    out.push_back(0);
+}
+
+bool wireFinishFrame(std::vector<uint8_t>& out)
+{
+    size_t size = out.size() - WIRE_FRAME_HEADER_SIZE;
+    if (size > UINT16_MAX)
+    {
+        return false;
+    }
+    setLe<uint16_t>(out, 2, size);
+    return true;
+}
+
+bool wireNextField(RecordReader& payload, uint8_t& tag, RecordReader& value)
+{
+    uint16_t size;
+    return payload.readLe(tag) &&
+        payload.readLe(size) &&
+        payload.readSubReader(value, size);
+}
+
+bool wireReadUint(RecordReader value, uint64_t& result)
+{
+    size_t size = value.remaining();
+    if (size == 0 || size > sizeof(result))
+    {
+        return false;
+    }
+    result = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        uint8_t byte = 0;
+        value.readLe(byte);
+        result |= (uint64_t)byte << (8 * i);
+    }
+    return true;
+}
+
+bool wireReadInt(RecordReader value, int64_t& result)
+{
+    size_t size = value.remaining();
+    uint64_t bits;
+    if (!wireReadUint(value, bits))
+    {
+        return false;
+    }
+    // Sign extend from the field width
+    if (size < sizeof(bits) && (bits >> (8 * size - 1)) & 1)
+    {
+        bits |= ~(uint64_t)0 << (8 * size);
+    }
+    result = (int64_t)bits;
+    return true;
+}
+
+std::string_view wireReadString(RecordReader value)
+{
+    return std::string_view(reinterpret_cast<const char*>(value.data() + value.offset()), value.remaining());
+}
+
+void wirePutUint(std::vector<uint8_t>& out, uint8_t tag, uint64_t value, size_t width)
+{
+    putHeader(out, tag, width);
+    for (size_t i = 0; i < width; i++)
+    {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+void wirePutBytes(std::vector<uint8_t>& out, uint8_t tag, const void* data, size_t size)
+{
+    // Longer values can't be represented by the u16 size fields
+    if (size > UINT16_MAX)
+    {
+        size = UINT16_MAX;
+    }
+    putHeader(out, tag, size);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+size_t wireBeginField(std::vector<uint8_t>& out, uint8_t tag)
+{
+    size_t start = out.size();
+    putHeader(out, tag, 0);
+    return start;
+}
+
+void wireEndField(std::vector<uint8_t>& out, size_t start)
+{
+    size_t size = out.size() - start - 3;
+    setLe<uint16_t>(out, start + 1, size > UINT16_MAX ? UINT16_MAX : size);
+}
+
+void wireEncodeStation(std::vector<uint8_t>& out, const Station& station, std::string_view name)
+{
+    size_t start = wireBeginField(out, WIRE_STATION);
+    wirePutUint(out, WIRE_STATION_ID, station.id, 1);
+    wirePutUint(out, WIRE_STATION_GPIO_PIN, station.gpio_pin, 1);
+    wirePutBytes(out, WIRE_STATION_NAME, name.data(), name.size());
+    wirePutUint(out, WIRE_STATION_IS_ON, station.is_on ? 1 : 0, 1);
+    wireEndField(out, start);
+}
+
+void wireEncodeEvent(std::vector<uint8_t>& out, const Event& event, std::string_view name, std::string_view cronExpr)
+{
+    size_t start = wireBeginField(out, WIRE_EVENT);
+    wirePutUint(out, WIRE_EVENT_ID, event.id, 1);
+    wirePutBytes(out, WIRE_EVENT_STATION_IDS, event.stations_ids.data(), event.stations_ids.size());
+    wirePutBytes(out, WIRE_EVENT_NAME, name.data(), name.size());
+    wirePutBytes(out, WIRE_EVENT_CRON_EXPR, cronExpr.data(), cronExpr.size());
+    wirePutUint(out, WIRE_EVENT_DURATION, (uint32_t)event.duration, 4);
+    wireEndField(out, start);
+}
+
+bool wireDecodeStation(RecordReader value, Station& station)
+{
+    // Like the JSON parser, a station needs an id, a pin and a name and starts switched off
+    bool hasId = false, hasPin = false, hasName = false;
+    uint8_t tag;
+    RecordReader field;
+    uint64_t number;
+    station = Station(0, 0, "", false);
+    while (!value.atEnd())
+    {
+        if (!wireNextField(value, tag, field))
+        {
+            return false;
+        }
+        switch (tag)
+        {
+            case WIRE_STATION_ID:
+                if (!wireReadUint(field, number) || number >= StationTable::MAX_IDS)
+                {
+                    return false;
+                }
+                station.id = number;
+                hasId = true;
+            break;
+            case WIRE_STATION_GPIO_PIN:
+                if (!wireReadUint(field, number) || number > Station::MAX_GPIO_PIN)
+                {
+                    return false;
+                }
+                station.gpio_pin = number;
+                hasPin = true;
+            break;
+            case WIRE_STATION_NAME:
+                station.name = wireReadString(field);
+                hasName = true;
+            break;
+
+            default:
+            break;
+        }
+    }
+    return hasId && hasPin && hasName;
+}
+
+bool wireDecodeEvent(RecordReader value, Event& event)
+{
+    bool hasId = false, hasStations = false, hasName = false, hasCron = false, hasDuration = false;
+    uint8_t tag;
+    RecordReader field;
+    uint64_t number;
+    int64_t duration;
+    event = Event(0, {}, "", "", 0);
+    while (!value.atEnd())
+    {
+        if (!wireNextField(value, tag, field))
+        {
+            return false;
+        }
+        switch (tag)
+        {
+            case WIRE_EVENT_ID:
+                if (!wireReadUint(field, number) || number >= EventTable::MAX_IDS)
+                {
+                    return false;
+                }
+                event.id = number;
+                hasId = true;
+            break;
+            case WIRE_EVENT_STATION_IDS:
+                // One byte per station id, so every id is in range
+                event.stations_ids.assign(field.data() + field.offset(), field.data() + field.offset() + field.remaining());
+                hasStations = true;
+            break;
+            case WIRE_EVENT_NAME:
+                event.name = wireReadString(field);
+                hasName = true;
+            break;
+            case WIRE_EVENT_CRON_EXPR:
+                event.cron_expr = wireReadString(field);
+                hasCron = true;
+            break;
+            case WIRE_EVENT_DURATION:
+                // Long durations saturate, negative ones are meaningless
+                if (!wireReadInt(field, duration) || duration < 0)
+                {
+                    return false;
+                }
+                event.duration = clampTo<int>(duration);
+                hasDuration = true;
+            break;
+
+            default:
+            break;
+        }
+    }
+    return hasId && hasStations && hasName && hasCron && hasDuration;
+}
+
+bool wireDecodeSetTime(RecordReader payload, SetTimeMessage& message)
+{
+    uint8_t tag;
+    RecordReader field;
+    int64_t number;
+    message.timeval.tv_sec = 0;
+    message.timeval.tv_usec = 0;
+    message.tz.clear();
+    while (!payload.atEnd())
+    {
+        if (!wireNextField(payload, tag, field))
+        {
+            return false;
+        }
+        switch (tag)
+        {
+            case WIRE_TIME_SEC:
+                if (!wireReadInt(field, number))
+                {
+                    return false;
+                }
+                message.timeval.tv_sec = clampTo<int>(number);
+            break;
+            case WIRE_TIME_USEC:
+                if (!wireReadInt(field, number))
+                {
+                    return false;
+                }
+                message.timeval.tv_usec = clampTo<int>(number);
+            break;
+            case WIRE_TIME_TZ:
+                message.tz = wireReadString(field);
+            break;
+
+            default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool wireDecodeSetStationState(RecordReader payload, SetStationStateMessage& message)
+{
+    uint8_t tag;
+    RecordReader field;
+    uint64_t number;
+    message.station_id = -1;
+    message.is_on = false;
+    while (!payload.atEnd())
+    {
+        if (!wireNextField(payload, tag, field))
+        {
+            return false;
+        }
+        switch (tag)
+        {
+            case WIRE_STATE_STATION_ID:
+                if (!wireReadUint(field, number))
+                {
+                    return false;
+                }
+                message.station_id = number < StationTable::MAX_IDS ? (int)number : -1;
+            break;
+            case WIRE_STATE_IS_ON:
+                if (!wireReadUint(field, number))
+                {
+                    return false;
+                }
+                message.is_on = number != 0;
+            break;
+
+            default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool wireDecodeSetConfig(RecordReader payload, SetConfigMessage& message)
+{
+    // Nothing is applied unless every record is valid
+    uint8_t tag;
+    RecordReader field;
+    message.stations.clear();
+    message.events.clear();
+    while (!payload.atEnd())
+    {
+        if (!wireNextField(payload, tag, field))
+        {
+            return false;
+        }
+        switch (tag)
+        {
+            case WIRE_STATION:
+                message.stations.emplace_back();
+                if (!wireDecodeStation(field, message.stations.back()))
+                {
+                    return false;
+                }
+            break;
+            case WIRE_EVENT:
+                message.events.emplace_back();
+                if (!wireDecodeEvent(field, message.events.back()))
+                {
+                    return false;
+                }
+            break;
+
+            default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool wireDecodeRequestNotify(RecordReader payload, int& mode)
+{
+    uint8_t tag;
+    RecordReader field;
+    uint64_t number;
+    mode = -1;
+    while (!payload.atEnd())
+    {
+        if (!wireNextField(payload, tag, field))
+        {
+            return false;
+        }
+        if (tag == WIRE_NOTIFY_MODE)
+        {
+            if (!wireReadUint(field, number))
+            {
+                return false;
+            }
+            mode = number != 0 ? 1 : 0;
+        }
+    }
+    return true;
+}
+
+bool wireDecodeGetHistory(RecordReader payload, uint32_t& from, uint32_t& to)
+{
+    uint8_t tag;
+    RecordReader field;
+    uint64_t number;
+    from = 0;
+    to = UINT32_MAX;
+    while (!payload.atEnd())
+    {
+        if (!wireNextField(payload, tag, field))
+        {
+            return false;
+        }
+        if (tag == WIRE_HISTORY_FROM || tag == WIRE_HISTORY_TO)
+        {
+            if (!wireReadUint(field, number))
+            {
+                return false;
+            }
+            (tag == WIRE_HISTORY_FROM ? from : to) = clampTo<uint32_t>(number);
+        }
+    }
+    return true;
+}
+
+bool wireDecodeSetProtocol(RecordReader payload, bool& binary)
+{
+    uint8_t tag;
+    RecordReader field;
+    uint64_t number;
+    bool found = false;
+    while (!payload.atEnd())
+    {
+        if (!wireNextField(payload, tag, field))
+        {
+            return false;
+        }
+        if (tag == WIRE_PROTOCOL)
+        {
+            if (!wireReadUint(field, number))
+            {
+                return false;
+            }
+            binary = number != 0;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool wireEncodeStateFrame(std::vector<uint8_t>& frame, uint16_t sequence, bool full,
+    const StationBits& present, const StationBits& states, const StationBits& notified)
+{
+    StationBits mask = full ? present : (states ^ notified);
+    if (mask.none() && !full)
+    {
+        return false;
+    }
+
+    // Only the bytes between the first and last masked station are sent
+    size_t first = 0, last = 0;
+    bool any = false;
+    for (size_t id = 0; id < mask.size(); id++)
+    {
+        if (mask[id])
+        {
+            first = any ? first : id;
+            last = id;
+            any = true;
+        }
+    }
+    size_t base = first / 8 * 8;
+    size_t length = any ? last / 8 - first / 8 + 1 : 0;
+
+    frame.clear();
+    frame.push_back(full ? WIRE_STATE_FRAME_FULL : WIRE_STATE_FRAME_DELTA);
+    frame.push_back(sequence & 0xFF);
+    frame.push_back(sequence >> 8);
+    frame.push_back(base);
+    frame.push_back(length);
+    frame.resize(frame.size() + 2 * length, 0);
+    uint8_t* maskBytes = frame.data() + 5;
+    uint8_t* stateBytes = maskBytes + length;
+    for (size_t i = 0; i < length * 8; i++)
+    {
+        if (mask[base + i])
+        {
+            maskBytes[i / 8] |= 1 << (i % 8);
+            stateBytes[i / 8] |= (states[base + i] ? 1 : 0) << (i % 8);
+        }
+    }
+    return true;
+}
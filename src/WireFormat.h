@@ -0,0 +1,113 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "data.h"
+#include "RecordReader.h"
+
+// Binary BLE message format, negotiated per connection with SET_PROTOCOL as an alternative
+// to the JSON messages. All integers are little-endian.
+//
+// Frame: magic 0xB1 u8 | type u8 (MessageType) | payload size u16 | payload
+// Payload: fields of tag u8 | size u16 | value. Fields may come in any order, unknown tags
+// are skipped. Integer values are as wide as their size (1 to 8 bytes), strings aren't
+// terminated, records are nested fields.
+//
+// SET_TIME: WIRE_TIME_* | SET_STATION_STATE: WIRE_STATE_* | REQUEST_NOTIFY: WIRE_NOTIFY_MODE
+// GET_HISTORY: WIRE_HISTORY_* | SET_PROTOCOL: WIRE_PROTOCOL
+// SET_CONFIG writes, GET_STATIONS and GET_EVENTS reads: WIRE_STATION and WIRE_EVENT records
+//
+// Nothing here depends on the ESP-IDF so host tools can produce and check frames.
+
+#define WIRE_MAGIC 0xB1
+#define WIRE_FRAME_HEADER_SIZE 4
+
+enum WireTag : uint8_t
+{
+    WIRE_TIME_SEC = 1,
+    WIRE_TIME_USEC = 2,
+    WIRE_TIME_TZ = 3,
+
+    WIRE_STATE_STATION_ID = 1,
+    WIRE_STATE_IS_ON = 2,
+
+    // 0 = JSON, 1 = delta frames
+    WIRE_NOTIFY_MODE = 1,
+
+    WIRE_HISTORY_FROM = 1,
+    WIRE_HISTORY_TO = 2,
+
+    // 0 = JSON, 1 = binary
+    WIRE_PROTOCOL = 1,
+
+    WIRE_STATION = 1,
+    WIRE_EVENT = 2,
+
+    WIRE_STATION_ID = 1,
+    WIRE_STATION_GPIO_PIN = 2,
+    WIRE_STATION_NAME = 3,
+    WIRE_STATION_IS_ON = 4,
+
+    WIRE_EVENT_ID = 1,
+    WIRE_EVENT_STATION_IDS = 2,
+    WIRE_EVENT_NAME = 3,
+    WIRE_EVENT_CRON_EXPR = 4,
+    WIRE_EVENT_DURATION = 5,
+};
+
+// Frames
+bool wireIsFrame(const uint8_t* data, size_t size);
+// Size of the frame at the start of the buffer, 0 while its header is incomplete
+size_t wireFrameSize(const uint8_t* data, size_t size);
+bool wireDecodeFrame(RecordReader& reader, uint8_t& type, RecordReader& payload);
+// Starts a frame in 'out' (which is cleared), wireFinishFrame fills in the payload size
+// and returns false if the payload is too large for it
+void wireBeginFrame(std::vector<uint8_t>& out, uint8_t type);
+bool wireFinishFrame(std::vector<uint8_t>& out);
+
+// Fields
+bool wireNextField(RecordReader& payload, uint8_t& tag, RecordReader& value);
+bool wireReadUint(RecordReader value, uint64_t& result);
+bool wireReadInt(RecordReader value, int64_t& result);
+std::string_view wireReadString(RecordReader value);
+void wirePutUint(std::vector<uint8_t>& out, uint8_t tag, uint64_t value, size_t width);
+void wirePutBytes(std::vector<uint8_t>& out, uint8_t tag, const void* data, size_t size);
+// A nested field is started with wireBeginField and ended with wireEndField
+size_t wireBeginField(std::vector<uint8_t>& out, uint8_t tag);
+void wireEndField(std::vector<uint8_t>& out, size_t start);
+
+// Records, the strings are passed separately since they may live outside the record
+void wireEncodeStation(std::vector<uint8_t>& out, const Station& station, std::string_view name);
+void wireEncodeEvent(std::vector<uint8_t>& out, const Event& event, std::string_view name, std::string_view cronExpr);
+bool wireDecodeStation(RecordReader value, Station& station);
+bool wireDecodeEvent(RecordReader value, Event& event);
+
+// Station state frames notified in delta mode, sent as is rather than in a message frame.
+// Multi-byte fields are little-endian:
+//   type u8 | sequence u16 | base id u8 | length u8 | mask[length] | states[length]
+// Bit i of byte j stands for station base + 8 * j + i. A delta frame masks the stations
+// whose state changed since the previous frame, a full frame masks every station. The
+// sequence increments per frame, a central that sees a gap asks for a full frame.
+#define WIRE_STATE_FRAME_DELTA 1
+#define WIRE_STATE_FRAME_FULL 2
+
+typedef std::bitset<StationTable::MAX_IDS> StationBits;
+
+// A full frame of the present stations, or a delta frame of the stations whose state differs
+// from 'notified' (the states of the connection's previous frame). Removed stations that were
+// on show up as switched off. Returns false when a delta frame would be empty.
+bool wireEncodeStateFrame(std::vector<uint8_t>& frame, uint16_t sequence, bool full,
+    const StationBits& present, const StationBits& states, const StationBits& notified);
+
+// Messages, missing fields keep the defaults the JSON parsers use
+bool wireDecodeSetTime(RecordReader payload, SetTimeMessage& message);
+bool wireDecodeSetStationState(RecordReader payload, SetStationStateMessage& message);
+bool wireDecodeSetConfig(RecordReader payload, SetConfigMessage& message);
+// 'mode' is -1 when the frame doesn't select one
+bool wireDecodeRequestNotify(RecordReader payload, int& mode);
+bool wireDecodeGetHistory(RecordReader payload, uint32_t& from, uint32_t& to);
+bool wireDecodeSetProtocol(RecordReader payload, bool& binary);
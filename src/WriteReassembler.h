@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string.h>
+#include <memory>
+
+#include "WireFormat.h"
+
+#include "esp32-hal-log.h"
+
+#define MSG_START_CHAR '$'
+#define MSG_END_CHAR '\n'
+
+// Joins the chunks written to a characteristic into whole messages. A JSON message may
+// start with MSG_START_CHAR, which drops whatever came before it, and ends with
+// MSG_END_CHAR. A binary frame (see WireFormat.h) ends once the size in its header has
+// arrived. An empty write drops the message in progress.
+//
+// Bytes are copied once, from the chunk into a buffer of fixed capacity allocated on first
+// use. Messages are always consumed whole, so the buffer restarts at its beginning for every
+// message and each one is handed on as a contiguous view. A message longer than the
+// capacity is dropped without buffering the rest of it.
+class WriteReassembler
+{
+public:
+    enum Kind
+    {
+        JSON,
+        BINARY,
+    };
+
+    explicit WriteReassembler(size_t capacity) :
+        m_capacity(capacity), m_size(0), m_state(IDLE), m_skip(0)
+    {}
+
+    // Calls onMessage(kind, data, size) for every message completed by the chunk. The data
+    // may be modified in place, it is only valid during the call.
+    template <class Callback>
+    void feed(const uint8_t* chunk, size_t size, Callback&& onMessage)
+    {
+        if (size == 0)
+        {
+            reset();
+            return;
+        }
+        // MSG_START_CHAR can't start a chunk in the middle of a binary frame, it is data there
+        if (chunk[0] == MSG_START_CHAR && m_state != BINARY_FRAME && m_state != SKIP_BINARY)
+        {
+            reset();
+            m_state = JSON_MESSAGE;
+            chunk++;
+            size--;
+        }
+        while (size > 0)
+        {
+            if (m_state == IDLE)
+            {
+                m_state = chunk[0] == WIRE_MAGIC ? BINARY_FRAME : JSON_MESSAGE;
+            }
+            size_t used = m_state == JSON_MESSAGE || m_state == SKIP_JSON ?
+                feedJson(chunk, size, onMessage) : feedBinary(chunk, size, onMessage);
+            chunk += used;
+            size -= used;
+        }
+    }
+
+    void reset()
+    {
+        m_size = 0;
+        m_state = IDLE;
+        m_skip = 0;
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    enum State
+    {
+        IDLE,
+        JSON_MESSAGE,
+        BINARY_FRAME,
+        // Dropping the rest of a message that didn't fit
+        SKIP_JSON,
+        SKIP_BINARY,
+    };
+
+    template <class Callback>
+    size_t feedJson(const uint8_t* chunk, size_t size, Callback&& onMessage)
+    {
+        const uint8_t* end = (const uint8_t*)memchr(chunk, MSG_END_CHAR, size);
+        size_t used = end != nullptr ? end - chunk + 1 : size;
+        if (m_state == JSON_MESSAGE && !append(chunk, used))
+        {
+            log_e("Message is longer than %d bytes, dropping it", m_capacity);
+            m_state = SKIP_JSON;
+        }
+        if (end != nullptr)
+        {
+            if (m_state == JSON_MESSAGE)
+            {
+                onMessage(JSON, m_data.get(), m_size);
+            }
+            reset();
+        }
+        return used;
+    }
+
+    template <class Callback>
+    size_t feedBinary(const uint8_t* chunk, size_t size, Callback&& onMessage)
+    {
+        if (m_state == SKIP_BINARY)
+        {
+            size_t used = size < m_skip ? size : m_skip;
+            m_skip -= used;
+            if (m_skip == 0)
+            {
+                reset();
+            }
+            return used;
+        }
+        // The header first, then exactly the rest of the frame
+        size_t frameSize = m_size < WIRE_FRAME_HEADER_SIZE ? WIRE_FRAME_HEADER_SIZE :
+            wireFrameSize(m_data.get(), m_size);
+        size_t used = frameSize - m_size < size ? frameSize - m_size : size;
+        append(chunk, used);
+        if (m_size == WIRE_FRAME_HEADER_SIZE)
+        {
+            frameSize = wireFrameSize(m_data.get(), m_size);
+            if (frameSize > m_capacity)
+            {
+                log_e("Frame is longer than %d bytes, dropping it", m_capacity);
+                m_state = SKIP_BINARY;
+                m_skip = frameSize - m_size;
+                m_size = 0;
+                return used;
+            }
+        }
+        if (m_size == frameSize)
+        {
+            onMessage(BINARY, m_data.get(), m_size);
+            reset();
+        }
+        return used;
+    }
+
+    bool append(const uint8_t* data, size_t size)
+    {
+        if (m_capacity - m_size < size)
+        {
+            return false;
+        }
+        if (!m_data)
+        {
+            m_data.reset(new uint8_t[m_capacity]);
+        }
+        memcpy(m_data.get() + m_size, data, size);
+        m_size += size;
+        return true;
+    }
+
+    std::unique_ptr<uint8_t[]> m_data;
+    size_t m_capacity;
+    size_t m_size;
+    State m_state;
+    size_t m_skip;
+};
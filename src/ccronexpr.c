@@ -238,14 +238,62 @@ static char* strdupl(const char* str, size_t len) {
     return res;
 }
 
-static unsigned int next_set_bit(uint8_t* bits, unsigned int max, unsigned int from_index, int* notfound) {
+/**
+ * Bit scanning helpers.
+ * The bitfields are scanned a 32 bit word at a time, bit 'idx' of a field
+ * lives in byte 'idx / 8' at position 'idx % 8' (see cron_get_bit).
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define cron_ctz32(x) ((unsigned int) __builtin_ctz(x))
+#define cron_clz32(x) ((unsigned int) __builtin_clz(x))
+#else /* __GNUC__ */
+static unsigned int cron_ctz32(uint32_t x) {
+    unsigned int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static unsigned int cron_clz32(uint32_t x) {
+    unsigned int n = 0;
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+#endif /* __GNUC__ */
+
+/* loads the 32 bits starting at bit 'base' (a multiple of 32), never touching bytes past 'nbytes' */
+static uint32_t load_bits_word(uint8_t* bits, unsigned int base, unsigned int nbytes) {
+    uint32_t word = 0;
+    unsigned int first = base / 8;
     unsigned int i;
+    for (i = 0; i < 4 && first + i < nbytes; i++) {
+        word |= ((uint32_t) bits[first + i]) << (8 * i);
+    }
+    return word;
+}
+
+static unsigned int next_set_bit(uint8_t* bits, unsigned int max, unsigned int from_index, int* notfound) {
+    unsigned int nbytes = (max + 7) / 8;
+    unsigned int base = from_index & ~31u;
     if (!bits) {
         *notfound = 1;
         return 0;
     }
-    for (i = from_index; i < max; i++) {
-        if (cron_get_bit(bits, i)) return i;
+    for (; base < max; base += 32) {
+        uint32_t word = load_bits_word(bits, base, nbytes);
+        if (from_index > base) {
+            word &= ~0u << (from_index - base);
+        }
+        if (word) {
+            unsigned int i = base + cron_ctz32(word);
+            if (i < max) return i;
+            break;
+        }
     }
     *notfound = 1;
     return 0;
@@ -1002,17 +1050,52 @@ time_t cron_next(cron_expr* expr, time_t date) {
     return cron_mktime(calendar);
 }
 
+int cron_next_n(cron_expr* expr, time_t date, time_t* out, int n) {
+    int count = 0;
+    if (!expr || !out || n <= 0) return 0;
+    struct tm calval;
+    memset(&calval, 0, sizeof(struct tm));
+    struct tm* calendar = cron_time(&date, &calval);
+    if (!calendar) return 0;
+    time_t previous = cron_mktime(calendar);
+    if (CRON_INVALID_INSTANT == previous) return 0;
+
+    int res = do_next(expr, calendar, calendar->tm_year);
+    while (0 == res) {
+        time_t calculated = cron_mktime(calendar);
+        if (CRON_INVALID_INSTANT == calculated) break;
+        if (calculated != previous) {
+            out[count++] = calculated;
+            if (count == n) break;
+            previous = calculated;
+        }
+        /* continue from the next whole second after the last match, reusing the calendar */
+        res = add_to_field(calendar, CRON_CF_SECOND, 1);
+        if (0 != res) break;
+        res = do_next(expr, calendar, calendar->tm_year);
+    }
+    return count;
+}
+
 
 /* https://github.com/staticlibs/ccronexpr/pull/8 */
 
 static unsigned int prev_set_bit(uint8_t* bits, int from_index, int to_index, int* notfound) {
-    int i;
-    if (!bits) {
+    int base;
+    if (!bits || from_index < 0 || from_index < to_index) {
         *notfound = 1;
         return 0;
     }
-    for (i = from_index; i >= to_index; i--) {
-        if (cron_get_bit(bits, i)) return i;
+    for (base = from_index & ~31; base >= 0 && base + 31 >= to_index; base -= 32) {
+        uint32_t word = load_bits_word(bits, (unsigned int) base, (unsigned int) from_index / 8 + 1);
+        if (from_index - base < 31) {
+            word &= (2u << (from_index - base)) - 1;
+        }
+        if (word) {
+            int i = base + 31 - (int) cron_clz32(word);
+            if (i >= to_index) return (unsigned int) i;
+            break;
+        }
     }
     *notfound = 1;
     return 0;
@@ -73,6 +73,21 @@ void cron_parse_expr(const char* expression, cron_expr* target, const char** err
  */
 time_t cron_next(cron_expr* expr, time_t date);
 
+/**
+ * Calculates the next 'n' consecutive 'fire' dates after the specified date.
+ * Gives the same results as calling 'cron_next' 'n' times, each time with
+ * the previous result, but walks the calendar forward only once.
+ * The scheduler only ever needs the next date and doesn't call it, it's meant
+ * for previewing a schedule.
+ * 
+ * @param expr parsed cron expression to use in next date calculation
+ * @param date start date to start calculation from
+ * @param out array of at least 'n' elements receiving the 'fire' dates
+ * @param n number of 'fire' dates to calculate
+ * @return number of 'fire' dates written to 'out', less than 'n' in case of error.
+ */
+int cron_next_n(cron_expr* expr, time_t date, time_t* out, int n);
+
 /**
  * Uses the specified expression to calculate the previous 'fire' date after
  * the specified date. All dates are processed as UTC (GMT) dates 
@@ -10,6 +10,8 @@
 #include <map>
 #include <sys/time.h>
 
+#include "IdTable.h"
+
 enum MessageType
 {
     SET_TIME,
@@ -17,6 +19,9 @@ enum MessageType
     GET_EVENTS,
     SET_STATION_STATE,
     REQUEST_NOTIFY,
+    GET_HISTORY,
+    SET_CONFIG,
+    SET_PROTOCOL,
     MAX,
 };
 
@@ -34,6 +39,9 @@ struct SetStationStateMessage
 
 struct Station
 {
+    // GPIOs 34-39 of the ESP32 are inputs only
+    static const uint8_t MAX_GPIO_PIN = 33;
+
     Station() = default;
     ~Station() = default;
     Station(uint8_t id_, uint8_t gpio_pin_, const std::string& name_, bool is_on_) :
@@ -61,26 +69,32 @@ struct Event
     int32_t duration;
 };
 
+// Replaces all stations and events at once
+struct SetConfigMessage
+{
+    std::vector<Station> stations;
+    std::vector<Event> events;
+};
+
+typedef IdTable<Station> StationTable;
+typedef IdTable<Event> EventTable;
+
 template <class T>
-static std::map<uint32_t, T> to_map(const std::vector<T>& vec)
+static IdTable<T> to_table(std::vector<T> vec)
 {
-    std::map<uint32_t, T> m;
-    for (const auto& e : vec)
+    IdTable<T> table;
+    for (auto& e : vec)
     {
-        m[e.id] = e;
+        table.set(std::move(e));
     }
-    return m;
+    return table;
 }
 
+// The table's records in id order, without copying them
 template <class T>
-static std::vector<T> to_vector(const std::map<uint32_t, T>& map)
+static const std::vector<T>& to_vector(const IdTable<T>& table)
 {
-    std::vector<T> vec;
-    for (const auto& e : map)
-    {
-        vec.push_back(e.second);
-    }
-    return vec;
+    return table.values();
 }
 
 
@@ -10,10 +10,26 @@
 #include "WaterManager.h"
 #include "esp_log.h"
 
+// Compares the storage backends on boot, erases the db
+#ifdef STORAGE_BENCHMARK
+#include "StorageBenchmark.h"
+#include "FatStorageBackend.h"
+#include "NvsStorageBackend.h"
+#endif
+
 WaterManager* manager = nullptr;
 
 void setup() 
 {
+#ifdef STORAGE_BENCHMARK
+    {
+        FatStorageBackend fat("/spiflash", "spiffs");
+        logStorageBenchmark(fat, runStorageBenchmark(fat, 16, 16, 64));
+        NvsStorageBackend nvs("blabla");
+        logStorageBenchmark(nvs, runStorageBenchmark(nvs, 16, 16, 64));
+    }
+#endif
+
     log_i("Starting Water Manager");
     manager = new WaterManager();
     log_i("Water Manager is now running..");
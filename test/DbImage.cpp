@@ -0,0 +1,105 @@
+#include "DbImage.h"
+#include "JsonFormat.h"
+
+template <class T>
+static void produceSnapshot(const std::vector<T>& records, uint32_t sequence, std::vector<uint8_t>& image)
+{
+    IdTable<T> table;
+    for (const T& record : records)
+    {
+        table.set(record);
+    }
+    dbEncodeSnapshot(image, table, sequence);
+}
+
+bool dbImageProduce(const std::string& config, DbTable table, uint32_t sequence, std::vector<uint8_t>& image)
+{
+    // The decoder unescapes strings in place
+    std::vector<char> buffer(config.begin(), config.end());
+    SetConfigMessage message;
+    if (!jsonDecodeSetConfig(JsonReader(buffer.data(), buffer.size()), message))
+    {
+        return false;
+    }
+    if (table == DB_TABLE_STATIONS)
+    {
+        produceSnapshot(message.stations, sequence, image);
+    }
+    else
+    {
+        produceSnapshot(message.events, sequence, image);
+    }
+    return true;
+}
+
+static void reportRecord(std::string& report, const Station& station)
+{
+    report += "station " + std::to_string(station.id) + " pin " + std::to_string(station.gpio_pin) +
+        (station.is_on ? " on" : " off") + " \"" + station.name + "\"\n";
+}
+
+static void reportRecord(std::string& report, const Event& event)
+{
+    report += "event " + std::to_string(event.id) + " \"" + event.name + "\" \"" + event.cron_expr + "\" " +
+        std::to_string(event.duration) + "s stations";
+    for (uint8_t id : event.stations_ids)
+    {
+        report += " " + std::to_string(id);
+    }
+    report += "\n";
+}
+
+template <class T>
+static bool checkRecords(RecordReader& reader, uint32_t count, std::string& report)
+{
+    IdTable<T> records;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        T record;
+        if (!dbDecodeRecord(reader, record) || !records.insert(record))
+        {
+            report += "record " + std::to_string(i) + " is corrupt or a duplicate\n";
+            return false;
+        }
+        reportRecord(report, record);
+    }
+    if (!reader.atEnd())
+    {
+        report += "trailing bytes after the last record\n";
+        return false;
+    }
+    return true;
+}
+
+bool dbImageCheck(const std::vector<uint8_t>& image, std::string& report)
+{
+    report.clear();
+    if (image.size() < DB_SNAPSHOT_HEADER_SIZE || !dbIsSnapshot(image.data(), image.size()))
+    {
+        report = "not a snapshot\n";
+        return false;
+    }
+    DbTable table = (DbTable)image[6];
+    if (table != DB_TABLE_STATIONS && table != DB_TABLE_EVENTS)
+    {
+        report = "unknown table " + std::to_string(image[6]) + "\n";
+        return false;
+    }
+    uint32_t sequence, count;
+    RecordReader reader(image.data(), image.size());
+    if (!dbCheckSnapshot(reader, table, sequence, count))
+    {
+        report = "bad version, size or CRC\n";
+        return false;
+    }
+    report = dbImageSlotKey(table, sequence) + ": sequence " + std::to_string(sequence) + ", " +
+        std::to_string(count) + " records\n";
+    return table == DB_TABLE_STATIONS ? checkRecords<Station>(reader, count, report) :
+        checkRecords<Event>(reader, count, report);
+}
+
+std::string dbImageSlotKey(DbTable table, uint32_t sequence)
+{
+    // Same slot naming as Storage
+    return std::string(table == DB_TABLE_STATIONS ? "stations" : "events") + (sequence % 2 ? ".b.bin" : ".a.bin");
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DbFormat.h"
+
+// Offline snapshot images of the stations and events db, see db_image.cpp.
+// The image is exactly what Storage writes to its snapshot slot for 'sequence'.
+
+// 'config' is the data object of a SET_CONFIG message, an invalid config produces nothing
+bool dbImageProduce(const std::string& config, DbTable table, uint32_t sequence, std::vector<uint8_t>& image);
+// Validates the header and CRC and decodes every record, 'report' lists the records
+bool dbImageCheck(const std::vector<uint8_t>& image, std::string& report);
+// Snapshot slot the image is loaded from, e.g. "stations.b.bin"
+std::string dbImageSlotKey(DbTable table, uint32_t sequence);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Clock.h"
+
+// Only moves when the test says so
+class FakeClock : public Clock
+{
+public:
+    FakeClock(uint64_t wallMs = 0) : wallMs(wallMs), monotonicMs(0) {}
+
+    uint64_t getWallMs() const override { return wallMs; }
+    int64_t getMonotonicMs() const override { return monotonicMs; }
+
+    // Both clocks move forward together
+    void advance(int64_t ms)
+    {
+        wallMs += ms;
+        monotonicMs += ms;
+    }
+
+    uint64_t wallMs;
+    int64_t monotonicMs;
+};
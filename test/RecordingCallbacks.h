@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "BlablaCallbacks.h"
+
+// Records the transitions instead of switching valves
+class RecordingCallbacks : public BlablaCallbacks
+{
+public:
+    struct Transition
+    {
+        uint32_t eventId;
+        std::vector<uint8_t> stations;
+        bool newState;
+    };
+
+    void onMessageReceived(MessageType, void*) override {}
+
+    void onEventStateChange(const Event& event, bool newState) override
+    {
+        transitions.push_back({event.id, event.stations_ids, newState});
+        if (onTransition)
+        {
+            onTransition(event, newState);
+        }
+    }
+
+    void getLatenessHistogram(LatenessHistogram&) override {}
+
+    bool getHistory(uint32_t, uint32_t, std::vector<HistoryRecord>&, size_t) override
+    {
+        return true;
+    }
+
+    const Transition* find(uint32_t eventId, bool newState, size_t from = 0) const
+    {
+        for (size_t i = from; i < transitions.size(); i++)
+        {
+            if (transitions[i].eventId == eventId && transitions[i].newState == newState)
+            {
+                return &transitions[i];
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<Transition> transitions;
+    // Runs after a transition was recorded, for tests that edit the schedule from the callback
+    std::function<void(const Event&, bool)> onTransition;
+};
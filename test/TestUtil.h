@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// Unlike assert, checks stay on in every build type
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } \
+    while (0)
+
+// Empty directory for a test's storage backend, under the build directory
+inline std::string makeTestDir(const char* name)
+{
+    std::string path = std::string("test_data/") + name;
+    std::string command = "rm -rf " + path + " && mkdir -p " + path;
+    CHECK(system(command.c_str()) == 0);
+    return path;
+}
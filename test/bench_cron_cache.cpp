@@ -0,0 +1,137 @@
+#include <chrono>
+#include <string.h>
+#include <time.h>
+
+#include "CronManager.h"
+#include "FakeClock.h"
+#include "PosixStorageBackend.h"
+#include "RecordingCallbacks.h"
+#include "Storage.h"
+#include "TestUtil.h"
+
+// Rescheduling the events through CronManager with their cron expressions read from
+// Storage and parsed again, like before the cache, and with the parsed expressions kept
+static const char* EXPRESSIONS[] = {
+    "*/10 * * * * *",
+    "0 0 6 * * *",
+    "0 30 5,18 * * MON-FRI",
+    "15 */7 * 1,15 * *",
+    "0 0 12 * JUN-AUG SAT,SUN",
+    "0 */15 6-20 * * *",
+    "30 0 4 1 * *",
+    "0 0/5 14,18 * * ?",
+};
+static const size_t NUM_OF_EXPRESSIONS = sizeof(EXPRESSIONS) / sizeof(EXPRESSIONS[0]);
+static const int NUM_OF_ROUNDS = 5000;
+static const int NUM_OF_TRANSITIONS = 20000;
+
+static const time_t START = 1700000000;
+
+static double elapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void commitEvents(Storage& storage, CronManager& cron, const std::vector<Event>& events)
+{
+    StorageDiff diff;
+    CHECK(storage.beginTransaction());
+    for (const auto& event : events)
+    {
+        storage.stageEvent(event);
+    }
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+}
+
+int main()
+{
+    std::string dir = makeTestDir("cron_cache");
+    PosixStorageBackend backend(dir.c_str());
+    FakeClock clock(START * 1000);
+    Storage storage(&backend, nullptr, &clock);
+    CronManager cron(&storage, &clock);
+    RecordingCallbacks callbacks;
+    cron.setCronCallbacks(&callbacks);
+
+    CHECK(storage.beginTransaction());
+    storage.stageClear();
+    StorageDiff diff;
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+    std::vector<Event> events;
+    StorageDiff changed;
+    for (size_t i = 0; i < NUM_OF_EXPRESSIONS; i++)
+    {
+        events.push_back(Event(i, {0}, "event", EXPRESSIONS[i], 1));
+        changed.changedEvents.push_back(i);
+    }
+    commitEvents(storage, cron, events);
+
+    // A changed event drops its compiled expression, so its cron string is read and parsed again
+    int64_t parsedSum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_OF_ROUNDS; i++)
+    {
+        clock.wallMs = (START + i * 61) * 1000;
+        cron.applyDiff(changed);
+        parsedSum += cron.getMsUntilNextDeadline();
+    }
+    double parsedNs = elapsedNs(begin) / (NUM_OF_ROUNDS * NUM_OF_EXPRESSIONS);
+
+    // A clock change reschedules every waiting event from its compiled expression
+    int64_t cachedSum = 0;
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_OF_ROUNDS; i++)
+    {
+        clock.wallMs = (START + i * 61) * 1000;
+        cron.onTimeChanged(0);
+        cachedSum += cron.getMsUntilNextDeadline();
+    }
+    double cachedNs = elapsedNs(begin) / (NUM_OF_ROUNDS * NUM_OF_EXPRESSIONS);
+
+    CHECK(parsedSum == cachedSum);
+    printf("reschedule with parse: %.0f ns, with cached expression: %.0f ns (%.1fx)\n",
+        parsedNs, cachedNs, parsedNs / cachedNs);
+
+    // Firing transitions, every off transition schedules the next run from the cache
+    clock.wallMs = START * 1000;
+    cron.onTimeChanged(0);
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
+    {
+        clock.wallMs += cron.getMsUntilNextDeadline();
+        cron.loop();
+    }
+    double firedNs = elapsedNs(begin) / NUM_OF_TRANSITIONS;
+    CHECK(callbacks.transitions.size() >= (size_t)NUM_OF_TRANSITIONS);
+    printf("fire and reschedule: %.0f ns per loop\n", firedNs);
+
+    // Changing the cron string replaces the cached schedule, waiting or running
+    callbacks.transitions.clear();
+    clock.wallMs = START * 1000;
+    cron.onTimeChanged(0);
+    CHECK(storage.beginTransaction());
+    for (size_t i = 2; i < NUM_OF_EXPRESSIONS; i++)
+    {
+        storage.stageEventRemoval(i);
+    }
+    storage.stageEvent(Event(0, {0}, "event", "0 0 0 * * *", 1));
+    diff = StorageDiff();
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+    // 2023-11-14 22:13:20, event 0 is due at midnight and event 1 at 6:00
+    CHECK(cron.getMsUntilNextDeadline() == (int64_t)(1700006400 - START) * 1000);
+    commitEvents(storage, cron, { Event(1, {0}, "event", "0 30 23 * * *", 1) });
+    CHECK(cron.getMsUntilNextDeadline() == (int64_t)(1700004600 - START) * 1000);
+    clock.wallMs = 1700004600ULL * 1000;
+    cron.loop();
+    CHECK(callbacks.find(1, true) != nullptr);
+    // Changed while running, the next run follows the new expression
+    commitEvents(storage, cron, { Event(1, {0}, "event", "0 45 23 * * *", 1) });
+    clock.advance(1000);
+    cron.loop();
+    CHECK(callbacks.find(1, false) != nullptr);
+    CHECK(cron.getMsUntilNextDeadline() == (int64_t)(1700005500 - 1700004601) * 1000);
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+
+#include "data.h"
+#include "TestUtil.h"
+
+// IdTable against the std::map it replaced: a random edit sequence must leave both with
+// the same contents in the same order, then lookups and iteration are timed per size.
+static const int NUM_OF_FUZZ_OPS = 100000;
+static const size_t NUM_OF_LOOKUPS = 1 << 18;
+static const size_t NUM_OF_VISITS = 1 << 20;
+
+template <class F>
+static double nsPerOp(F f, size_t numOfOps)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numOfOps;
+}
+
+static void fuzz(std::mt19937& rng)
+{
+    StationTable table;
+    std::map<uint32_t, Station> reference;
+    for (int i = 0; i < NUM_OF_FUZZ_OPS; i++)
+    {
+        // Ids past 255 don't fit a station, they must be neither found nor erased
+        uint32_t id = rng() % 300;
+        switch (rng() % 3)
+        {
+        case 0:
+            if (id < StationTable::MAX_IDS)
+            {
+                Station station(id, rng() % 40, "Station " + std::to_string(rng() % 9), rng() % 2);
+                table.set(station);
+                reference[id] = station;
+            }
+            break;
+        case 1:
+            CHECK(table.erase(id) == (reference.erase(id) == 1));
+            break;
+        default:
+        {
+            const Station* station = table.find(id);
+            auto it = reference.find(id);
+            CHECK((station != nullptr) == (it != reference.end()));
+            CHECK(station == nullptr || station->name == it->second.name);
+            break;
+        }
+        }
+
+        if (i % 1000 == 0)
+        {
+            CHECK(table.size() == reference.size());
+            auto it = reference.begin();
+            for (const Station& station : table)
+            {
+                CHECK(station.id == it->first);
+                ++it;
+            }
+        }
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    fuzz(rng);
+
+    for (size_t n : {8, 32, 128, 256})
+    {
+        std::vector<uint32_t> ids;
+        for (uint32_t id = 0; id < StationTable::MAX_IDS; id++)
+        {
+            ids.push_back(id);
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+        ids.resize(n);
+
+        StationTable table;
+        std::map<uint32_t, Station> reference;
+        for (uint32_t id : ids)
+        {
+            Station station(id, id % 40, "Station " + std::to_string(id), false);
+            table.set(station);
+            reference[id] = station;
+        }
+        std::vector<uint32_t> queries(NUM_OF_LOOKUPS);
+        for (uint32_t& id : queries)
+        {
+            id = ids[rng() % n];
+        }
+
+        // The sums keep the loops from being optimized away and must agree
+        long mapSum = 0;
+        long tableSum = 0;
+        double mapLookup = nsPerOp([&]() {
+            for (uint32_t id : queries)
+            {
+                auto it = reference.find(id);
+                mapSum += it != reference.end() ? it->second.gpio_pin : 0;
+            }
+        }, queries.size());
+        double tableLookup = nsPerOp([&]() {
+            for (uint32_t id : queries)
+            {
+                const Station* station = table.find(id);
+                tableSum += station != nullptr ? station->gpio_pin : 0;
+            }
+        }, queries.size());
+
+        size_t rounds = NUM_OF_VISITS / n;
+        double mapIterate = nsPerOp([&]() {
+            for (size_t round = 0; round < rounds; round++)
+            {
+                for (const auto& entry : reference)
+                {
+                    mapSum += entry.second.gpio_pin + entry.second.is_on;
+                }
+            }
+        }, rounds * n);
+        double tableIterate = nsPerOp([&]() {
+            for (size_t round = 0; round < rounds; round++)
+            {
+                for (const Station& station : table)
+                {
+                    tableSum += station.gpio_pin + station.is_on;
+                }
+            }
+        }, rounds * n);
+        CHECK(mapSum == tableSum);
+
+        printf("%3zu stations: lookup map %.2f ns, table %.2f ns | iterate map %.2f ns, table %.2f ns per station\n",
+            n, mapLookup, tableLookup, mapIterate, tableIterate);
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <chrono>
+#include <map>
+#include <string>
+#include <string.h>
+
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "TestUtil.h"
+
+// Boot load of synthetic events dbs, with the Storage loader and with the loader Storage
+// had before: a few freads and a heap copy per field, in the original layout. Event ids
+// are a byte, so the largest db has 255 events.
+static const int NUM_OF_LOADS = 50;
+
+static Event makeEvent(uint32_t id)
+{
+    return Event(id, {(uint8_t)(id % 8), (uint8_t)(id % 5)}, "Event number " + std::to_string(id),
+        "0 */5 6-20 * * MON-FRI", 60);
+}
+
+static void writeSizePrefixed(FILE* f, const void* data, size_t size)
+{
+    fwrite(&size, sizeof(size_t), 1, f);
+    fwrite(data, 1, size, f);
+}
+
+// The original events.bin layout
+static void writeBaselineEvents(const std::string& path, uint32_t numOfEvents)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    CHECK(f != nullptr);
+    fwrite(&numOfEvents, sizeof(uint32_t), 1, f);
+    for (uint32_t i = 0; i < numOfEvents; i++)
+    {
+        Event e = makeEvent(i);
+        int64_t duration = e.duration;
+        fwrite(&e.id, sizeof(uint8_t), 1, f);
+        writeSizePrefixed(f, e.stations_ids.data(), e.stations_ids.size());
+        writeSizePrefixed(f, e.name.data(), e.name.size());
+        writeSizePrefixed(f, e.cron_expr.data(), e.cron_expr.size());
+        fwrite(&duration, sizeof(int64_t), 1, f);
+    }
+    fclose(f);
+}
+
+static size_t loadBaselineEvents(const std::string& path, std::map<uint32_t, Event>& events)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    CHECK(f != nullptr);
+    uint32_t numOfEvents = 0;
+    CHECK(fread(&numOfEvents, sizeof(uint32_t), 1, f) == 1);
+    std::vector<Event> vec(numOfEvents);
+    for (uint32_t i = 0; i < numOfEvents; i++)
+    {
+        auto& e = vec[i];
+        size_t size = 0;
+        int64_t duration = 0;
+        fread(&e.id, sizeof(uint8_t), 1, f);
+        fread(&size, sizeof(size_t), 1, f);
+        e.stations_ids.resize(size);
+        fread(&e.stations_ids[0], sizeof(uint8_t), size, f);
+        fread(&size, sizeof(size_t), 1, f);
+        char* name = new char[size + 1];
+        memset(name, 0, size + 1);
+        fread(name, sizeof(char), size, f);
+        e.name = std::string(name);
+        fread(&size, sizeof(size_t), 1, f);
+        char* cron = new char[size + 1];
+        memset(cron, 0, size + 1);
+        fread(cron, sizeof(char), size, f);
+        e.cron_expr = std::string(cron);
+        fread(&duration, sizeof(int64_t), 1, f);
+        e.duration = duration;
+        delete[] cron;
+        delete[] name;
+    }
+    fclose(f);
+    events.clear();
+    for (auto& e : vec)
+    {
+        events[e.id] = e;
+    }
+    return events.size();
+}
+
+static double elapsedUs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    for (uint32_t numOfEvents : {10, 100, 255})
+    {
+        std::string dir = makeTestDir("storage_load");
+        PosixStorageBackend backend(dir.c_str());
+        {
+            EventTable events;
+            for (uint32_t i = 0; i < numOfEvents; i++)
+            {
+                events.set(makeEvent(i));
+            }
+            Storage storage(&backend);
+            CHECK(storage.setEvents(events));
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < NUM_OF_LOADS; i++)
+        {
+            Storage storage(&backend);
+            CHECK(storage.getEvents().size() == numOfEvents);
+        }
+        double loadUs = elapsedUs(begin) / NUM_OF_LOADS;
+
+        std::string baselinePath = dir + "/baseline_events.bin";
+        writeBaselineEvents(baselinePath, numOfEvents);
+        std::map<uint32_t, Event> baselineEvents;
+        begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < NUM_OF_LOADS; i++)
+        {
+            CHECK(loadBaselineEvents(baselinePath, baselineEvents) == numOfEvents);
+        }
+        double baselineUs = elapsedUs(begin) / NUM_OF_LOADS;
+
+        printf("%3u events: Storage boot load %.0f us, fread per field loader %.0f us\n",
+            numOfEvents, loadUs, baselineUs);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <string>
+
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "StorageBenchmark.h"
+#include "TestUtil.h"
+
+// Bytes written per event edit, appended to the edit log (with the compactions loop() runs
+// once the log is long enough) and, as Storage did before the log, rewriting the whole
+// table for every edit
+static const uint32_t NUM_OF_EDITS = 512;
+
+static EventTable makeEvents(uint32_t numOfEvents)
+{
+    EventTable events;
+    for (uint32_t i = 0; i < numOfEvents; i++)
+    {
+        events.set(Event(i, {(uint8_t)(i % 8)}, "Event " + std::to_string(i), "0 */5 * * * *", 60));
+    }
+    return events;
+}
+
+int main()
+{
+    for (uint32_t numOfEvents : {10, 100, 250})
+    {
+        std::string dir = makeTestDir("storage_writes");
+        PosixStorageBackend backend(dir.c_str());
+        Storage storage(&backend);
+        EventTable events = makeEvents(numOfEvents);
+        CHECK(storage.setEvents(events));
+
+        // Add/remove pairs of one id, the table size stays stable
+        backend.resetStats();
+        uint32_t id = numOfEvents;
+        for (uint32_t i = 0; i < NUM_OF_EDITS; i++)
+        {
+            if (!storage.removeEvent(id))
+            {
+                CHECK(storage.addEvent(Event(id, {0}, "Edited event", "0 0 * * * *", 30)));
+            }
+            storage.loop();
+        }
+        uint32_t logBytes = backend.getBytesWritten();
+
+        backend.resetStats();
+        for (uint32_t i = 0; i < NUM_OF_EDITS; i++)
+        {
+            if (i % 2 == 0)
+            {
+                events.set(Event(id, {0}, "Edited event", "0 0 * * * *", 30));
+            }
+            else
+            {
+                events.erase(id);
+            }
+            CHECK(storage.setEvents(events));
+        }
+        uint32_t rewriteBytes = backend.getBytesWritten();
+
+        printf("%3u events: %5u bytes per edit appended to the log, %6u rewriting the table\n",
+            numOfEvents, logBytes / NUM_OF_EDITS, rewriteBytes / NUM_OF_EDITS);
+        CHECK(logBytes < rewriteBytes);
+    }
+
+    // The workloads the device runs on its backends
+    std::string dir = makeTestDir("storage_benchmark");
+    PosixStorageBackend backend(dir.c_str());
+    for (const auto& r : runStorageBenchmark(backend, 16, 16, 64))
+    {
+        printf("[%s] %-12s %8lld us, %6u bytes read, %6u bytes written in %4u writes\n",
+            backend.getName(), r.workload, (long long)r.us, r.bytesRead, r.bytesWritten, r.writes);
+    }
+    return 0;
+}
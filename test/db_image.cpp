@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <iterator>
+
+#include "DbImage.h"
+
+// Produces and checks db snapshot images on the host:
+//
+//   db_image produce stations|events <config.json> <image> [sequence]
+//   db_image check <image>
+//
+// config.json holds the data object of a SET_CONFIG message. An image copied to the
+// slot key printed by produce (e.g. stations.b.bin) is loaded by Storage at boot.
+// Exits with 1 if the config or the image is invalid.
+static bool readFile(const char* path, std::string& data)
+{
+    std::ifstream f(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    return f.good() || f.eof();
+}
+
+static int usage()
+{
+    fprintf(stderr, "usage: db_image produce stations|events <config.json> <image> [sequence]\n"
+        "       db_image check <image>\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 5 && argc <= 6 && strcmp(argv[1], "produce") == 0)
+    {
+        DbTable table;
+        if (strcmp(argv[2], "stations") == 0)
+        {
+            table = DB_TABLE_STATIONS;
+        }
+        else if (strcmp(argv[2], "events") == 0)
+        {
+            table = DB_TABLE_EVENTS;
+        }
+        else
+        {
+            return usage();
+        }
+        uint32_t sequence = argc == 6 ? strtoul(argv[5], nullptr, 10) : 1;
+        std::string config;
+        std::vector<uint8_t> image;
+        if (!readFile(argv[3], config))
+        {
+            fprintf(stderr, "can't read %s\n", argv[3]);
+            return 1;
+        }
+        if (!dbImageProduce(config, table, sequence, image))
+        {
+            fprintf(stderr, "%s: invalid config\n", argv[3]);
+            return 1;
+        }
+        std::ofstream f(argv[4], std::ios::binary | std::ios::trunc);
+        f.write((const char*)image.data(), image.size());
+        if (!f)
+        {
+            fprintf(stderr, "can't write %s\n", argv[4]);
+            return 1;
+        }
+        printf("%s: %zu bytes, load it as %s\n", argv[4], image.size(), dbImageSlotKey(table, sequence).c_str());
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "check") == 0)
+    {
+        std::string data;
+        if (!readFile(argv[2], data))
+        {
+            fprintf(stderr, "can't read %s\n", argv[2]);
+            return 1;
+        }
+        std::string report;
+        bool ok = dbImageCheck(std::vector<uint8_t>(data.begin(), data.end()), report);
+        fprintf(ok ? stdout : stderr, "%s%s: %s\n", report.c_str(), argv[2], ok ? "OK" : "INVALID");
+        return ok ? 0 : 1;
+    }
+    return usage();
+}
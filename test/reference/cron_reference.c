@@ -0,0 +1,17 @@
+// The bit by bit ccronexpr.c the word-level scanning replaced, kept as the reference of
+// test_ccronexpr. Its public functions are renamed so it links next to src/ccronexpr.c.
+#define cron_mktime_gm reference_cron_mktime_gm
+#define cron_time_gm reference_cron_time_gm
+#define cron_mktime_local reference_cron_mktime_local
+#define cron_time_local reference_cron_time_local
+#define cron_mktime reference_cron_mktime
+#define cron_time reference_cron_time
+#define cron_set_bit reference_cron_set_bit
+#define cron_del_bit reference_cron_del_bit
+#define cron_get_bit reference_cron_get_bit
+#define cron_parse_expr reference_cron_parse_expr
+#define cron_next reference_cron_next
+#define cron_next_n reference_cron_next_n
+#define cron_prev reference_cron_prev
+
+#include "ccronexpr_bitwise.c"
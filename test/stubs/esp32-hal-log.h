@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdio.h>
+
+// Errors and warnings go to stderr, the rest is dropped to keep test output readable
+#define log_e(fmt, ...) fprintf(stderr, "[E] " fmt "\n", ##__VA_ARGS__)
+#define log_w(fmt, ...) fprintf(stderr, "[W] " fmt "\n", ##__VA_ARGS__)
+#define log_i(fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#define log_d(fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#define log_v(fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
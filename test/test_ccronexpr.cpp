@@ -0,0 +1,252 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ccronexpr.h"
+#include "TestUtil.h"
+
+// The bit by bit implementation, see reference/cron_reference.c
+extern "C"
+{
+    void reference_cron_parse_expr(const char* expression, cron_expr* target, const char** error);
+    time_t reference_cron_next(cron_expr* expr, time_t date);
+    time_t reference_cron_prev(cron_expr* expr, time_t date);
+}
+
+struct FieldRange
+{
+    int min;
+    int max;
+};
+
+// seconds, minutes, hours, day of month, month, day of week
+static const FieldRange FIELDS[] = { {0, 59}, {0, 59}, {0, 23}, {1, 31}, {1, 12}, {0, 6} };
+
+// A random field: '*', a value, a range, a step or a list of those
+static std::string randomField(std::mt19937& rng, const FieldRange& range)
+{
+    auto value = [&]() { return range.min + (int)(rng() % (range.max - range.min + 1)); };
+    std::string field;
+    int parts = 1 + rng() % 3;
+    for (int i = 0; i < parts; i++)
+    {
+        if (i > 0)
+        {
+            field += ',';
+        }
+        int low = value();
+        int high = value();
+        if (low > high)
+        {
+            std::swap(low, high);
+        }
+        switch (rng() % 5)
+        {
+            case 0: field += "*"; break;
+            case 1: field += std::to_string(low); break;
+            case 2: field += std::to_string(low) + "-" + std::to_string(high); break;
+            case 3: field += "*/" + std::to_string(1 + rng() % 17); break;
+            default: field += std::to_string(low) + "/" + std::to_string(1 + rng() % 11); break;
+        }
+        if (field[0] == '*')
+        {
+            break;
+        }
+    }
+    return field;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static cron_expr parse(const char* expression)
+{
+    cron_expr expr;
+    const char* error = NULL;
+    memset(&expr, 0, sizeof(expr));
+    cron_parse_expr(expression, &expr, &error);
+    CHECK(error == NULL);
+    return expr;
+}
+
+// cron_next_n must return what calling cron_next n times does, stopping at the first error
+static int checkNextN(const char* expression, time_t date, int n)
+{
+    cron_expr expr = parse(expression);
+    std::vector<time_t> expected;
+    time_t next = date;
+    while ((int)expected.size() < n)
+    {
+        next = cron_next(&expr, next);
+        if (next == (time_t)-1)
+        {
+            break;
+        }
+        expected.push_back(next);
+    }
+    std::vector<time_t> out(n + 1, 0);
+    int count = cron_next_n(&expr, date, out.data(), n);
+    if (count != (int)expected.size() || !std::equal(expected.begin(), expected.end(), out.begin()))
+    {
+        fprintf(stderr, "cron_next_n '%s' from %ld differs from cron_next\n", expression, (long)date);
+        exit(1);
+    }
+    // Nothing is written past the results
+    CHECK(out[count] == 0);
+    return count;
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    const time_t start = 1700000000;
+    int compared = 0;
+
+    // Both implementations must parse to the same bitfields and find the same dates
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string expression;
+        for (const auto& field : FIELDS)
+        {
+            expression += (expression.empty() ? "" : " ") + randomField(rng, field);
+        }
+        cron_expr word, bitwise;
+        const char* wordError = NULL;
+        const char* bitwiseError = NULL;
+        memset(&word, 0, sizeof(word));
+        memset(&bitwise, 0, sizeof(bitwise));
+        cron_parse_expr(expression.c_str(), &word, &wordError);
+        reference_cron_parse_expr(expression.c_str(), &bitwise, &bitwiseError);
+        CHECK((wordError == NULL) == (bitwiseError == NULL));
+        if (wordError != NULL)
+        {
+            continue;
+        }
+        CHECK(memcmp(&word, &bitwise, sizeof(word)) == 0);
+        // cron_prev recurses without end when a day of month never occurs (e.g. the 31st
+        // in a 30 day month), in both versions, so it's only compared up to the 28th
+        bool comparePrev = word.days_of_month[3] >> 5 == 0;
+        for (int j = 0; j < 20; j++)
+        {
+            time_t date = start + (time_t)(rng() % (4 * 365 * 24 * 3600));
+            bool same = cron_next(&word, date) == reference_cron_next(&bitwise, date) &&
+                (!comparePrev || cron_prev(&word, date) == reference_cron_prev(&bitwise, date));
+            if (!same)
+            {
+                fprintf(stderr, "'%s' differs at %ld\n", expression.c_str(), (long)date);
+                return 1;
+            }
+            compared++;
+        }
+    }
+    printf("%d dates match\n", compared);
+
+    // cron_next_n against repeated cron_next
+    CHECK(checkNextN("*/10 * * * * *", start, 0) == 0);
+    CHECK(checkNextN("*/10 * * * * *", start, 1) == 1);
+    CHECK(checkNextN("*/10 * * * * *", start, 500) == 500);
+    CHECK(checkNextN("0 30 5,18 * * MON-FRI", start, 100) == 100);
+    CHECK(checkNextN("0 0 12 29 2 *", start, 3) == 3);
+    // The 30th of February never comes
+    CHECK(checkNextN("0 0 0 30 2 *", start, 5) == 0);
+    for (int i = 0; i < 200; i++)
+    {
+        std::string expression;
+        for (const auto& field : FIELDS)
+        {
+            expression += (expression.empty() ? "" : " ") + randomField(rng, field);
+        }
+        cron_expr expr;
+        const char* error = NULL;
+        memset(&expr, 0, sizeof(expr));
+        cron_parse_expr(expression.c_str(), &expr, &error);
+        if (error == NULL)
+        {
+            checkNextN(expression.c_str(), start + (time_t)(rng() % (365 * 24 * 3600)), 1 + rng() % 50);
+        }
+    }
+
+    // Across the daylight saving changes of Central Europe: in 2023 the clocks went
+    // forward at 02:00 on March 26th and back at 03:00 on October 29th
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    const time_t springForward = 1679792400;
+    const time_t fallBack = 1698541200;
+    const char* dstExpressions[] = { "0 */15 * * * *", "0 30 2 * * *", "0 0 * * * *", "*/20 59 1-3 * * *" };
+    for (const char* expression : dstExpressions)
+    {
+        for (time_t change : { springForward, fallBack })
+        {
+            checkNextN(expression, change - 6 * 3600, 40);
+            checkNextN(expression, change - 1, 10);
+        }
+    }
+    setenv("TZ", "UTC", 1);
+    tzset();
+    puts("cron_next_n matches cron_next");
+
+    // The same 100 fire times in one call and in 100 calls
+    for (const char* expression : { "*/10 * * * * *", "0 30 5,18 * * MON-FRI" })
+    {
+        cron_expr expr = parse(expression);
+        const int runs = 200;
+        const int n = 100;
+        time_t out[n];
+        time_t batchSum = 0, singleSum = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++)
+        {
+            CHECK(cron_next_n(&expr, start + i * 13, out, n) == n);
+            batchSum += out[n - 1];
+        }
+        double batchNs = elapsedNs(begin) / runs;
+        begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++)
+        {
+            time_t next = start + i * 13;
+            for (int j = 0; j < n; j++)
+            {
+                next = cron_next(&expr, next);
+            }
+            singleSum += next;
+        }
+        double singleNs = elapsedNs(begin) / runs;
+        CHECK(batchSum == singleSum);
+        printf("%d fire times of '%s': cron_next_n %.0f ns, cron_next %.0f ns\n", n, expression, batchNs, singleNs);
+    }
+
+    // Sparse fields need the longest scans
+    const char* expressions[] = { "0 0 6 * * *", "0 30 5,18 * * MON-FRI", "0 0 12 * JUN-AUG SAT,SUN" };
+    for (const char* expression : expressions)
+    {
+        cron_expr expr;
+        const char* error = NULL;
+        memset(&expr, 0, sizeof(expr));
+        cron_parse_expr(expression, &expr, &error);
+        CHECK(error == NULL);
+        const int runs = 20000;
+        time_t wordSum = 0, bitwiseSum = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++)
+        {
+            bitwiseSum += reference_cron_next(&expr, start + i * 13);
+        }
+        double bitwiseNs = elapsedNs(begin) / runs;
+        begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++)
+        {
+            wordSum += cron_next(&expr, start + i * 13);
+        }
+        double wordNs = elapsedNs(begin) / runs;
+        CHECK(wordSum == bitwiseSum);
+        printf("cron_next '%s': bit by bit %.0f ns, word at a time %.0f ns\n", expression, bitwiseNs, wordNs);
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "CronManager.h"
+#include "FakeClock.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "RecordingCallbacks.h"
+#include "TestUtil.h"
+
+// Steps the fake clock 10 ms at a time and runs the cron loop until done() or the timeout
+template <class Done>
+static bool runUntil(FakeClock& clock, CronManager& cron, Done done, int timeoutMs)
+{
+    for (int elapsed = 0; elapsed < timeoutMs; elapsed += 10)
+    {
+        cron.loop();
+        if (done())
+        {
+            return true;
+        }
+        clock.advance(10);
+    }
+    return false;
+}
+
+int main()
+{
+    std::string dir = makeTestDir("cron_manager");
+    PosixStorageBackend backend(dir.c_str());
+    // 2023-11-14 22:13:20 UTC
+    FakeClock clock(1700000000ULL * 1000);
+    Storage storage(&backend, nullptr, &clock);
+    CronManager cron(&storage, &clock);
+    RecordingCallbacks callbacks;
+    cron.setCronCallbacks(&callbacks);
+
+    // Three events that start every second and run longer than the test needs to edit them
+    StorageDiff diff;
+    CHECK(storage.beginTransaction());
+    storage.stageClear();
+    storage.stageEvent(Event(1, {1, 2}, "removed", "* * * * * *", 3));
+    storage.stageEvent(Event(2, {3, 4}, "changed", "* * * * * *", 3));
+    storage.stageEvent(Event(3, {5}, "dropped", "* * * * * *", 3));
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+    CHECK(runUntil(clock, cron, [&]() {
+        return callbacks.find(1, true) && callbacks.find(2, true) && callbacks.find(3, true);
+    }, 2000));
+    CHECK(callbacks.find(1, false) == nullptr);
+    size_t started = callbacks.transitions.size();
+
+    // Removing a running event closes its valves right away
+    CHECK(storage.beginTransaction());
+    storage.stageEventRemoval(1);
+    storage.stageEvent(Event(2, {6}, "changed", "* * * * * *", 3));
+    diff = StorageDiff();
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+    const RecordingCallbacks::Transition* off = callbacks.find(1, false, started);
+    CHECK(off != nullptr && off->stations == std::vector<uint8_t>({1, 2}));
+    CHECK(!cron.isScheduled(1));
+    CHECK(callbacks.find(2, false, started) == nullptr);
+
+    // An event dropped from Storage behind the scheduler's back still closes its valves
+    CHECK(storage.removeEvent(3));
+
+    CHECK(runUntil(clock, cron, [&]() {
+        return callbacks.find(2, false, started) && callbacks.find(3, false, started);
+    }, 5000));
+    // A changed running event closes the stations it opened
+    off = callbacks.find(2, false, started);
+    CHECK(off->stations == std::vector<uint8_t>({3, 4}));
+    off = callbacks.find(3, false, started);
+    CHECK(off->stations == std::vector<uint8_t>({5}));
+    CHECK(!cron.isScheduled(3));
+
+    // The next run of the changed event uses its new stations
+    size_t stopped = callbacks.transitions.size();
+    CHECK(runUntil(clock, cron, [&]() { return callbacks.find(2, true, stopped) != nullptr; }, 2000));
+    CHECK(callbacks.find(2, true, stopped)->stations == std::vector<uint8_t>({6}));
+
+    // Every event was switched off exactly once
+    for (uint32_t eventId : {1, 2, 3})
+    {
+        const RecordingCallbacks::Transition* first = callbacks.find(eventId, false);
+        CHECK(first != nullptr);
+        CHECK(callbacks.find(eventId, false, first - callbacks.transitions.data() + 1) == nullptr);
+    }
+
+    puts("PASS");
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "CronManager.h"
+#include "FakeClock.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "RecordingCallbacks.h"
+#include "TestUtil.h"
+
+// 2023-11-14 22:10:00 UTC, a multiple of ten minutes
+#define BASE_TIME 1699999800ULL
+
+int main()
+{
+    std::string dir = makeTestDir("cron_resume");
+    PosixStorageBackend backend(dir.c_str());
+    // Rebooted two minutes into the runs that started on the ten minutes
+    FakeClock clock((BASE_TIME + 120) * 1000);
+    Storage storage(&backend, nullptr, &clock);
+    CronManager cron(&storage, &clock);
+    RecordingCallbacks callbacks;
+    cron.setCronCallbacks(&callbacks);
+
+    StorageDiff diff;
+    CHECK(storage.beginTransaction());
+    storage.stageClear();
+    // Still running, 3 of 5 minutes left
+    storage.stageEvent(Event(1, {1, 2}, "running", "0 */10 * * * *", 300));
+    // Ran for a minute, done already
+    storage.stageEvent(Event(2, {3}, "done", "0 */10 * * * *", 60));
+    // Starts at 22:14
+    storage.stageEvent(Event(3, {4}, "waiting", "0 4-59/10 * * * *", 300));
+    // Started at 22:04, ended exactly now
+    storage.stageEvent(Event(4, {5}, "ended", "0 4-59/10 * * * *", 480));
+    CHECK(storage.commitTransaction(diff));
+    for (uint32_t eventId : {1, 2, 3, 4})
+    {
+        cron.addEvent(eventId);
+    }
+
+    cron.resumeRunningEvents();
+    CHECK(callbacks.transitions.size() == 1);
+    CHECK(callbacks.transitions[0].eventId == 1 && callbacks.transitions[0].newState);
+    CHECK(cron.getRunningEvents().size() == 1);
+    CHECK(cron.getRunningEvents().at(1).stations_ids == std::vector<uint8_t>({1, 2}));
+    // Nothing else is switched on, event 3 is due first
+    CHECK(cron.isScheduled(2) && cron.isScheduled(3) && cron.isScheduled(4));
+    CHECK(cron.getMsUntilNextDeadline() == 120 * 1000);
+
+    // Resuming again doesn't switch it on twice
+    cron.resumeRunningEvents();
+    CHECK(callbacks.transitions.size() == 1);
+
+    // Event 3 starts at 22:14 as scheduled
+    clock.advance(120 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(3, true) != nullptr);
+    CHECK(callbacks.find(1, false) == nullptr);
+
+    // Event 1 ends when the run that started at 22:10 would have, and is next due at 22:20
+    clock.advance(60 * 1000);
+    cron.loop();
+    const RecordingCallbacks::Transition* off = callbacks.find(1, false);
+    CHECK(off != nullptr && off->stations == std::vector<uint8_t>({1, 2}));
+    CHECK(cron.getRunningEvents().count(1) == 0);
+    CHECK(cron.isScheduled(1));
+    size_t before = callbacks.transitions.size();
+    clock.advance(300 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(1, true, before) != nullptr);
+
+    puts("PASS");
+    return 0;
+}
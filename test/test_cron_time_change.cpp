@@ -0,0 +1,104 @@
+#include "CronManager.h"
+#include "FakeClock.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "RecordingCallbacks.h"
+#include "TestUtil.h"
+
+// CronManager::onTimeChanged on a fake clock: running events keep their remaining duration,
+// waiting ones are scheduled again from the new time
+
+// 2023-11-14 22:10:00 UTC, a multiple of ten minutes
+#define BASE_TIME 1699999800ULL
+
+static void setTime(FakeClock& clock, CronManager& cron, uint64_t wallMs)
+{
+    int64_t deltaMs = (int64_t)(wallMs - clock.wallMs);
+    clock.wallMs = wallMs;
+    cron.onTimeChanged(deltaMs);
+}
+
+int main()
+{
+    std::string dir = makeTestDir("cron_time_change");
+    PosixStorageBackend backend(dir.c_str());
+    FakeClock clock(BASE_TIME * 1000 - 1000);
+    Storage storage(&backend, nullptr, &clock);
+    CronManager cron(&storage, &clock);
+    RecordingCallbacks callbacks;
+    cron.setCronCallbacks(&callbacks);
+
+    StorageDiff diff;
+    CHECK(storage.beginTransaction());
+    storage.stageClear();
+    // Every ten minutes for five minutes
+    storage.stageEvent(Event(1, {1}, "long", "0 */10 * * * *", 300));
+    // Two minutes past every ten minutes, for a minute
+    storage.stageEvent(Event(2, {2}, "short", "0 2-59/10 * * * *", 60));
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+    CHECK(cron.getMsUntilNextDeadline() == 1000);
+
+    // 22:10:00, event 1 switches on until 22:15
+    clock.advance(1000);
+    cron.loop();
+    CHECK(callbacks.find(1, true) != nullptr);
+    CHECK(cron.getMsUntilNextDeadline() == 120 * 1000);
+
+    // An hour forward at 22:11: event 1 still has four minutes to run, event 2 is next
+    // due at 23:12 instead of 22:12
+    clock.advance(60 * 1000);
+    setTime(clock, cron, clock.wallMs + 3600 * 1000);
+    CHECK(callbacks.transitions.size() == 1);
+    CHECK(cron.getMsUntilNextDeadline() == 60 * 1000);
+    clock.advance(60 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(2, true) != nullptr);
+    CHECK(callbacks.find(1, false) == nullptr);
+    // Event 1 ends at 23:15, its five minutes are counted on the new clock
+    clock.advance(60 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(2, false) != nullptr);
+    CHECK(callbacks.find(1, false) == nullptr);
+    CHECK(cron.getMsUntilNextDeadline() == 120 * 1000);
+    clock.advance(120 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(1, false) != nullptr);
+    CHECK(cron.getLatenessHistogram().getMaxMs() == 0);
+
+    // Event 1 waits for 23:20 and event 2 for 23:22. Two hours back to 21:15:00 they are due
+    // at 21:20 and 21:22, the cached 23:20 fire time isn't kept.
+    CHECK(cron.getMsUntilNextDeadline() == 300 * 1000);
+    setTime(clock, cron, clock.wallMs - 2 * 3600 * 1000);
+    CHECK(clock.wallMs == (BASE_TIME - 3600 + 300) * 1000);
+    CHECK(cron.getMsUntilNextDeadline() == 300 * 1000);
+    size_t before = callbacks.transitions.size();
+    clock.advance(300 * 1000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == before + 1 && callbacks.find(1, true, before) != nullptr);
+
+    // Back again while event 1 runs: its off transition moves along, it still ends in 5 minutes
+    setTime(clock, cron, clock.wallMs - 24 * 3600 * 1000);
+    CHECK(cron.getMsUntilNextDeadline() == 120 * 1000);
+    clock.advance(120 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(2, true, before) != nullptr);
+    clock.advance(60 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(2, false, before) != nullptr);
+    CHECK(callbacks.find(1, false, before) == nullptr);
+    clock.advance(120 * 1000);
+    cron.loop();
+    CHECK(callbacks.find(1, false, before) != nullptr);
+    CHECK(cron.getLatenessHistogram().getMaxMs() == 0);
+
+    // A jump without onTimeChanged leaves the transitions where they were, they fire late
+    before = callbacks.transitions.size();
+    clock.advance(3600 * 1000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() > before);
+    CHECK(cron.getLatenessHistogram().getMaxMs() > 0);
+
+    puts("PASS");
+    return 0;
+}
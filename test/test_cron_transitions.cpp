@@ -0,0 +1,118 @@
+#include "CronManager.h"
+#include "FakeClock.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "RecordingCallbacks.h"
+#include "TestUtil.h"
+
+// CronManager::fireTransition on a fake clock: what the callbacks see, when the off
+// transition and the next run are due, and events that changed while they were pending
+
+// 2023-11-14 22:10:00 UTC, a multiple of ten minutes
+#define BASE_TIME 1699999800ULL
+
+static void commit(Storage& storage, CronManager& cron, const std::vector<Event>& events, const std::vector<uint32_t>& removed = {})
+{
+    StorageDiff diff;
+    CHECK(storage.beginTransaction());
+    for (auto eventId : removed)
+    {
+        storage.stageEventRemoval(eventId);
+    }
+    for (const auto& event : events)
+    {
+        storage.stageEvent(event);
+    }
+    CHECK(storage.commitTransaction(diff));
+    cron.applyDiff(diff);
+}
+
+int main()
+{
+    std::string dir = makeTestDir("cron_transitions");
+    PosixStorageBackend backend(dir.c_str());
+    FakeClock clock(BASE_TIME * 1000 - 10 * 1000);
+    Storage storage(&backend, nullptr, &clock);
+    CronManager cron(&storage, &clock);
+    RecordingCallbacks callbacks;
+    cron.setCronCallbacks(&callbacks);
+
+    CHECK(storage.beginTransaction());
+    storage.stageClear();
+    StorageDiff diff;
+    CHECK(storage.commitTransaction(diff));
+    commit(storage, cron, { Event(1, {1, 2}, "a", "0 */10 * * * *", 120) });
+
+    // Nothing fires before the deadline
+    clock.advance(9999);
+    cron.loop();
+    CHECK(callbacks.transitions.empty());
+
+    // Switched on 7 s late, the off transition still follows the intended start
+    clock.advance(7001);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == 1);
+    CHECK(callbacks.transitions[0].eventId == 1 && callbacks.transitions[0].newState);
+    CHECK(callbacks.transitions[0].stations == std::vector<uint8_t>({1, 2}));
+    CHECK(cron.getRunningEvents().count(1) == 1);
+    CHECK(cron.getLatenessHistogram().getCount() == 1 && cron.getLatenessHistogram().getLastMs() == 7000);
+    CHECK(cron.getMsUntilNextDeadline() == 120 * 1000 - 7000);
+
+    // Switched off on time, the next run is at 22:20
+    clock.advance(120 * 1000 - 7000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == 2 && !callbacks.transitions[1].newState);
+    CHECK(callbacks.transitions[1].stations == std::vector<uint8_t>({1, 2}));
+    CHECK(cron.getRunningEvents().empty());
+    CHECK(cron.getLatenessHistogram().getLastMs() == 0);
+    CHECK(cron.getMsUntilNextDeadline() == 480 * 1000);
+
+    // Transitions due at the same loop fire in deadline order: at 22:20:10 event 2 should
+    // have started at 22:19 and ended at 22:19:30, event 1 started at 22:20
+    commit(storage, cron, { Event(2, {3}, "b", "0 9-59/10 * * * *", 30) });
+    callbacks.transitions.clear();
+    clock.advance(490 * 1000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == 3);
+    CHECK(callbacks.transitions[0].eventId == 2 && callbacks.transitions[0].newState);
+    CHECK(callbacks.transitions[1].eventId == 2 && !callbacks.transitions[1].newState);
+    CHECK(callbacks.transitions[2].eventId == 1 && callbacks.transitions[2].newState);
+    CHECK(cron.getLatenessHistogram().getMaxMs() == 70 * 1000);
+
+    // An event dropped from Storage while running closes the stations it opened and isn't
+    // scheduled again
+    CHECK(storage.removeEvent(1));
+    clock.advance(120 * 1000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == 4 && callbacks.transitions[3].eventId == 1);
+    CHECK(!callbacks.transitions[3].newState && callbacks.transitions[3].stations == std::vector<uint8_t>({1, 2}));
+    CHECK(!cron.isScheduled(1));
+
+    // An event dropped while waiting is dropped when its on transition fires, without a callback
+    CHECK(storage.removeEvent(2));
+    CHECK(cron.isScheduled(2));
+    clock.advance(600 * 1000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == 4);
+    CHECK(!cron.isScheduled(2));
+
+    // The callback removing the event that is switching on closes it again, and no off
+    // transition is left behind
+    commit(storage, cron, { Event(3, {4}, "c", "* * * * * *", 30) });
+    callbacks.onTransition = [&](const Event& event, bool newState) {
+        if (newState)
+        {
+            cron.removeEvent(event.id);
+        }
+    };
+    clock.advance(1000);
+    cron.loop();
+    CHECK(callbacks.transitions.size() == 6);
+    CHECK(callbacks.transitions[4].eventId == 3 && callbacks.transitions[4].newState);
+    CHECK(callbacks.transitions[5].eventId == 3 && !callbacks.transitions[5].newState);
+    CHECK(!cron.isScheduled(3) && cron.getRunningEvents().empty());
+    CHECK(cron.getMsUntilNextDeadline() == -1);
+
+    puts("PASS");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <fstream>
+
+#include "DbImage.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "TestUtil.h"
+
+// Produces images with the db_image tool code, checks that Storage boots from them and
+// that every corrupted or truncated image is rejected by the check.
+static const char* CONFIG =
+    "{\"stations\":[{\"id\":3,\"gpio_pin\":25,\"name\":\"lawn\"},"
+    "{\"id\":1,\"gpio_pin\":26,\"name\":\"hedge \\\"north\\\"\"}],"
+    "\"events\":[{\"id\":7,\"station_ids\":[1,3],\"name\":\"morning\",\"cron_expr\":\"0 30 6 * * *\",\"duration\":600}]}";
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data)
+{
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f.write((const char*)data.data(), data.size());
+}
+
+static void checkRejectsDamage(const std::vector<uint8_t>& image)
+{
+    std::string report;
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        std::vector<uint8_t> damaged = image;
+        damaged[i] ^= 0x10;
+        CHECK(!dbImageCheck(damaged, report));
+    }
+    for (size_t cut = 0; cut < image.size(); cut++)
+    {
+        CHECK(!dbImageCheck(std::vector<uint8_t>(image.begin(), image.begin() + cut), report));
+    }
+    std::vector<uint8_t> longer = image;
+    longer.push_back(0);
+    CHECK(!dbImageCheck(longer, report));
+}
+
+int main()
+{
+    std::vector<uint8_t> stations, events;
+    std::string report;
+    CHECK(dbImageProduce(CONFIG, DB_TABLE_STATIONS, 4, stations));
+    CHECK(dbImageProduce(CONFIG, DB_TABLE_EVENTS, 5, events));
+    CHECK(dbImageCheck(stations, report));
+    CHECK(report == "stations.a.bin: sequence 4, 2 records\n"
+        "station 1 pin 26 off \"hedge \"north\"\"\n"
+        "station 3 pin 25 off \"lawn\"\n");
+    CHECK(dbImageCheck(events, report));
+    CHECK(report == "events.b.bin: sequence 5, 1 records\n"
+        "event 7 \"morning\" \"0 30 6 * * *\" 600s stations 1 3\n");
+
+    // Invalid configs produce nothing
+    std::vector<uint8_t> image;
+    CHECK(!dbImageProduce("{\"stations\":[{\"id\":1,\"gpio_pin\":34,\"name\":\"a\"}],\"events\":[]}",
+        DB_TABLE_STATIONS, 1, image));
+    CHECK(!dbImageProduce("{\"stations\":[", DB_TABLE_STATIONS, 1, image));
+
+    checkRejectsDamage(stations);
+    checkRejectsDamage(events);
+    CHECK(!dbImageCheck(std::vector<uint8_t>(), report));
+
+    // Storage boots from the images in their slots
+    std::string dir = makeTestDir("db_image");
+    writeFile(dir + "/" + dbImageSlotKey(DB_TABLE_STATIONS, 4), stations);
+    writeFile(dir + "/" + dbImageSlotKey(DB_TABLE_EVENTS, 5), events);
+    PosixStorageBackend backend(dir.c_str());
+    Storage storage(&backend);
+    CHECK(storage.getStations().size() == 2 && storage.getEvents().size() == 1);
+    const Station* lawn = storage.getStation(3);
+    CHECK(lawn != nullptr && lawn->gpio_pin == 25 && !lawn->is_on && storage.getStationName(*lawn) == "lawn");
+    const Station* hedge = storage.getStation(1);
+    CHECK(hedge != nullptr && hedge->gpio_pin == 26 && storage.getStationName(*hedge) == "hedge \"north\"");
+    const Event* morning = storage.getEvent(7);
+    CHECK(morning != nullptr && morning->duration == 600 && morning->stations_ids == std::vector<uint8_t>({ 1, 3 }));
+    CHECK(storage.getEventName(*morning) == "morning" && storage.getEventCron(*morning) == "0 30 6 * * *");
+
+    printf("PASS: %zu and %zu byte images\n", stations.size(), events.size());
+    return 0;
+}
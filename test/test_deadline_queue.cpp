@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <random>
+
+#include "CronManager.h"
+#include "DeadlineQueue.h"
+#include "TestUtil.h"
+
+// DeadlineQueue against a vector kept sorted by deadline. Equal deadlines may pop in any
+// order, so only the deadline of a popped key is compared.
+static const int NUM_OF_KEYS = 64;
+static const int NUM_OF_OPERATIONS = 200000;
+
+struct Reference
+{
+    std::vector<DeadlineQueue::Entry> entries;
+
+    std::vector<DeadlineQueue::Entry>::iterator find(uint32_t key)
+    {
+        return std::find_if(entries.begin(), entries.end(), [&](const DeadlineQueue::Entry& e) { return e.key == key; });
+    }
+
+    void push(uint32_t key, uint64_t deadline)
+    {
+        auto it = find(key);
+        if (it != entries.end())
+        {
+            entries.erase(it);
+        }
+        auto pos = std::upper_bound(entries.begin(), entries.end(), deadline,
+            [](uint64_t d, const DeadlineQueue::Entry& e) { return d < e.deadline; });
+        entries.insert(pos, {deadline, key});
+    }
+};
+
+// The popped key must be queued with the earliest deadline
+static void checkPop(DeadlineQueue& queue, Reference& reference)
+{
+    DeadlineQueue::Entry entry;
+    CHECK(queue.pop(entry));
+    CHECK(!reference.entries.empty() && entry.deadline == reference.entries.front().deadline);
+    auto it = reference.find(entry.key);
+    CHECK(it != reference.entries.end() && it->deadline == entry.deadline);
+    reference.entries.erase(it);
+}
+
+static void checkSame(const DeadlineQueue& queue, Reference& reference)
+{
+    CHECK(queue.size() == reference.entries.size());
+    CHECK(queue.empty() == reference.entries.empty());
+    if (!reference.entries.empty())
+    {
+        CHECK(queue.peek() != nullptr && queue.peek()->deadline == reference.entries.front().deadline);
+    }
+    else
+    {
+        CHECK(queue.peek() == nullptr);
+    }
+    for (uint32_t key = 0; key < NUM_OF_KEYS + 2; key++)
+    {
+        auto it = reference.find(key);
+        uint64_t deadline = 0;
+        CHECK(queue.contains(key) == (it != reference.entries.end()));
+        CHECK(queue.getDeadline(key, deadline) == (it != reference.entries.end()));
+        CHECK(it == reference.entries.end() || deadline == it->deadline);
+    }
+}
+
+static void checkExamples()
+{
+    DeadlineQueue queue;
+    DeadlineQueue::Entry entry;
+    CHECK(!queue.pop(entry) && !queue.cancel(3));
+    queue.push(1, 100);
+    queue.push(2, 200);
+    queue.push(3, 300);
+
+    // Moving a key earlier or later reorders it instead of adding a second entry
+    queue.push(3, 50);
+    CHECK(queue.size() == 3 && queue.peek()->key == 3);
+    queue.push(3, 250);
+    CHECK(queue.size() == 3 && queue.peek()->key == 1);
+    queue.push(1, 400);
+    CHECK(queue.pop(entry) && entry.key == 2 && entry.deadline == 200);
+    CHECK(queue.pop(entry) && entry.key == 3 && entry.deadline == 250);
+    CHECK(queue.cancel(1) && !queue.cancel(1) && queue.empty());
+
+    // The on and off transitions of an event are separate keys, one doesn't replace the other
+    CHECK(CronManager::transitionKey(5, true) != CronManager::transitionKey(5, false));
+    CHECK(CronManager::transitionKey(5, false) != CronManager::transitionKey(4, true));
+    CHECK(CronManager::transitionKey(255, true) >> 1 == 255 && (CronManager::transitionKey(255, true) & 1) == 1);
+    CHECK(CronManager::transitionKey(255, false) >> 1 == 255 && (CronManager::transitionKey(255, false) & 1) == 0);
+    queue.push(CronManager::transitionKey(5, true), 1000);
+    queue.push(CronManager::transitionKey(5, false), 2000);
+    queue.push(CronManager::transitionKey(4, true), 1500);
+    CHECK(queue.size() == 3);
+    CHECK(queue.cancel(CronManager::transitionKey(5, true)));
+    uint64_t deadline;
+    CHECK(queue.getDeadline(CronManager::transitionKey(5, false), deadline) && deadline == 2000);
+    CHECK(queue.pop(entry) && entry.key == CronManager::transitionKey(4, true));
+    CHECK(queue.pop(entry) && entry.key >> 1 == 5 && (entry.key & 1) == 0);
+
+    queue.push(7, 1);
+    queue.clear();
+    CHECK(queue.empty() && !queue.contains(7));
+}
+
+int main()
+{
+    checkExamples();
+
+    std::mt19937 rng(1);
+    DeadlineQueue queue;
+    Reference reference;
+    DeadlineQueue::Entry entry;
+    int pops = 0;
+    for (int i = 0; i < NUM_OF_OPERATIONS; i++)
+    {
+        uint32_t key = rng() % NUM_OF_KEYS;
+        // Few distinct deadlines, so ties are common
+        uint64_t deadline = rng() % 1000;
+        switch (rng() % 8)
+        {
+        case 0:
+        case 1:
+        case 2:
+            // Adds a new key or moves an existing one earlier or later
+            queue.push(key, deadline);
+            reference.push(key, deadline);
+            break;
+        case 3:
+        {
+            auto it = reference.find(key);
+            CHECK(queue.cancel(key) == (it != reference.entries.end()));
+            if (it != reference.entries.end())
+            {
+                reference.entries.erase(it);
+            }
+            break;
+        }
+        case 4:
+        case 5:
+            if (reference.entries.empty())
+            {
+                CHECK(!queue.pop(entry));
+                break;
+            }
+            checkPop(queue, reference);
+            pops++;
+            break;
+        case 6:
+            // Pops everything that is due, like CronManager::loop
+            while (!queue.empty() && queue.peek()->deadline <= deadline)
+            {
+                checkPop(queue, reference);
+                pops++;
+            }
+            CHECK(reference.entries.empty() || reference.entries.front().deadline > deadline);
+            break;
+        default:
+            if (rng() % 500 == 0)
+            {
+                queue.clear();
+                reference.entries.clear();
+            }
+            break;
+        }
+        checkSame(queue, reference);
+    }
+    printf("%d operations, %d pops match\n", NUM_OF_OPERATIONS, pops);
+    puts("PASS");
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <deque>
+#include <random>
+
+#include "HistoryLog.h"
+#include "PosixStorageBackend.h"
+#include "TestUtil.h"
+
+// HistoryLog against a deque of the records that should still be held: appending the first
+// record of a block evicts what the block held from the previous lap
+
+struct Model
+{
+    std::deque<HistoryRecord> records;
+    uint32_t nextSequence = 1;
+
+    void append(const HistoryRecord& record)
+    {
+        uint32_t sequence = nextSequence++;
+        if ((sequence % HistoryLog::CAPACITY) % HistoryLog::BLOCK_RECORDS == 0)
+        {
+            // The block held the sequences one lap back
+            while (!records.empty() && records.front().sequence + HistoryLog::CAPACITY < sequence + HistoryLog::BLOCK_RECORDS)
+            {
+                records.pop_front();
+            }
+        }
+        records.push_back(record);
+        records.back().sequence = sequence;
+    }
+
+    std::vector<HistoryRecord> query(uint32_t from, uint32_t to) const
+    {
+        std::vector<HistoryRecord> matching;
+        for (const auto& record : records)
+        {
+            if (record.timestamp >= from && record.timestamp <= to)
+            {
+                matching.push_back(record);
+            }
+        }
+        return matching;
+    }
+};
+
+static bool sameRecord(const HistoryRecord& a, const HistoryRecord& b)
+{
+    return a.sequence == b.sequence && a.timestamp == b.timestamp && a.station_id == b.station_id &&
+        a.event_id == b.event_id && a.source == b.source && a.is_on == b.is_on && a.duration == b.duration;
+}
+
+static void checkQuery(HistoryLog& history, const Model& model, uint32_t from, uint32_t to)
+{
+    std::vector<HistoryRecord> records;
+    std::vector<HistoryRecord> expected = model.query(from, to);
+    CHECK(history.query(from, to, records, HistoryLog::CAPACITY));
+    CHECK(records.size() == expected.size());
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        CHECK(sameRecord(records[i], expected[i]));
+    }
+    // A limited query returns the oldest matches
+    if (expected.size() > 1)
+    {
+        size_t limit = expected.size() / 2;
+        CHECK(!history.query(from, to, records, limit));
+        CHECK(records.size() == limit && sameRecord(records.back(), expected[limit - 1]));
+    }
+}
+
+static void checkSame(HistoryLog& history, const Model& model)
+{
+    CHECK(history.getCount() == model.records.size());
+    checkQuery(history, model, 0, UINT32_MAX);
+}
+
+static HistoryRecord makeRecord(std::mt19937& rng, uint32_t timestamp)
+{
+    HistoryRecord record;
+    record.sequence = 0;
+    record.timestamp = timestamp;
+    record.station_id = rng() % 256;
+    record.event_id = rng() % 2 ? HISTORY_NO_EVENT : rng() % 256;
+    record.source = rng() % 2 ? HISTORY_SOURCE_EVENT : HISTORY_SOURCE_MANUAL;
+    record.is_on = rng() % 2;
+    record.duration = rng() % 65536;
+    return record;
+}
+
+int main()
+{
+    std::string dir = makeTestDir("history_log");
+    PosixStorageBackend backend(dir.c_str());
+    std::string path = backend.getFilePath("history.bin");
+    std::mt19937 rng(1);
+    Model model;
+
+    HistoryLog history(path.c_str());
+    CHECK(history.open());
+    checkSame(history, model);
+
+    // Two and a half laps, the clock mostly moves forward but steps back now and then, so
+    // the time ranges of the blocks overlap
+    uint32_t timestamp = 1700000000;
+    const uint32_t total = HistoryLog::CAPACITY * 5 / 2 + 17;
+    for (uint32_t i = 0; i < total; i++)
+    {
+        timestamp += rng() % 7 == 0 ? -(int32_t)(rng() % 300) : rng() % 60;
+        HistoryRecord record = makeRecord(rng, timestamp);
+        CHECK(history.append(record));
+        model.append(record);
+        CHECK(record.sequence == model.records.back().sequence);
+        // Around the first lap and every block boundary
+        uint32_t sequence = record.sequence;
+        if (sequence < 3 || sequence % HistoryLog::BLOCK_RECORDS < 2 || sequence % HistoryLog::BLOCK_RECORDS == HistoryLog::BLOCK_RECORDS - 1)
+        {
+            CHECK(history.getCount() == model.records.size());
+        }
+    }
+    // The oldest record is the first one of the oldest full block
+    CHECK(model.records.front().sequence % HistoryLog::BLOCK_RECORDS == 0);
+    CHECK(history.getCount() == HistoryLog::CAPACITY - HistoryLog::BLOCK_RECORDS + (total + 1) % HistoryLog::BLOCK_RECORDS);
+    checkSame(history, model);
+    for (int i = 0; i < 200; i++)
+    {
+        uint32_t from = model.records.front().timestamp - 500 + rng() % (timestamp - model.records.front().timestamp + 1000);
+        uint32_t to = from + rng() % 3000;
+        checkQuery(history, model, from, to);
+    }
+    checkQuery(history, model, 0, model.records.front().timestamp - 1000);
+
+    // Reopening rebuilds the index from the file and keeps counting from the last sequence,
+    // the block being written still holds evicted records of the previous lap
+    history.close();
+    HistoryLog reopened(path.c_str());
+    CHECK(reopened.open());
+    checkSame(reopened, model);
+    for (uint32_t i = 0; i < HistoryLog::BLOCK_RECORDS + 5; i++)
+    {
+        timestamp += rng() % 60;
+        HistoryRecord record = makeRecord(rng, timestamp);
+        CHECK(reopened.append(record));
+        model.append(record);
+        CHECK(record.sequence == model.records.back().sequence);
+    }
+    checkSame(reopened, model);
+    reopened.close();
+
+    // A file of another size is recreated empty
+    FILE* file = fopen(path.c_str(), "ab");
+    CHECK(file != nullptr && fputc(0, file) == 0 && fclose(file) == 0);
+    HistoryLog recreated(path.c_str());
+    CHECK(recreated.open());
+    CHECK(recreated.getCount() == 0);
+    HistoryRecord record = makeRecord(rng, timestamp);
+    CHECK(recreated.append(record) && record.sequence == 1);
+
+    // Without a file nothing is recorded
+    HistoryLog closed("");
+    CHECK(!closed.append(record));
+    std::vector<HistoryRecord> records;
+    CHECK(closed.query(0, UINT32_MAX, records, 10) && records.empty());
+
+    puts("PASS");
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "LatenessHistogram.h"
+#include "TestUtil.h"
+
+// Bucket of a single recorded value
+static size_t bucketOf(int64_t latenessMs)
+{
+    LatenessHistogram histogram;
+    histogram.record(latenessMs);
+    size_t found = LatenessHistogram::NUM_BUCKETS;
+    for (size_t bucket = 0; bucket < LatenessHistogram::NUM_BUCKETS; bucket++)
+    {
+        if (histogram.getBucketCount(bucket) != 0)
+        {
+            CHECK(found == LatenessHistogram::NUM_BUCKETS && histogram.getBucketCount(bucket) == 1);
+            found = bucket;
+        }
+    }
+    CHECK(found < LatenessHistogram::NUM_BUCKETS);
+    return found;
+}
+
+int main()
+{
+    // Bounds are inclusive, a value just above one goes to the next bucket
+    for (size_t i = 0; i < LatenessHistogram::NUM_BOUNDS; i++)
+    {
+        int32_t bound = LatenessHistogram::BUCKET_BOUNDS_MS[i];
+        CHECK(bucketOf(bound) == i);
+        CHECK(bucketOf(bound + 1) == i + 1);
+        CHECK(i == 0 || bucketOf(LatenessHistogram::BUCKET_BOUNDS_MS[i - 1] + 1) == i);
+    }
+    // Early transitions count as on time, everything past the last bound goes to the last bucket
+    CHECK(bucketOf(-1) == 0);
+    CHECK(bucketOf(INT64_MIN) == 0);
+    CHECK(bucketOf(INT64_MAX) == LatenessHistogram::NUM_BUCKETS - 1);
+    CHECK(LatenessHistogram().getBucketCount(LatenessHistogram::NUM_BUCKETS) == 0);
+
+    LatenessHistogram histogram;
+    CHECK(histogram.getCount() == 0 && histogram.getMinMs() == 0 && histogram.getMaxMs() == 0 && histogram.getLastMs() == 0);
+    // The first value sets the minimum and maximum even when both are on the same side of 0
+    histogram.record(7);
+    CHECK(histogram.getCount() == 1 && histogram.getMinMs() == 7 && histogram.getMaxMs() == 7 && histogram.getLastMs() == 7);
+    histogram.record(3);
+    histogram.record(20000);
+    histogram.record(-4);
+    histogram.record(12);
+    CHECK(histogram.getCount() == 5);
+    CHECK(histogram.getMinMs() == -4 && histogram.getMaxMs() == 20000 && histogram.getLastMs() == 12);
+    // -4 | 3 | 7 | 12 | 20000
+    CHECK(histogram.getBucketCount(0) == 1);
+    CHECK(histogram.getBucketCount(3) == 1);
+    CHECK(histogram.getBucketCount(4) == 1);
+    CHECK(histogram.getBucketCount(5) == 1);
+    CHECK(histogram.getBucketCount(LatenessHistogram::NUM_BUCKETS - 1) == 1);
+
+    histogram.reset();
+    CHECK(histogram.getCount() == 0 && histogram.getMinMs() == 0 && histogram.getMaxMs() == 0 && histogram.getLastMs() == 0);
+    for (size_t bucket = 0; bucket < LatenessHistogram::NUM_BUCKETS; bucket++)
+    {
+        CHECK(histogram.getBucketCount(bucket) == 0);
+    }
+    histogram.record(-9);
+    CHECK(histogram.getMinMs() == -9 && histogram.getMaxMs() == -9);
+
+    puts("PASS");
+    return 0;
+}
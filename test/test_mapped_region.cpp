@@ -0,0 +1,168 @@
+#include <string.h>
+#include <vector>
+
+#include "FakeClock.h"
+#include "MappedRegion.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "TestUtil.h"
+
+// The snapshot region on Linux: a file mapped read-only and written through pwrite, remapped
+// after every erase and write like the partition on the ESP32. Storage commits its snapshots
+// to it and reads the names and cron expressions from the mapping.
+
+static const size_t REGION_SIZE = 0x20000;
+// Four slots, stations A/B then events A/B
+static const size_t SLOT_SIZE = REGION_SIZE / 4;
+
+static bool isErased(const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Slot of the region the string is read from, -1 if it isn't in the mapping
+static int slotOf(const MappedRegion& region, std::string_view text)
+{
+    const uint8_t* p = (const uint8_t*)text.data();
+    if (text.empty() || p < region.data() || p + text.size() > region.data() + region.size())
+    {
+        return -1;
+    }
+    return (p - region.data()) / SLOT_SIZE;
+}
+
+static void checkRegion(const std::string& path)
+{
+    MappedRegion region(path.c_str(), REGION_SIZE);
+    CHECK(region.data() == nullptr);
+    CHECK(region.open());
+    // A new region starts out erased
+    CHECK(region.size() == REGION_SIZE && isErased(region.data(), REGION_SIZE));
+
+    // Every write shows in the mapping, which is set up again after it
+    const uint8_t data[] = { 1, 2, 3, 4, 5 };
+    CHECK(region.write(MappedRegion::SECTOR_SIZE - 2, data, sizeof(data)));
+    CHECK(region.data() != nullptr && memcmp(region.data() + MappedRegion::SECTOR_SIZE - 2, data, sizeof(data)) == 0);
+    CHECK(region.write(5 * MappedRegion::SECTOR_SIZE, data, sizeof(data)));
+    CHECK(memcmp(region.data() + 5 * MappedRegion::SECTOR_SIZE, data, sizeof(data)) == 0);
+
+    // Erases are rounded out to whole sectors, a range touching two sectors erases both
+    CHECK(region.erase(MappedRegion::SECTOR_SIZE - 1, 2));
+    CHECK(isErased(region.data(), 2 * MappedRegion::SECTOR_SIZE));
+    CHECK(region.data()[5 * MappedRegion::SECTOR_SIZE] == 1);
+    CHECK(region.erase(5 * MappedRegion::SECTOR_SIZE + 100, 1));
+    CHECK(isErased(region.data(), REGION_SIZE));
+
+    // The contents outlive the region object
+    CHECK(region.write(REGION_SIZE - sizeof(data), data, sizeof(data)));
+    region.close();
+    CHECK(region.data() == nullptr);
+    MappedRegion reopened(path.c_str(), REGION_SIZE);
+    CHECK(reopened.open());
+    CHECK(memcmp(reopened.data() + REGION_SIZE - sizeof(data), data, sizeof(data)) == 0);
+    reopened.close();
+
+    // A file of another size is a new region
+    MappedRegion resized(path.c_str(), REGION_SIZE / 2);
+    CHECK(resized.open());
+    CHECK(isErased(resized.data(), REGION_SIZE / 2));
+}
+
+static StationTable makeStations(const char* prefix)
+{
+    StationTable stations;
+    for (uint8_t id = 0; id < 8; id++)
+    {
+        stations.insert(Station(id, 10 + id, std::string(prefix) + std::to_string(id), id % 2 == 0));
+    }
+    return stations;
+}
+
+static void checkStationNames(Storage& storage, const MappedRegion& region, const char* prefix, int slot)
+{
+    CHECK(storage.getStations().size() == 8);
+    for (const auto& station : storage.getStations())
+    {
+        std::string_view name = storage.getStationName(station);
+        CHECK(name == std::string(prefix) + std::to_string(station.id));
+        CHECK(slotOf(region, name) == slot);
+        CHECK(station.gpio_pin == 10 + station.id);
+    }
+}
+
+int main()
+{
+    std::string dir = makeTestDir("mapped_region");
+    std::string regionPath = dir + "/config.bin";
+    checkRegion(dir + "/region.bin");
+
+    FakeClock clock;
+    {
+        CHECK(system(("mkdir -p " + dir + "/db").c_str()) == 0);
+        PosixStorageBackend backend((dir + "/db").c_str());
+        MappedRegion region(regionPath.c_str(), REGION_SIZE);
+        Storage storage(&backend, &region, &clock);
+        CHECK(region.data() != nullptr);
+
+        // Snapshots go to alternating slots, the strings are read from the new mapping
+        // after every commit
+        CHECK(storage.setStations(makeStations("first ")));
+        checkStationNames(storage, region, "first ", 1);
+        CHECK(storage.setStations(makeStations("second ")));
+        checkStationNames(storage, region, "second ", 0);
+        CHECK(storage.setStations(makeStations("third ")));
+        checkStationNames(storage, region, "third ", 1);
+
+        EventTable events;
+        events.insert(Event(3, {0, 1}, "morning", "0 0 6 * * *", 600));
+        CHECK(storage.setEvents(events));
+        const Event* event = storage.getEvent(3);
+        CHECK(event != nullptr && event->cron_expr.empty());
+        CHECK(storage.getEventName(*event) == "morning" && storage.getEventCron(*event) == "0 0 6 * * *");
+        CHECK(slotOf(region, storage.getEventCron(*event)) >= 2);
+
+        // The snapshots aren't kept on the backend
+        std::vector<uint8_t> buffer;
+        CHECK(!backend.read("stations.a.bin", buffer) && !backend.read("stations.b.bin", buffer));
+        CHECK(!backend.read("events.a.bin", buffer) && !backend.read("events.b.bin", buffer));
+
+        // Edits since the last snapshot keep their strings in RAM
+        CHECK(storage.addStation(Station(20, 30, "added", false)));
+        CHECK(storage.getStationName(*storage.getStation(20)) == "added");
+        CHECK(slotOf(region, storage.getStationName(*storage.getStation(20))) == -1);
+        CHECK(storage.removeStation(20));
+    }
+
+    {
+        // The region alone holds the snapshots, an empty backend loads them
+        CHECK(system(("mkdir -p " + dir + "/empty").c_str()) == 0);
+        PosixStorageBackend backend((dir + "/empty").c_str());
+        MappedRegion region(regionPath.c_str(), REGION_SIZE);
+        Storage storage(&backend, &region, &clock);
+        checkStationNames(storage, region, "third ", 1);
+        CHECK(storage.getEvent(3) != nullptr && storage.getEventCron(*storage.getEvent(3)) == "0 0 6 * * *");
+    }
+
+    {
+        // A torn newest slot falls back to the previous snapshot
+        MappedRegion region(regionPath.c_str(), REGION_SIZE);
+        CHECK(region.open());
+        std::vector<uint8_t> zeros(16, 0);
+        CHECK(region.write(SLOT_SIZE + 8, zeros.data(), zeros.size()));
+        region.close();
+
+        PosixStorageBackend backend((dir + "/empty").c_str());
+        Storage storage(&backend, &region, &clock);
+        checkStationNames(storage, region, "second ", 0);
+    }
+
+    puts("PASS");
+    return 0;
+}
@@ -0,0 +1,307 @@
+#include <chrono>
+#include <new>
+#include <random>
+#include <string.h>
+
+#include "JsonFormat.h"
+#include "WireFormat.h"
+#include "TestUtil.h"
+
+// The JSON and binary message decoders: known messages decode to the expected values,
+// mutated and random input is rejected or decoded without reading out of bounds (each
+// input sits in an exact size heap buffer, so run under ASan to catch overreads), and
+// the decode rate and heap allocations per message are reported.
+static const int NUM_OF_FUZZ_INPUTS = 200000;
+static const int NUM_OF_DECODES = 200000;
+
+static size_t g_allocations = 0;
+
+void* operator new(size_t size)
+{
+    g_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static const char* JSON_SEEDS[] = {
+    "{\"type\":6,\"data\":{\"stations\":[{\"id\":1,\"gpio_pin\":4,\"name\":\"a\\u00e9b\"}],"
+        "\"events\":[{\"id\":2,\"station_ids\":[1],\"name\":\"e\",\"cron_expr\":\"0 * * * * *\",\"duration\":5}]}}",
+    "{\"type\":0,\"data\":\"{\\\"tv_sec\\\":12,\\\"tz_str\\\":\\\"UTC\\\\u0041\\\"}\"}",
+    "{\"type\":3,\"data\":{\"station_id\":1,\"is_on\":true}}",
+    "{\"type\":5,\"data\":{\"from\":1e20,\"to\":-5}}",
+};
+
+// Runs every decoder over the data, as a hostile client could pick any message type
+static void decodeJson(std::vector<char>& buffer)
+{
+    int type;
+    JsonReader data(buffer.data(), 0);
+    if (!jsonDecodeMessage(buffer.data(), buffer.size(), type, data))
+    {
+        return;
+    }
+    SetConfigMessage config;
+    SetTimeMessage time;
+    SetStationStateMessage state;
+    int mode;
+    uint32_t from, to;
+    bool binary;
+    jsonDecodeSetConfig(data, config);
+    jsonDecodeSetTime(data, time);
+    jsonDecodeSetStationState(data, state);
+    jsonDecodeRequestNotify(data, mode);
+    jsonDecodeGetHistory(data, from, to);
+    jsonDecodeSetProtocol(data, binary);
+}
+
+static void decodeWire(const std::vector<uint8_t>& frame)
+{
+    RecordReader reader(frame.data(), frame.size());
+    uint8_t type;
+    RecordReader payload(frame.data(), 0);
+    if (!wireIsFrame(frame.data(), frame.size()) || !wireDecodeFrame(reader, type, payload))
+    {
+        return;
+    }
+    SetConfigMessage config;
+    SetTimeMessage time;
+    SetStationStateMessage state;
+    int mode;
+    uint32_t from, to;
+    bool binary;
+    wireDecodeSetConfig(payload, config);
+    wireDecodeSetTime(payload, time);
+    wireDecodeSetStationState(payload, state);
+    wireDecodeRequestNotify(payload, mode);
+    wireDecodeGetHistory(payload, from, to);
+    wireDecodeSetProtocol(payload, binary);
+}
+
+static std::vector<uint8_t> makeWireSeed(int index)
+{
+    std::vector<uint8_t> frame;
+    switch (index)
+    {
+    case 0:
+    {
+        wireBeginFrame(frame, SET_CONFIG);
+        Station station(1, 4, "", false);
+        wireEncodeStation(frame, station, "station");
+        Event event(2, {1}, "", "", 5);
+        wireEncodeEvent(frame, event, "event", "0 * * * * *");
+        break;
+    }
+    case 1:
+        wireBeginFrame(frame, SET_TIME);
+        wirePutUint(frame, WIRE_TIME_SEC, 12, 8);
+        wirePutBytes(frame, WIRE_TIME_TZ, "UTC", 3);
+        break;
+    case 2:
+        wireBeginFrame(frame, SET_STATION_STATE);
+        wirePutUint(frame, WIRE_STATE_STATION_ID, 1, 1);
+        wirePutUint(frame, WIRE_STATE_IS_ON, 1, 1);
+        break;
+    default:
+        wireBeginFrame(frame, GET_HISTORY);
+        wirePutUint(frame, WIRE_HISTORY_FROM, UINT64_MAX, 8);
+        wirePutUint(frame, WIRE_HISTORY_TO, 5, 4);
+        break;
+    }
+    CHECK(wireFinishFrame(frame));
+    return frame;
+}
+
+// A SET_CONFIG frame with one station and one event
+static bool decodeWireConfig(uint64_t pin, size_t pinWidth, int32_t duration, SetConfigMessage& config)
+{
+    std::vector<uint8_t> frame;
+    wireBeginFrame(frame, SET_CONFIG);
+    size_t start = wireBeginField(frame, WIRE_STATION);
+    wirePutUint(frame, WIRE_STATION_ID, 1, 1);
+    wirePutUint(frame, WIRE_STATION_GPIO_PIN, pin, pinWidth);
+    wirePutBytes(frame, WIRE_STATION_NAME, "a", 1);
+    wireEndField(frame, start);
+    wireEncodeEvent(frame, Event(2, {1}, "", "", duration), "e", "* * * * * *");
+    CHECK(wireFinishFrame(frame));
+    RecordReader reader(frame.data(), frame.size());
+    uint8_t type;
+    RecordReader payload(frame.data(), 0);
+    CHECK(wireDecodeFrame(reader, type, payload) && type == SET_CONFIG);
+    return wireDecodeSetConfig(payload, config);
+}
+
+static void checkKnownMessages()
+{
+    int type;
+    std::string text = JSON_SEEDS[0];
+    std::vector<char> buffer(text.begin(), text.end());
+    JsonReader data(buffer.data(), 0);
+    SetConfigMessage config;
+    CHECK(jsonDecodeMessage(buffer.data(), buffer.size(), type, data) && type == SET_CONFIG);
+    CHECK(jsonDecodeSetConfig(data, config));
+    CHECK(config.stations.size() == 1 && config.stations[0].name == "a\xc3\xa9" "b");
+    CHECK(config.events.size() == 1 && config.events[0].cron_expr == "0 * * * * *" && config.events[0].duration == 5);
+
+    // 'data' as an escaped string
+    text = JSON_SEEDS[1];
+    buffer.assign(text.begin(), text.end());
+    SetTimeMessage time;
+    CHECK(jsonDecodeMessage(buffer.data(), buffer.size(), type, data) && type == SET_TIME);
+    CHECK(jsonDecodeSetTime(data, time) && time.timeval.tv_sec == 12 && time.tz == "UTCA");
+
+    // Out of range numbers saturate
+    text = JSON_SEEDS[3];
+    buffer.assign(text.begin(), text.end());
+    uint32_t from, to;
+    CHECK(jsonDecodeMessage(buffer.data(), buffer.size(), type, data) && type == GET_HISTORY);
+    CHECK(jsonDecodeGetHistory(data, from, to) && from == UINT32_MAX && to == 0);
+
+    // Pins a station can't drive and negative durations reject the whole configuration
+    const char* rejected[] = {
+        "{\"stations\":[{\"id\":1,\"gpio_pin\":300,\"name\":\"a\"}],\"events\":[]}",
+        "{\"stations\":[{\"id\":1,\"gpio_pin\":-1,\"name\":\"a\"}],\"events\":[]}",
+        "{\"stations\":[{\"id\":1,\"gpio_pin\":34,\"name\":\"a\"}],\"events\":[]}",
+        "{\"stations\":[],\"events\":[{\"id\":2,\"station_ids\":[1],\"name\":\"e\",\"cron_expr\":\"* * * * * *\",\"duration\":-5}]}",
+    };
+    for (const char* message : rejected)
+    {
+        buffer.assign(message, message + strlen(message));
+        CHECK(!jsonDecodeSetConfig(JsonReader(buffer.data(), buffer.size()), config));
+    }
+    const char* accepted = "{\"stations\":[{\"id\":1,\"gpio_pin\":33,\"name\":\"a\"}],"
+        "\"events\":[{\"id\":2,\"station_ids\":[1],\"name\":\"e\",\"cron_expr\":\"* * * * * *\",\"duration\":0}]}";
+    buffer.assign(accepted, accepted + strlen(accepted));
+    CHECK(jsonDecodeSetConfig(JsonReader(buffer.data(), buffer.size()), config));
+    CHECK(config.stations[0].gpio_pin == 33 && config.events[0].duration == 0);
+
+    std::vector<uint8_t> frame = makeWireSeed(3);
+    RecordReader reader(frame.data(), frame.size());
+    uint8_t frameType;
+    RecordReader payload(frame.data(), 0);
+    CHECK(wireDecodeFrame(reader, frameType, payload) && frameType == GET_HISTORY);
+    CHECK(wireDecodeGetHistory(payload, from, to) && from == UINT32_MAX && to == 5);
+
+    // Same limits as the JSON decoder, pins used to wrap around in the uint8_t
+    CHECK(!decodeWireConfig(300, 2, 5, config));
+    CHECK(!decodeWireConfig(UINT64_MAX, 8, 5, config));
+    CHECK(!decodeWireConfig(34, 1, 5, config));
+    CHECK(!decodeWireConfig(4, 1, -5, config));
+    CHECK(decodeWireConfig(33, 1, 0, config));
+    CHECK(config.stations[0].gpio_pin == 33 && config.events[0].duration == 0);
+}
+
+static void fuzz(std::mt19937& rng)
+{
+    static const char ALPHABET[] = "{}[]\":,\\u0123456789abcdefe-+.tnrl $\x01\xff";
+    std::vector<uint8_t> wireSeeds[4];
+    for (int i = 0; i < 4; i++)
+    {
+        wireSeeds[i] = makeWireSeed(i);
+    }
+
+    for (int i = 0; i < NUM_OF_FUZZ_INPUTS; i++)
+    {
+        std::string text = JSON_SEEDS[i % 4];
+        int numOfMutations = rng() % 6;
+        for (int k = 0; k < numOfMutations && !text.empty(); k++)
+        {
+            size_t position = rng() % text.size();
+            char c = ALPHABET[rng() % (sizeof(ALPHABET) - 1)];
+            switch (rng() % 3)
+            {
+            case 0:
+                text[position] = c;
+                break;
+            case 1:
+                text.erase(position, 1);
+                break;
+            default:
+                text.insert(position, 1, c);
+                break;
+            }
+        }
+        if (rng() % 5 == 0)
+        {
+            text.resize(rng() % (text.size() + 1));
+        }
+        std::vector<char> buffer(text.begin(), text.end());
+        decodeJson(buffer);
+
+        // Mutated valid frames reach the field decoders, random ones mostly the framing
+        std::vector<uint8_t> frame;
+        if (i % 2 == 0)
+        {
+            frame = wireSeeds[(i / 2) % 4];
+            for (int k = rng() % 4; k > 0; k--)
+            {
+                frame[rng() % frame.size()] = rng();
+            }
+            frame.resize(rng() % (frame.size() + 1));
+        }
+        else
+        {
+            frame.resize(rng() % 64);
+            for (uint8_t& byte : frame)
+            {
+                byte = rng();
+            }
+            if (!frame.empty())
+            {
+                frame[0] = WIRE_MAGIC;
+            }
+        }
+        decodeWire(frame);
+    }
+}
+
+// Decodes copies of one message, as the reassembly buffer is decoded in place
+template <class Decode>
+static void benchmark(const char* name, const std::string& message, Decode decode)
+{
+    std::vector<char> buffer(message.size());
+    size_t allocations = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_OF_DECODES; i++)
+    {
+        memcpy(buffer.data(), message.data(), message.size());
+        int type;
+        JsonReader data(buffer.data(), 0);
+        CHECK(jsonDecodeMessage(buffer.data(), buffer.size(), type, data));
+        CHECK(decode(data));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t perMessage = (g_allocations - allocations) / NUM_OF_DECODES;
+    printf("%s: %.2fM messages/s, %zu heap allocations per message\n", name, NUM_OF_DECODES / seconds / 1e6, perMessage);
+    CHECK(perMessage == 0);
+}
+
+int main()
+{
+    checkKnownMessages();
+    std::mt19937 rng(1);
+    fuzz(rng);
+
+    SetStationStateMessage state;
+    benchmark("SET_STATION_STATE, string data",
+        "{\"type\":3,\"data\":\"{\\\"station_id\\\":1,\\\"is_on\\\":true}\"}",
+        [&](JsonReader data) { return jsonDecodeSetStationState(data, state) && state.is_on; });
+    SetTimeMessage time;
+    benchmark("SET_TIME, inline data",
+        "{\"type\":0,\"data\":{\"tv_sec\":1700000000,\"tv_usec\":0,\"tz_str\":\"CET-1CEST\"}}",
+        [&](JsonReader data) { return jsonDecodeSetTime(data, time) && time.timeval.tv_sec == 1700000000; });
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <random>
+
+#include "WireFormat.h"
+#include "TestUtil.h"
+
+// Layout of the station state frames notified in delta mode, and what a central applying
+// the delta frames to the states of the previous ones ends up with
+
+static StationBits bits(std::initializer_list<int> ids)
+{
+    StationBits result;
+    for (int id : ids)
+    {
+        result[id] = true;
+    }
+    return result;
+}
+
+static void checkFrame(const std::vector<uint8_t>& frame, std::initializer_list<uint8_t> expected)
+{
+    CHECK(frame == std::vector<uint8_t>(expected));
+}
+
+// Applies a frame the way a central does
+static void applyFrame(const std::vector<uint8_t>& frame, StationBits& states)
+{
+    CHECK(frame.size() >= 5);
+    size_t base = frame[3];
+    size_t length = frame[4];
+    CHECK(frame.size() == 5 + 2 * length);
+    for (size_t i = 0; i < length * 8; i++)
+    {
+        if (frame[5 + i / 8] & (1 << (i % 8)))
+        {
+            states[base + i] = (frame[5 + length + i / 8] >> (i % 8)) & 1;
+        }
+    }
+}
+
+int main()
+{
+    std::vector<uint8_t> frame;
+
+    // type | sequence u16 | base | length | mask[length] | states[length]
+    CHECK(wireEncodeStateFrame(frame, 0x1234, true, bits({1, 2, 9}), bits({2}), bits({})));
+    checkFrame(frame, { WIRE_STATE_FRAME_FULL, 0x34, 0x12, 0, 2, 0x06, 0x02, 0x04, 0x00 });
+
+    // A full frame is sent whatever was notified before, even without stations
+    CHECK(wireEncodeStateFrame(frame, 1, true, bits({}), bits({}), bits({})));
+    checkFrame(frame, { WIRE_STATE_FRAME_FULL, 1, 0, 0, 0 });
+
+    // Delta frames only mask what changed since the previous frame, from its byte on
+    CHECK(!wireEncodeStateFrame(frame, 2, false, bits({1, 2}), bits({2}), bits({2})));
+    CHECK(wireEncodeStateFrame(frame, 2, false, bits({1, 2}), bits({1, 2}), bits({2})));
+    checkFrame(frame, { WIRE_STATE_FRAME_DELTA, 2, 0, 0, 1, 0x02, 0x02 });
+    CHECK(wireEncodeStateFrame(frame, 3, false, bits({17, 40}), bits({40}), bits({17})));
+    checkFrame(frame, { WIRE_STATE_FRAME_DELTA, 3, 0, 16, 4, 0x02, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01 });
+    CHECK(wireEncodeStateFrame(frame, 0xFFFF, false, bits({255}), bits({255}), bits({})));
+    checkFrame(frame, { WIRE_STATE_FRAME_DELTA, 0xFF, 0xFF, 248, 1, 0x80, 0x80 });
+
+    // A removed station that was on is sent as switched off
+    CHECK(wireEncodeStateFrame(frame, 4, false, bits({1}), bits({}), bits({5})));
+    checkFrame(frame, { WIRE_STATE_FRAME_DELTA, 4, 0, 0, 1, 0x20, 0x00 });
+
+    // A central that applies every delta frame tracks the states
+    std::mt19937 rng(1);
+    StationBits present, states, notified, central;
+    for (int i = 0; i < 10000; i++)
+    {
+        for (int k = rng() % 4; k > 0; k--)
+        {
+            size_t id = rng() % (rng() % 2 ? 16 : StationTable::MAX_IDS);
+            present[id] = rng() % 4 != 0;
+            states[id] = present[id] && rng() % 2;
+        }
+        if (wireEncodeStateFrame(frame, i, false, present, states, notified))
+        {
+            CHECK(frame[0] == WIRE_STATE_FRAME_DELTA && frame[1] == (i & 0xFF) && frame[2] == ((i >> 8) & 0xFF));
+            applyFrame(frame, central);
+            notified = states;
+        }
+        CHECK(central == states);
+    }
+    // A full frame resyncs a central that lost track
+    central = bits({3, 100});
+    CHECK(wireEncodeStateFrame(frame, 0, true, present, states, notified));
+    applyFrame(frame, central);
+    CHECK((central & present) == states);
+
+    puts("PASS");
+    return 0;
+}
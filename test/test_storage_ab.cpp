@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "DbFormat.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "TestUtil.h"
+
+// Cuts the next stations snapshot short at every byte, as a power loss while it is being
+// written would, and checks that boot always loads either the old or the new table.
+static std::vector<uint8_t> readFile(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data)
+{
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f.write((const char*)data.data(), data.size());
+}
+
+static uint32_t snapshotSequence(const std::vector<uint8_t>& data)
+{
+    uint32_t sequence = 0;
+    uint32_t count = 0;
+    RecordReader reader(data.data(), data.size());
+    return dbCheckSnapshot(reader, DB_TABLE_STATIONS, sequence, count) ? sequence : 0;
+}
+
+// Storage keeps records without their strings, resolves them for comparing
+static StationTable loadedStations(const Storage& storage)
+{
+    StationTable stations;
+    for (Station station : storage.getStations())
+    {
+        station.name = std::string(storage.getStationName(station));
+        stations.set(station);
+    }
+    return stations;
+}
+
+static bool sameStations(const StationTable& a, const StationTable& b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const Station& x, const Station& y) {
+        return x.id == y.id && x.gpio_pin == y.gpio_pin && x.name == y.name && x.is_on == y.is_on;
+    });
+}
+
+int main()
+{
+    std::string dir = makeTestDir("storage_ab");
+    PosixStorageBackend backend(dir.c_str());
+    StationTable oldTable;
+    StationTable newTable;
+    {
+        Storage storage(&backend);
+        for (uint8_t id = 2; id < 12; id++)
+        {
+            CHECK(storage.addStation(Station(id, id, "old " + std::to_string(id), false)));
+        }
+        // Fill both slots
+        CHECK(storage.setStations(storage.getStations()));
+        CHECK(storage.setStations(storage.getStations()));
+        oldTable = loadedStations(storage);
+        CHECK(oldTable.find(2) != nullptr && oldTable.find(2)->name == "old 2");
+        newTable = oldTable;
+        newTable.erase(3);
+        newTable.set(Station(40, 1, "brand new station", true));
+    }
+
+    std::string slotA = dir + "/stations.a.bin";
+    std::string slotB = dir + "/stations.b.bin";
+    std::vector<uint8_t> a = readFile(slotA);
+    std::vector<uint8_t> b = readFile(slotB);
+    uint32_t sequence = std::max(snapshotSequence(a), snapshotSequence(b)) + 1;
+    CHECK(sequence > 1);
+    std::vector<uint8_t> image;
+    dbEncodeSnapshot(image, newTable, sequence);
+    const std::string& target = sequence % 2 ? slotB : slotA;
+
+    size_t loadedOld = 0;
+    size_t loadedNew = 0;
+    for (size_t cut = 0; cut <= image.size(); cut++)
+    {
+        // The backend truncates the slot before writing it, a torn write leaves a prefix
+        std::vector<uint8_t> torn(image.begin(), image.begin() + cut);
+        writeFile(slotA, a);
+        writeFile(slotB, b);
+        writeFile(target, torn);
+
+        Storage storage(&backend);
+        if (sameStations(loadedStations(storage), oldTable))
+        {
+            loadedOld++;
+        }
+        else
+        {
+            CHECK(sameStations(loadedStations(storage), newTable));
+            loadedNew++;
+        }
+    }
+    // Only the complete image commits the new table
+    CHECK(loadedNew == 1);
+    CHECK(loadedOld == image.size());
+
+    // A log left behind by a crash right after a snapshot commit belongs to the old snapshot
+    writeFile(slotA, a);
+    writeFile(slotB, b);
+    {
+        Storage storage(&backend);
+        CHECK(storage.addStation(Station(77, 1, "logged", false)));
+    }
+    writeFile(target, image);
+    {
+        Storage storage(&backend);
+        CHECK(sameStations(loadedStations(storage), newTable));
+        CHECK(storage.getStation(77) == nullptr);
+    }
+
+    printf("PASS: %zu cut points\n", image.size() + 1);
+    return 0;
+}
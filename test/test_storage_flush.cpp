@@ -0,0 +1,83 @@
+#include "FakeClock.h"
+#include "PosixStorageBackend.h"
+#include "Storage.h"
+#include "TestUtil.h"
+
+// State of a station as another Storage opened on the same directory sees it
+static bool isPersistedOn(const std::string& dir, uint32_t id)
+{
+    PosixStorageBackend backend(dir.c_str());
+    FakeClock clock;
+    Storage storage(&backend, nullptr, &clock);
+    const Station* station = storage.getStation(id);
+    CHECK(station != nullptr);
+    return station->is_on;
+}
+
+static void setOn(Storage& storage, uint32_t id, bool on)
+{
+    Station* station = storage.getStation(id);
+    CHECK(station != nullptr);
+    station->is_on = on;
+    storage.markStationDirty(id);
+}
+
+int main()
+{
+    std::string dir = makeTestDir("storage_flush");
+    PosixStorageBackend backend(dir.c_str());
+    FakeClock clock;
+    {
+        Storage storage(&backend, nullptr, &clock);
+        // The empty db gets stations 0 and 1
+        CHECK(storage.getStation(0) != nullptr && storage.getStation(1) != nullptr);
+        CHECK(storage.getMsUntilFlush() == -1);
+
+        // A change is flushed once nothing changed for the quiet period
+        setOn(storage, 0, true);
+        CHECK(storage.getMsUntilFlush() == 5000);
+        clock.advance(4999);
+        CHECK(storage.getMsUntilFlush() == 1);
+        storage.loop();
+        CHECK(!isPersistedOn(dir, 0));
+        clock.advance(1);
+        CHECK(storage.getMsUntilFlush() == 0);
+        storage.loop();
+        CHECK(storage.getMsUntilFlush() == -1);
+        CHECK(isPersistedOn(dir, 0));
+
+        // Every change restarts the quiet period, up to the maximum age of the oldest one
+        setOn(storage, 1, true);
+        for (int i = 0; i < 6; i++)
+        {
+            clock.advance(4000);
+            setOn(storage, 0, i % 2 != 0);
+            CHECK(storage.getMsUntilFlush() == 5000);
+            storage.loop();
+        }
+        CHECK(!isPersistedOn(dir, 1));
+        clock.advance(4000);
+        setOn(storage, 0, false);
+        CHECK(storage.getMsUntilFlush() == 2000);
+        clock.advance(2000);
+        CHECK(storage.getMsUntilFlush() == 0);
+        storage.loop();
+        CHECK(storage.getMsUntilFlush() == -1);
+        CHECK(!isPersistedOn(dir, 0));
+        CHECK(isPersistedOn(dir, 1));
+
+        // Flushing by hand clears the pending changes
+        setOn(storage, 1, false);
+        CHECK(storage.flush());
+        CHECK(storage.getMsUntilFlush() == -1);
+        CHECK(!isPersistedOn(dir, 1));
+
+        // Whatever is pending at shutdown is flushed by the destructor
+        setOn(storage, 0, true);
+    }
+    CHECK(isPersistedOn(dir, 0));
+    CHECK(!isPersistedOn(dir, 1));
+
+    puts("PASS");
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <random>
+#include <string>
+
+#include "WriteReassembler.h"
+#include "TestUtil.h"
+
+// Messages written to a characteristic in chunks of any size come out whole and in order,
+// oversize ones are dropped without losing the next message, and garbage is recovered from
+
+// WRITE_MESSAGE_MAX_SIZE of Bluetooth.cpp
+static const size_t CAPACITY = 16384;
+
+struct Message
+{
+    WriteReassembler::Kind kind;
+    std::string data;
+
+    bool operator==(const Message& other) const { return kind == other.kind && data == other.data; }
+};
+
+typedef std::vector<Message> Messages;
+
+static void feed(WriteReassembler& reassembler, const std::string& chunk, Messages& messages)
+{
+    reassembler.feed((const uint8_t*)chunk.data(), chunk.size(), [&](WriteReassembler::Kind kind, uint8_t* data, size_t size) {
+        messages.push_back({kind, std::string((const char*)data, size)});
+    });
+}
+
+static std::string makeFrame(size_t payloadSize, uint8_t fill)
+{
+    std::vector<uint8_t> frame;
+    wireBeginFrame(frame, SET_CONFIG);
+    std::string value(payloadSize - 3, (char)fill);
+    wirePutBytes(frame, WIRE_STATION, value.data(), value.size());
+    CHECK(wireFinishFrame(frame));
+    return std::string(frame.begin(), frame.end());
+}
+
+static std::string makeJson(std::mt19937& rng, size_t size)
+{
+    // Neither MSG_START_CHAR nor MSG_END_CHAR, and not the frame magic
+    static const char ALPHABET[] = "{}[]\":,abcdefghij0123456789 ";
+    std::string json;
+    for (size_t i = 0; i < size; i++)
+    {
+        json += ALPHABET[rng() % (sizeof(ALPHABET) - 1)];
+    }
+    return json + MSG_END_CHAR;
+}
+
+static void checkSplitJson()
+{
+    const std::string json = "{\"type\":3,\"data\":{\"station_id\":1,\"is_on\":true}}\n";
+    // Every way of cutting the message into three chunks
+    for (size_t i = 1; i < json.size(); i++)
+    {
+        for (size_t j = i; j < json.size(); j++)
+        {
+            WriteReassembler reassembler(CAPACITY);
+            Messages messages;
+            feed(reassembler, json.substr(0, i), messages);
+            if (j > i)
+            {
+                feed(reassembler, json.substr(i, j - i), messages);
+            }
+            CHECK(messages.empty());
+            feed(reassembler, json.substr(j), messages);
+            CHECK(messages.size() == 1 && messages[0] == Message({WriteReassembler::JSON, json}));
+        }
+    }
+
+    // Several messages and the start of the next one in a chunk, with and without MSG_START_CHAR
+    WriteReassembler reassembler(CAPACITY);
+    Messages messages;
+    feed(reassembler, "${\"a\":1}\n{\"b\":2}\n{\"c\"", messages);
+    feed(reassembler, ":3}\n", messages);
+    CHECK(messages.size() == 3);
+    CHECK(messages[0].data == "{\"a\":1}\n" && messages[1].data == "{\"b\":2}\n" && messages[2].data == "{\"c\":3}\n");
+}
+
+static void checkSplitFrame()
+{
+    const std::string frame = makeFrame(40, '$');
+    // The header split at every byte, then the frame fed a byte at a time
+    for (size_t i = 1; i < frame.size(); i++)
+    {
+        WriteReassembler reassembler(CAPACITY);
+        Messages messages;
+        feed(reassembler, frame.substr(0, i), messages);
+        CHECK(messages.empty());
+        feed(reassembler, frame.substr(i), messages);
+        CHECK(messages.size() == 1 && messages[0] == Message({WriteReassembler::BINARY, frame}));
+    }
+    WriteReassembler reassembler(CAPACITY);
+    Messages messages;
+    for (char c : frame + frame)
+    {
+        feed(reassembler, std::string(1, c), messages);
+    }
+    // MSG_START_CHAR starting a chunk inside a frame is data
+    CHECK(messages.size() == 2 && messages[0].data == frame && messages[1].data == frame);
+
+    // A frame followed by a JSON message in the same chunk
+    messages.clear();
+    feed(reassembler, frame + "{}\n", messages);
+    CHECK(messages.size() == 2 && messages[0].kind == WriteReassembler::BINARY && messages[1] == Message({WriteReassembler::JSON, "{}\n"}));
+}
+
+static void checkOversize(std::mt19937& rng)
+{
+    WriteReassembler reassembler(CAPACITY);
+    Messages messages;
+
+    // The largest message fits, one more byte doesn't. The rest of a dropped message is
+    // skipped up to its end, the next message in the same chunk is kept.
+    std::string fits = makeJson(rng, CAPACITY - 1);
+    std::string tooLong = makeJson(rng, CAPACITY);
+    std::string next = makeJson(rng, 10);
+    feed(reassembler, fits, messages);
+    CHECK(messages.size() == 1 && messages[0].data == fits);
+    feed(reassembler, tooLong.substr(0, 1000), messages);
+    feed(reassembler, tooLong.substr(1000, 9000), messages);
+    feed(reassembler, tooLong.substr(10000) + next, messages);
+    CHECK(messages.size() == 2 && messages[1].data == next);
+
+    // An oversize frame is skipped by the size in its header, even when it holds the JSON
+    // terminator, and the frame after it comes out
+    std::string bigFrame = makeFrame(CAPACITY, '\n');
+    std::string frame = makeFrame(10, 'x');
+    CHECK(bigFrame.size() > CAPACITY);
+    feed(reassembler, bigFrame.substr(0, 2), messages);
+    feed(reassembler, bigFrame.substr(2, 5000), messages);
+    feed(reassembler, bigFrame.substr(5002) + frame, messages);
+    CHECK(messages.size() == 3 && messages[2] == Message({WriteReassembler::BINARY, frame}));
+    CHECK(makeFrame(CAPACITY - 4, 'x').size() == CAPACITY);
+    feed(reassembler, makeFrame(CAPACITY - 4, 'x'), messages);
+    CHECK(messages.size() == 4 && messages[3].data.size() == CAPACITY);
+}
+
+static void checkGarbage()
+{
+    WriteReassembler reassembler(CAPACITY);
+    Messages messages;
+
+    // Garbage without a terminator is dropped by MSG_START_CHAR starting a chunk
+    feed(reassembler, "\x01\x02garbage", messages);
+    feed(reassembler, "${\"a\":1}\n", messages);
+    CHECK(messages.size() == 1 && messages[0].data == "{\"a\":1}\n");
+
+    // or by an empty write, after which a frame is recognized again
+    std::string frame = makeFrame(20, 'y');
+    messages.clear();
+    feed(reassembler, "more garbage", messages);
+    feed(reassembler, "", messages);
+    feed(reassembler, frame, messages);
+    CHECK(messages.size() == 1 && messages[0] == Message({WriteReassembler::BINARY, frame}));
+
+    // A truncated frame is dropped by the empty write too
+    messages.clear();
+    feed(reassembler, frame.substr(0, 10), messages);
+    feed(reassembler, "", messages);
+    feed(reassembler, "{}\n", messages);
+    CHECK(messages.size() == 1 && messages[0] == Message({WriteReassembler::JSON, "{}\n"}));
+
+    // Garbage with a terminator comes out as a message for the decoder to reject, the
+    // messages after it are intact
+    messages.clear();
+    feed(reassembler, "\xff\xfe junk\n" + frame + "{}\n", messages);
+    CHECK(messages.size() == 3);
+    CHECK(messages[0].kind == WriteReassembler::JSON && messages[1].data == frame && messages[2].data == "{}\n");
+}
+
+// Random streams of messages, some too long, cut into random chunks
+static void checkRandom(std::mt19937& rng)
+{
+    for (int round = 0; round < 200; round++)
+    {
+        std::string stream;
+        Messages expected;
+        for (int i = 0; i < 20; i++)
+        {
+            size_t size = rng() % 10 == 0 ? CAPACITY - 100 + rng() % 200 : rng() % 300 + 10;
+            Message message;
+            if (rng() % 2)
+            {
+                message = {WriteReassembler::JSON, makeJson(rng, size - 1)};
+            }
+            else
+            {
+                message = {WriteReassembler::BINARY, makeFrame(size - 4, (uint8_t)rng())};
+            }
+            stream += message.data;
+            if (message.data.size() <= CAPACITY)
+            {
+                expected.push_back(message);
+            }
+        }
+        WriteReassembler reassembler(CAPACITY);
+        Messages messages;
+        for (size_t offset = 0; offset < stream.size();)
+        {
+            size_t size = 1 + rng() % (rng() % 4 == 0 ? 2000 : 20);
+            // MSG_START_CHAR starting a chunk restarts a JSON message
+            while (offset + size < stream.size() && stream[offset + size] == MSG_START_CHAR)
+            {
+                size++;
+            }
+            feed(reassembler, stream.substr(offset, size), messages);
+            offset += size;
+        }
+        CHECK(messages == expected);
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    checkSplitJson();
+    checkSplitFrame();
+    checkOversize(rng);
+    checkGarbage();
+    checkRandom(rng);
+    puts("PASS");
+    return 0;
+}